@@ -0,0 +1,142 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <Windows.h>
+
+#include "guid_hash.h"
+
+// the GUID hash from comon.h, which we can't include as it needs the debugger engine headers
+template<> struct std::hash<GUID>
+{
+    std::size_t operator()(const GUID& g) const noexcept {
+        return static_cast<std::size_t>(comon_ext::guid_fingerprint(g));
+    }
+};
+
+// a failed check ends the benchmark with an error, so ctest reports it
+#define BENCH_CHECK(condition) comon_bench::check((condition), #condition, __FILE__, __LINE__)
+
+namespace comon_bench
+{
+inline void check(bool condition, const char* expression, const char* file, int line) {
+    if (!condition) {
+        std::fprintf(stderr, "%s(%d): check failed: %s\n", file, line, expression);
+        std::exit(1);
+    }
+}
+
+struct options
+{
+    // run only the behavior checks, without the timed runs (used by ctest)
+    bool check_only{};
+    // a recorded lookup trace, one GUID per line
+    std::string trace_path{};
+};
+
+inline options parse_options(int argc, char* argv[]) {
+    options opts{};
+    for (int i = 1; i < argc; i++) {
+        if (std::string_view arg{ argv[i] }; arg == "--check") {
+            opts.check_only = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            opts.trace_path = argv[++i];
+        } else {
+            std::fprintf(stderr, "usage: %s [--check] [--trace <file with one GUID per line>]\n", argv[0]);
+            std::exit(2);
+        }
+    }
+    return opts;
+}
+
+// the COM family of well-known IIDs: xxxxxxxx-0000-0000-C000-000000000046
+inline GUID com_family_guid(uint32_t data1) {
+    return { data1, 0, 0, { 0xc0, 0, 0, 0, 0, 0, 0, 0x46 } };
+}
+
+// the CLSIDs of one component (as generated by uuidgen -n), which differ only in Data1
+inline GUID sequential_guid(uint32_t index) {
+    return { 0x5a3b0000 + index, 0x8e2f, 0x4c71, { 0x9d, 0x41, 0x3e, 0x27, 0xb0, 0x6c, 0x18, 0xf5 } };
+}
+
+inline GUID random_guid(std::mt19937_64& rng) {
+    GUID guid{};
+    uint64_t words[2]{ rng(), rng() };
+    std::memcpy(&guid, words, sizeof(GUID));
+    return guid;
+}
+
+// accepts the registry format, with or without the braces
+inline std::optional<GUID> parse_guid(std::string_view text) {
+    if (text.size() >= 2 && text.front() == '{' && text.back() == '}') {
+        text = text.substr(1, text.size() - 2);
+    }
+    if (text.size() != 36) {
+        return std::nullopt;
+    }
+
+    std::string s{ text };
+    unsigned int data1{}, data2{}, data3{}, data4[8]{};
+    if (std::sscanf(s.c_str(), "%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x", &data1, &data2, &data3,
+        &data4[0], &data4[1], &data4[2], &data4[3], &data4[4], &data4[5], &data4[6], &data4[7]) != 11) {
+        return std::nullopt;
+    }
+
+    GUID guid{ data1, static_cast<uint16_t>(data2), static_cast<uint16_t>(data3), {} };
+    for (size_t i = 0; i < 8; i++) {
+        guid.Data4[i] = static_cast<uint8_t>(data4[i]);
+    }
+    return guid;
+}
+
+inline std::vector<GUID> read_trace(const std::string& path) {
+    std::ifstream file{ path };
+    BENCH_CHECK(file.is_open());
+
+    std::vector<GUID> trace{};
+    for (std::string line{}; std::getline(file, line);) {
+        if (auto end{ line.find_last_not_of(" \t\r") }; end != std::string::npos) {
+            line.erase(end + 1);
+        }
+        if (auto guid{ parse_guid(line) }; guid) {
+            trace.push_back(*guid);
+        }
+    }
+    return trace;
+}
+
+// nanoseconds per operation of a single run of f
+template<typename F>
+double measure_ns(size_t operations, F&& f) {
+    using namespace std::chrono;
+    auto start{ steady_clock::now() };
+    std::forward<F>(f)();
+    return static_cast<double>(duration_cast<nanoseconds>(steady_clock::now() - start).count()) / static_cast<double>(operations);
+}
+}
@@ -0,0 +1,442 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/*
+ * Benchmarks and behavior checks of the cometa caches (cache.h):
+ * - the pooled LFU against the previous std::map-of-unordered_sets LFU,
+ * - the hit rate of the LFU with and without frequency aging on a long session,
+ * - the hit rate and lookup time of every policy on synthetic (or recorded) IID lookup traces.
+*/
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "bench.h"
+#include "legacy_lfu_cache.h"
+
+#include "cache.h"
+
+using namespace comon_ext;
+using namespace comon_bench;
+
+namespace
+{
+using value_t = uint32_t;
+
+template<template<typename> typename Policy>
+using guid_cache = cache<GUID, value_t, Policy>;
+
+constexpr size_t type_cache_capacity{ 100 };
+
+constexpr std::array all_policies{ cache_policy::lfu, cache_policy::lru, cache_policy::arc, cache_policy::s3fifo, cache_policy::wtinylfu };
+
+const char* policy_name(cache_policy policy) {
+    switch (policy) {
+    case cache_policy::lfu: return "lfu";
+    case cache_policy::lru: return "lru";
+    case cache_policy::arc: return "arc";
+    case cache_policy::s3fifo: return "s3fifo";
+    case cache_policy::wtinylfu: return "wtinylfu";
+    default: return "unknown";
+    }
+}
+
+/* *** TRACES *** */
+
+// picks indexes of a working set with a Zipf-like skew (the first interfaces are the most popular)
+class zipf_picker
+{
+    std::discrete_distribution<size_t> _distribution;
+
+public:
+    zipf_picker(size_t count, double exponent): _distribution{ make_distribution(count, exponent) } {}
+
+    static std::discrete_distribution<size_t> make_distribution(size_t count, double exponent) {
+        std::vector<double> weights(count);
+        for (size_t i = 0; i < count; i++) {
+            weights[i] = 1.0 / std::pow(static_cast<double>(i + 1), exponent);
+        }
+        return { std::begin(weights), std::end(weights) };
+    }
+
+    size_t operator()(std::mt19937_64& rng) { return _distribution(rng); }
+};
+
+/*
+ * A long session of the type cache: when the monitor attaches, the DllGetClassObject storm hammers
+ * a few dozen interfaces (IUnknown, IClassFactory and the like). Later lookups come from the traced
+ * interfaces, a working set that drifts from phase to phase, interleaved with !comon status scans
+ * that touch each of many vtables once.
+*/
+std::vector<GUID> session_trace(size_t phases) {
+    constexpr uint32_t storm_keys{ 60 };
+    constexpr size_t storm_lookups{ 20'000 };
+    constexpr uint32_t working_set{ 120 };
+    constexpr uint32_t drift{ 40 };
+    constexpr size_t phase_lookups{ 20'000 };
+    constexpr uint32_t scan_keys{ 500 };
+
+    std::mt19937_64 rng{ 0x636f6d6f6e };
+    std::vector<GUID> trace{};
+
+    std::uniform_int_distribution<uint32_t> storm{ 0, storm_keys - 1 };
+    for (size_t i = 0; i < storm_lookups; i++) {
+        trace.push_back(com_family_guid(storm(rng)));
+    }
+
+    zipf_picker traced{ working_set, 0.8 };
+    for (uint32_t phase = 0; phase < phases; phase++) {
+        for (size_t i = 0; i < phase_lookups; i++) {
+            if (i == phase_lookups / 2) {
+                for (uint32_t k = 0; k < scan_keys; k++) {
+                    trace.push_back(random_guid(rng));
+                }
+            }
+            trace.push_back(sequential_guid(phase * drift + static_cast<uint32_t>(traced(rng))));
+        }
+    }
+    return trace;
+}
+
+// !comon status over thousands of vtables, with a small set of interfaces looked up in between
+std::vector<GUID> scan_trace() {
+    std::mt19937_64 rng{ 0x7363616e };
+    std::uniform_int_distribution<uint32_t> hot{ 0, 19 };
+    std::vector<GUID> trace{};
+    for (uint32_t round = 0; round < 20; round++) {
+        for (uint32_t i = 0; i < 5'000; i++) {
+            trace.push_back(sequential_guid(100'000 + i));
+            if (i % 4 == 0) {
+                trace.push_back(com_family_guid(hot(rng)));
+            }
+        }
+    }
+    return trace;
+}
+
+// a breakpoint loop on a handful of interfaces
+std::vector<GUID> loop_trace() {
+    std::mt19937_64 rng{ 0x6c6f6f70 };
+    std::uniform_int_distribution<uint32_t> loop{ 0, 7 };
+    std::vector<GUID> trace{};
+    for (size_t i = 0; i < 200'000; i++) {
+        trace.push_back(sequential_guid(loop(rng)));
+    }
+    return trace;
+}
+
+/* *** REPLAY *** */
+
+uint64_t sink{};
+
+// looks up the trace the way cometa does: a miss loads the metadata and inserts it
+template<typename Cache>
+size_t replay(Cache& c, std::span<const GUID> trace) {
+    size_t hits{};
+    for (const auto& key : trace) {
+        if (c.contains(key)) {
+            sink += c.get(key);
+            hits++;
+        } else {
+            c.insert(key, key.Data1);
+        }
+    }
+    return hits;
+}
+
+template<typename Cache>
+double hit_rate(Cache&& c, std::span<const GUID> trace) {
+    return static_cast<double>(replay(c, trace)) / static_cast<double>(trace.size());
+}
+
+template<typename MakeCache>
+double replay_ns(MakeCache make_cache, std::span<const GUID> trace, size_t runs) {
+    double best{ std::numeric_limits<double>::max() };
+    for (size_t run = 0; run < runs; run++) {
+        auto c{ make_cache() };
+        best = std::min(best, measure_ns(trace.size(), [&c, trace]() { replay(c, trace); }));
+    }
+    return best;
+}
+
+/* *** BEHAVIOR CHECKS *** */
+
+GUID nth_key(uint32_t i) { return sequential_guid(i); }
+
+// random operations compared with a map of the values last stored for each key
+template<template<typename> typename Policy>
+void check_against_reference(size_t capacity) {
+    std::mt19937_64 rng{ capacity };
+    std::uniform_int_distribution<uint32_t> keys{ 0, static_cast<uint32_t>(capacity * 3) };
+    std::uniform_int_distribution<int> ops{ 0, 9 };
+
+    guid_cache<Policy> c{ capacity };
+    std::map<uint32_t, value_t> stored{};
+    cache_stats expected{};
+
+    for (value_t step = 0; step < 50'000; step++) {
+        auto k{ keys(rng) };
+        if (auto op{ ops(rng) }; op < 6) {
+            if (c.contains(nth_key(k))) {
+                BENCH_CHECK(c.get(nth_key(k)) == stored.at(k));
+                expected.hits++;
+            }
+        } else if (op < 9) {
+            bool cached{ c.contains(nth_key(k)) };
+            bool full{ c.size() == capacity };
+            c.insert(nth_key(k), step);
+            BENCH_CHECK(c.contains(nth_key(k)));
+            if (!cached) {
+                stored[k] = step;
+                expected.inserts++;
+                expected.evictions += full ? 1 : 0;
+            }
+        } else {
+            bool cached{ c.contains(nth_key(k)) };
+            bool full{ c.size() == capacity };
+            c.insert_or_assign(nth_key(k), step);
+            stored[k] = step;
+            expected.updates += cached ? 1 : 0;
+            expected.inserts += cached ? 0 : 1;
+            expected.evictions += !cached && full ? 1 : 0;
+        }
+
+        BENCH_CHECK(c.size() <= capacity);
+        if (step % 1'000 == 0) {
+            size_t cached{};
+            for (const auto& [stored_key, value] : stored) {
+                if (c.contains(nth_key(stored_key))) {
+                    BENCH_CHECK(c.get(nth_key(stored_key)) == value);
+                    expected.hits++;
+                    cached++;
+                }
+            }
+            BENCH_CHECK(cached == c.size());
+        }
+    }
+
+    const auto& stats{ c.stats() };
+    BENCH_CHECK(stats.hits == expected.hits && stats.inserts == expected.inserts &&
+        stats.updates == expected.updates && stats.evictions == expected.evictions);
+
+    c.clear();
+    BENCH_CHECK(c.size() == 0 && !c.contains(nth_key(0)));
+    c.insert(nth_key(0), 1);
+    BENCH_CHECK(c.contains(nth_key(0)) && c.get(nth_key(0)) == 1);
+}
+
+// one-hit keys must not flush the entries that were looked up repeatedly
+template<template<typename> typename Policy>
+bool survives_scan() {
+    guid_cache<Policy> c{ 10 };
+    for (uint32_t i = 0; i < 2; i++) {
+        c.insert(nth_key(i), i);
+        for (int hit = 0; hit < 4; hit++) {
+            c.get(nth_key(i));
+        }
+    }
+    for (uint32_t i = 1'000; i < 1'100; i++) {
+        c.insert(nth_key(i), i);
+    }
+    return c.contains(nth_key(0)) && c.contains(nth_key(1));
+}
+
+void check_policies() {
+    for (size_t capacity : { 1, 2, 7, 100 }) {
+        check_against_reference<lfu_policy>(capacity);
+        check_against_reference<lru_policy>(capacity);
+        check_against_reference<arc_policy>(capacity);
+        check_against_reference<s3fifo_policy>(capacity);
+        check_against_reference<wtinylfu_policy>(capacity);
+    }
+
+    {
+        // LRU evicts the least recently used key
+        guid_cache<lru_policy> c{ 2 };
+        c.insert(nth_key(0), 0);
+        c.insert(nth_key(1), 1);
+        c.get(nth_key(0));
+        c.insert(nth_key(2), 2);
+        BENCH_CHECK(c.contains(nth_key(0)) && !c.contains(nth_key(1)) && c.contains(nth_key(2)));
+    }
+
+    {
+        // LFU evicts the least frequently used key, and the least recently touched one among equals
+        guid_cache<lfu_policy> c{ 3, 0 };
+        c.insert(nth_key(0), 0);
+        c.insert(nth_key(1), 1);
+        c.insert(nth_key(2), 2);
+        c.get(nth_key(0));
+        c.get(nth_key(2));
+        c.insert(nth_key(3), 3);
+        BENCH_CHECK(!c.contains(nth_key(1)));
+        c.get(nth_key(3));
+        c.insert(nth_key(4), 4);
+        BENCH_CHECK(!c.contains(nth_key(0)) && c.contains(nth_key(2)) && c.contains(nth_key(3)));
+    }
+
+    {
+        // an entry hot only at the start stays forever without aging, and is evicted with it
+        auto stale_entry_cached = [](size_t aging_period) {
+            guid_cache<lfu_policy> c{ 2, aging_period };
+            c.insert(nth_key(0), 0);
+            for (int i = 0; i < 50; i++) {
+                c.get(nth_key(0));
+            }
+            for (uint32_t round = 0; round < 20; round++) {
+                c.insert(nth_key(1 + round), 1);
+                for (int i = 0; i < 10; i++) {
+                    c.get(nth_key(1 + round));
+                }
+            }
+            return c.contains(nth_key(0));
+        };
+        BENCH_CHECK(stale_entry_cached(0));
+        BENCH_CHECK(!stale_entry_cached(20));
+    }
+
+    BENCH_CHECK(!survives_scan<lru_policy>());
+    BENCH_CHECK(survives_scan<lfu_policy>());
+    BENCH_CHECK(survives_scan<arc_policy>());
+    BENCH_CHECK(survives_scan<s3fifo_policy>());
+    BENCH_CHECK(survives_scan<wtinylfu_policy>());
+
+    {
+        policy_cache<GUID, value_t> c{ cache_policy::lfu, 10 };
+        BENCH_CHECK(c.policy() == cache_policy::lfu && c.aging_period() == lfu_policy<GUID>::default_aging_factor * 10);
+        c.insert(nth_key(0), 0);
+        for (auto policy : all_policies) {
+            c.reset(policy, 20, 5);
+            BENCH_CHECK(c.policy() == policy && c.capacity() == 20 && c.size() == 0 && c.stats().inserts == 0);
+            BENCH_CHECK(policy == cache_policy::lfu ? c.aging_period() == 5 : !c.aging_period());
+            c.insert_or_assign(nth_key(1), 1);
+            c.insert_or_assign(nth_key(1), 2);
+            BENCH_CHECK(c.get(nth_key(1)) == 2 && c.stats().updates == 1);
+        }
+    }
+
+    bool rejected{};
+    try {
+        guid_cache<lru_policy> c{ 0 };
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    BENCH_CHECK(rejected);
+}
+
+/* *** BENCHMARKS *** */
+
+// user-visible replay results of every policy for the capacities we care about
+void print_policy_hit_rates(const char* name, std::span<const GUID> trace) {
+    std::printf("\n%s (%zu lookups), hit rate:\n%-10s", name, trace.size(), "capacity");
+    for (auto policy : all_policies) {
+        std::printf("%10s", policy_name(policy));
+    }
+    std::printf("\n");
+    for (size_t capacity : { 50, 100, 200 }) {
+        std::printf("%-10zu", capacity);
+        for (auto policy : all_policies) {
+            std::printf("%9.1f%%", 100 * hit_rate(policy_cache<GUID, value_t>{ policy, capacity }, trace));
+        }
+        std::printf("\n");
+    }
+}
+
+void print_policy_times(std::span<const GUID> trace, size_t runs) {
+    std::printf("\nsession trace, ns per lookup (capacity %zu):\n", type_cache_capacity);
+    std::printf("  %-18s %6.1f\n", "lfu (before)",
+        replay_ns([]() { return legacy_lfu_cache<GUID, value_t>{ type_cache_capacity }; }, trace, runs));
+    std::printf("  %-18s %6.1f\n", "lfu",
+        replay_ns([]() { return guid_cache<lfu_policy>{ type_cache_capacity }; }, trace, runs));
+    std::printf("  %-18s %6.1f\n", "lru",
+        replay_ns([]() { return guid_cache<lru_policy>{ type_cache_capacity }; }, trace, runs));
+    std::printf("  %-18s %6.1f\n", "arc",
+        replay_ns([]() { return guid_cache<arc_policy>{ type_cache_capacity }; }, trace, runs));
+    std::printf("  %-18s %6.1f\n", "s3fifo",
+        replay_ns([]() { return guid_cache<s3fifo_policy>{ type_cache_capacity }; }, trace, runs));
+    std::printf("  %-18s %6.1f\n", "wtinylfu",
+        replay_ns([]() { return guid_cache<wtinylfu_policy>{ type_cache_capacity }; }, trace, runs));
+    std::printf("  %-18s %6.1f\n", "policy_cache (lfu)",
+        replay_ns([]() { return policy_cache<GUID, value_t>{ cache_policy::lfu, type_cache_capacity }; }, trace, runs));
+}
+
+// the LFU operations alone: hits on resident keys, and inserts that evict
+void print_lfu_operation_times(size_t runs) {
+    std::vector<GUID> resident{}, evicting{};
+    for (uint32_t i = 0; i < 1'000'000; i++) {
+        resident.push_back(nth_key(i % type_cache_capacity));
+        evicting.push_back(nth_key(i));
+    }
+
+    auto measure = [runs](auto make_cache, std::span<const GUID> keys) {
+        return replay_ns(make_cache, keys, runs);
+    };
+    std::printf("\nLFU ns per operation (capacity %zu):\n%-14s%12s%12s\n", type_cache_capacity, "", "get", "insert");
+    std::printf("%-14s%12.1f%12.1f\n", "before",
+        measure([]() { return legacy_lfu_cache<GUID, value_t>{ type_cache_capacity }; }, resident),
+        measure([]() { return legacy_lfu_cache<GUID, value_t>{ type_cache_capacity }; }, evicting));
+    std::printf("%-14s%12.1f%12.1f\n", "pooled",
+        measure([]() { return guid_cache<lfu_policy>{ type_cache_capacity, 0 }; }, resident),
+        measure([]() { return guid_cache<lfu_policy>{ type_cache_capacity, 0 }; }, evicting));
+}
+}
+
+int main(int argc, char* argv[]) {
+    auto opts{ parse_options(argc, argv) };
+
+    check_policies();
+    std::printf("cache policy checks passed\n");
+
+    auto session{ session_trace(opts.check_only ? 10 : 50) };
+
+    // aging must let the traced working set replace the interfaces that were hot only while attaching
+    std::printf("\nsession trace (%zu lookups), LFU hit rate by aging period (capacity %zu):\n", session.size(), type_cache_capacity);
+    double no_aging{}, default_aging{};
+    for (size_t aging_period : { size_t{ 0 }, 2 * type_cache_capacity, 10 * type_cache_capacity, 50 * type_cache_capacity }) {
+        auto rate{ hit_rate(guid_cache<lfu_policy>{ type_cache_capacity, aging_period }, session) };
+        if (aging_period == 0) {
+            no_aging = rate;
+        } else if (aging_period == lfu_policy<GUID>::default_aging_factor * type_cache_capacity) {
+            default_aging = rate;
+        }
+        std::printf("  %-8zu %5.1f%%\n", aging_period, 100 * rate);
+    }
+    BENCH_CHECK(default_aging > no_aging);
+
+    print_policy_hit_rates("session trace", session);
+    print_policy_hit_rates("status scan trace", scan_trace());
+    print_policy_hit_rates("breakpoint loop trace", loop_trace());
+    if (!opts.trace_path.empty()) {
+        auto recorded{ read_trace(opts.trace_path) };
+        BENCH_CHECK(!recorded.empty());
+        print_policy_hit_rates(opts.trace_path.c_str(), recorded);
+    }
+
+    if (!opts.check_only) {
+        print_lfu_operation_times(5);
+        print_policy_times(session, 5);
+    }
+
+    std::printf("\n(%llu)\n", static_cast<unsigned long long>(sink % 10));
+    return 0;
+}
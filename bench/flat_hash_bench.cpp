@@ -0,0 +1,273 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/*
+ * Benchmarks and behavior checks of the flat GUID hash map (flat_hash.h) and the GUID hash (guid_hash.h).
+ * The GUID families we meet in practice are compared with the previous std::unordered_map keyed by
+ * the XOR of the four GUID words: the probe lengths (keys compared per lookup) and the lookup times.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "bench.h"
+
+#include "flat_hash.h"
+
+using namespace comon_ext;
+using namespace comon_bench;
+
+namespace
+{
+using value_t = uint32_t;
+
+// the std::hash<GUID> of comon.h before the strong hash
+struct xor_guid_hash
+{
+    std::size_t operator()(const GUID& g) const noexcept {
+        uint32_t words[4]{};
+        std::memcpy(words, &g, sizeof(GUID));
+        return words[0] ^ words[1] ^ words[2] ^ words[3];
+    }
+};
+
+// counts the key comparisons, which are the probes of the flat map
+struct counting_equal
+{
+    static inline size_t comparisons{};
+
+    bool operator()(const GUID& a, const GUID& b) const {
+        comparisons++;
+        return a == b;
+    }
+};
+
+struct distribution
+{
+    const char* name;
+    std::vector<GUID> keys;
+    // keys of the same family that are not in the map
+    std::vector<GUID> missing;
+};
+
+std::vector<distribution> make_distributions(uint32_t count) {
+    std::mt19937_64 rng{ 0x67756964 };
+    distribution com{ "COM family", {}, {} }, sequential{ "sequential", {}, {} }, random{ "random", {}, {} }, mixed{ "mixed", {}, {} };
+    for (uint32_t i = 0; i < count; i++) {
+        com.keys.push_back(com_family_guid(i));
+        com.missing.push_back(com_family_guid(count + i));
+        sequential.keys.push_back(sequential_guid(i));
+        sequential.missing.push_back(sequential_guid(count + i));
+        random.keys.push_back(random_guid(rng));
+        random.missing.push_back(random_guid(rng));
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        mixed.keys.push_back(i % 3 == 0 ? com.keys[i] : i % 3 == 1 ? sequential.keys[i] : random.keys[i]);
+        mixed.missing.push_back(i % 3 == 0 ? com.missing[i] : i % 3 == 1 ? sequential.missing[i] : random.missing[i]);
+    }
+    return { com, sequential, random, mixed };
+}
+
+template<typename Map>
+Map make_map(std::span<const GUID> keys) {
+    Map map{};
+    map.reserve(keys.size());
+    for (const auto& key : keys) {
+        map.insert({ key, key.Data1 });
+    }
+    return map;
+}
+
+struct probe_lengths
+{
+    double hit;
+    double miss;
+};
+
+probe_lengths flat_probes(std::span<const GUID> keys, std::span<const GUID> missing) {
+    auto map{ make_map<flat_hash_map<GUID, value_t, std::hash<GUID>, counting_equal>>(keys) };
+    counting_equal::comparisons = 0;
+    for (const auto& key : keys) {
+        BENCH_CHECK(map.contains(key));
+    }
+    auto hit{ static_cast<double>(counting_equal::comparisons) / static_cast<double>(keys.size()) };
+
+    counting_equal::comparisons = 0;
+    for (const auto& key : missing) {
+        BENCH_CHECK(!map.contains(key));
+    }
+    return { hit, static_cast<double>(counting_equal::comparisons) / static_cast<double>(missing.size()) };
+}
+
+// a chained table compares the keys of the bucket up to the match (or all of them on a miss)
+template<typename Hash>
+probe_lengths chained_probes(std::span<const GUID> keys, std::span<const GUID> missing) {
+    auto map{ make_map<std::unordered_map<GUID, value_t, Hash>>(keys) };
+    size_t hit{};
+    for (const auto& key : keys) {
+        auto b{ map.bucket(key) };
+        for (auto iter{ map.begin(b) }; iter != map.end(b); ++iter) {
+            hit++;
+            if (iter->first == key) {
+                break;
+            }
+        }
+    }
+    size_t miss{};
+    for (const auto& key : missing) {
+        miss += map.bucket_size(map.bucket(key));
+    }
+    return { static_cast<double>(hit) / static_cast<double>(keys.size()), static_cast<double>(miss) / static_cast<double>(missing.size()) };
+}
+
+uint64_t sink{};
+
+template<typename Map>
+double lookup_ns(std::span<const GUID> keys, std::span<const GUID> lookups, size_t runs) {
+    auto map{ make_map<Map>(keys) };
+    double best{ std::numeric_limits<double>::max() };
+    for (size_t run = 0; run < runs; run++) {
+        best = std::min(best, measure_ns(lookups.size(), [&map, lookups]() {
+            for (const auto& key : lookups) {
+                if (auto iter{ map.find(key) }; iter != std::end(map)) {
+                    sink += iter->second;
+                }
+            }
+        }));
+    }
+    return best;
+}
+
+// random operations compared with std::unordered_map, with enough erases to fill the groups with tombstones
+void check_flat_hash() {
+    std::mt19937_64 rng{ 0x666c6174 };
+    std::uniform_int_distribution<uint32_t> keys{ 0, 4'000 };
+    std::uniform_int_distribution<int> ops{ 0, 9 };
+
+    flat_hash_map<GUID, value_t> map{};
+    flat_hash_set<GUID> set{};
+    std::unordered_map<GUID, value_t> reference{};
+
+    for (value_t step = 0; step < 200'000; step++) {
+        auto key{ step % 2 == 0 ? com_family_guid(keys(rng)) : sequential_guid(keys(rng)) };
+        if (auto op{ ops(rng) }; op < 4) {
+            auto inserted{ map.insert({ key, step }).second };
+            BENCH_CHECK(inserted == reference.insert({ key, step }).second);
+            BENCH_CHECK(set.insert(key).second == inserted);
+        } else if (op < 5) {
+            map.insert_or_assign(key, step);
+            reference.insert_or_assign(key, step);
+            set.insert(key);
+        } else if (op < 8) {
+            auto erased{ map.erase(key) };
+            BENCH_CHECK(erased == reference.erase(key));
+            BENCH_CHECK(set.erase(key) == erased);
+        } else {
+            auto iter{ map.find(key) };
+            auto expected{ reference.find(key) };
+            BENCH_CHECK((iter == std::end(map)) == (expected == std::end(reference)));
+            BENCH_CHECK(iter == std::end(map) || iter->second == expected->second);
+            BENCH_CHECK(set.contains(key) == (iter != std::end(map)));
+        }
+
+        if (step % 10'000 == 0) {
+            BENCH_CHECK(map.size() == reference.size() && set.size() == reference.size());
+            size_t visited{};
+            for (const auto& [k, v] : map) {
+                BENCH_CHECK(reference.at(k) == v && set.contains(k));
+                visited++;
+            }
+            BENCH_CHECK(visited == reference.size());
+        }
+    }
+
+    // erasing while iterating returns the next element
+    for (auto iter{ std::begin(map) }; iter != std::end(map);) {
+        iter = iter->second % 2 == 0 ? map.erase(iter) : std::next(iter);
+    }
+    BENCH_CHECK(std::ranges::all_of(map, [](const auto& slot) { return slot.second % 2 == 1; }));
+
+    map.clear();
+    BENCH_CHECK(map.empty() && std::begin(map) == std::end(map) && !map.contains(com_family_guid(0)));
+    map[com_family_guid(0)] = 1;
+    BENCH_CHECK(map.size() == 1 && map[com_family_guid(0)] == 1);
+
+    flat_hash_set<GUID> listed{ com_family_guid(1), com_family_guid(2), com_family_guid(1) };
+    BENCH_CHECK(listed.size() == 2 && listed.count(com_family_guid(2)) == 1);
+}
+}
+
+int main(int argc, char* argv[]) {
+    auto opts{ parse_options(argc, argv) };
+
+    check_flat_hash();
+    std::printf("flat hash checks passed\n");
+
+    constexpr uint32_t key_count{ 60'000 };
+    auto distributions{ make_distributions(key_count) };
+    if (!opts.trace_path.empty()) {
+        distribution recorded{ "recorded", {}, {} };
+        std::unordered_set<GUID> unique{};
+        for (const auto& key : read_trace(opts.trace_path)) {
+            if (unique.insert(key).second) {
+                recorded.keys.push_back(key);
+            }
+        }
+        std::mt19937_64 rng{ 0x74726163 };
+        for (size_t i = 0; i < recorded.keys.size(); i++) {
+            recorded.missing.push_back(random_guid(rng));
+        }
+        BENCH_CHECK(!recorded.keys.empty());
+        distributions.push_back(std::move(recorded));
+    }
+
+    std::printf("\nkeys compared per lookup (%u keys), hit / miss:\n%-12s%18s%18s%18s\n", key_count, "",
+        "flat (strong)", "chained (xor)", "chained (strong)");
+    for (const auto& [name, keys, missing] : distributions) {
+        auto flat{ flat_probes(keys, missing) };
+        auto chained_xor{ chained_probes<xor_guid_hash>(keys, missing) };
+        auto chained_strong{ chained_probes<std::hash<GUID>>(keys, missing) };
+        std::printf("%-12s%9.2f /%6.2f%9.2f /%6.2f%9.2f /%6.2f\n", name, flat.hit, flat.miss,
+            chained_xor.hit, chained_xor.miss, chained_strong.hit, chained_strong.miss);
+
+        // the strong hash spreads every family, so a lookup rarely compares more than the matching key
+        BENCH_CHECK(flat.hit < 1.25 && flat.miss < 0.5);
+    }
+
+    if (!opts.check_only) {
+        std::printf("\nns per lookup, hit / miss:\n%-12s%18s%18s%18s\n", "",
+            "flat (strong)", "chained (xor)", "chained (strong)");
+        for (const auto& [name, keys, missing] : distributions) {
+            constexpr size_t runs{ 10 };
+            std::printf("%-12s%9.1f /%6.1f%9.1f /%6.1f%9.1f /%6.1f\n", name,
+                lookup_ns<flat_hash_map<GUID, value_t>>(keys, keys, runs),
+                lookup_ns<flat_hash_map<GUID, value_t>>(keys, missing, runs),
+                lookup_ns<std::unordered_map<GUID, value_t, xor_guid_hash>>(keys, keys, runs),
+                lookup_ns<std::unordered_map<GUID, value_t, xor_guid_hash>>(keys, missing, runs),
+                lookup_ns<std::unordered_map<GUID, value_t>>(keys, keys, runs),
+                lookup_ns<std::unordered_map<GUID, value_t>>(keys, missing, runs));
+        }
+    }
+
+    std::printf("\n(%llu)\n", static_cast<unsigned long long>(sink % 10));
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <utility>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <cassert>
+#include <stdexcept>
+
+namespace comon_bench
+{
+// lfu_cache before the pooled frequency buckets, kept as the baseline of the benchmarks
+template<typename K, typename O>
+class legacy_lfu_cache
+{
+    const size_t _capacity;
+    std::unordered_map<K, std::pair<O, int32_t>> _cache{};
+    std::map<int, std::unordered_set<K>> _cache_freqs{};
+
+    void discard_from_frequency(int32_t freq, const K& key) {
+        assert(_cache_freqs.contains(freq));
+        auto& freqs{ _cache_freqs[freq] };
+        assert(freqs.contains(key));
+        freqs.erase(key);
+
+        if (freqs.empty()) {
+            _cache_freqs.erase(freq);
+        }
+    }
+
+    void add_to_frequency(int32_t freq, const K& key) {
+        if (auto freqs_iter{ _cache_freqs.find(freq) }; freqs_iter == std::end(_cache_freqs)) {
+            _cache_freqs.emplace(std::make_pair(freq, std::unordered_set<K>{key}));
+        } else {
+            freqs_iter->second.insert(key);
+        }
+    }
+
+    K extract_least_frequent() {
+        assert(!_cache_freqs.empty());
+        auto freqs_iter{ std::begin(_cache_freqs) };
+
+        auto& freqs{ freqs_iter->second };
+        assert(!freqs.empty());
+        auto key_iter{ std::begin(freqs) };
+        auto res{ *key_iter };
+        freqs.erase(key_iter);
+
+        if (freqs.empty()) {
+            _cache_freqs.erase(freqs_iter);
+        }
+        return res;
+    }
+
+public:
+    legacy_lfu_cache(size_t capacity): _capacity{ capacity } {
+        if (capacity <= 0) {
+            throw std::invalid_argument{ "capacity" };
+        }
+    }
+
+    bool contains(const K& key) const {
+        return _cache.contains(key);
+    }
+
+    const O& get(const K& key) {
+        assert(_cache.contains(key));
+        auto& elem{ _cache[key] };
+
+        auto freq{ elem.second };
+        auto new_freq{ freq + 1 };
+
+        elem.second = new_freq;
+        discard_from_frequency(freq, key);
+        add_to_frequency(new_freq, key);
+
+        return elem.first;
+    }
+
+    void insert(const K& key, const O& data) {
+        if (!_cache.contains(key)) {
+            if (_cache.size() >= _capacity) {
+                // we need to free some space
+                assert(_cache.size() == _capacity);
+                _cache.erase(extract_least_frequent());
+            }
+            _cache.emplace(std::make_pair(key, std::make_pair(data, 1)));
+            add_to_frequency(1, key);
+        }
+    }
+
+    void clear() {
+        _cache_freqs.clear();
+        _cache.clear();
+    }
+};
+}
@@ -54,7 +54,7 @@ class call_context
 
 public:
     struct arg_val {
-        std::wstring type;
+        std::wstring_view type;
         ULONG64 value;
     };
 
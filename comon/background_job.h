@@ -0,0 +1,85 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stop_token>
+#include <thread>
+
+#include <Windows.h>
+
+#include <wil/result.h>
+
+#include "comon.h"
+
+namespace comon_ext
+{
+
+/*
+ * Runs a function on a background thread. The function gets a logger that buffers its messages, as only
+ * the engine thread may write to the debugger output, and a stop token set by cancel (or when the job
+ * is destroyed, which waits for the function to return).
+*/
+class background_job
+{
+    const std::shared_ptr<output_buffer> _output{ std::make_shared<output_buffer>() };
+    const std::chrono::steady_clock::time_point _start{ std::chrono::steady_clock::now() };
+    std::atomic<HRESULT> _result{ S_OK };
+    std::atomic<bool> _done{};
+
+    // the last member, so the thread starts after the other members are initialized and is joined
+    // before they are destroyed
+    std::jthread _thread;
+
+public:
+    using job_function = std::function<HRESULT(std::stop_token stop_token, const dbgeng_logger& logger)>;
+
+    explicit background_job(job_function job) :
+        _thread{ [this, job = std::move(job)](std::stop_token stop_token) {
+            dbgeng_logger logger{ _output };
+            HRESULT hr{};
+            try {
+                hr = job(stop_token, logger);
+            } catch (...) {
+                hr = wil::ResultFromCaughtException();
+            }
+            _result.store(hr);
+            _done.store(true, std::memory_order_release);
+        } } {}
+
+    background_job(const background_job&) = delete;
+    background_job& operator=(const background_job&) = delete;
+
+    bool is_done() const { return _done.load(std::memory_order_acquire); }
+
+    // valid when the job is done
+    HRESULT result() const { return _result.load(); }
+
+    void cancel() { _thread.request_stop(); }
+
+    bool is_cancelled() const { return _thread.get_stop_token().stop_requested(); }
+
+    std::chrono::steady_clock::duration elapsed() const { return std::chrono::steady_clock::now() - _start; }
+
+    // writes the messages logged by the job since the previous call
+    void write_output(const dbgeng_logger& logger) { logger.write(*_output); }
+};
+
+}
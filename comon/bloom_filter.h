@@ -0,0 +1,83 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include "guid_hash.h"
+
+namespace comon_ext
+{
+/*
+ * Bloom filter over 64-bit fingerprints (10 bits and 7 probes per item give ~1% false
+ * positives). It is sized for the expected number of items and reports when it holds
+ * more, so the owner can rebuild it with a larger size.
+*/
+class bloom_filter
+{
+    static constexpr size_t bits_per_item{ 10 };
+    static constexpr uint64_t probes{ 7 };
+
+    size_t _expected_items{};
+    size_t _items{};
+    uint64_t _bits_mask{};
+    std::vector<uint64_t> _words{};
+
+public:
+    explicit bloom_filter(size_t expected_items) {
+        reset(expected_items);
+    }
+
+    void reset(size_t expected_items) {
+        _expected_items = std::max<size_t>(expected_items, 1024);
+        _items = 0;
+
+        auto bits{ std::bit_ceil(_expected_items * bits_per_item) };
+        _bits_mask = bits - 1;
+        _words.assign(bits / 64, 0);
+    }
+
+    void add(uint64_t fingerprint) {
+        auto h1{ fingerprint };
+        auto h2{ mix64(fingerprint) | 1 };
+        for (uint64_t i = 0; i < probes; i++) {
+            auto bit{ (h1 + i * h2) & _bits_mask };
+            _words[static_cast<size_t>(bit / 64)] |= 1ull << (bit % 64);
+        }
+        _items++;
+    }
+
+    bool may_contain(uint64_t fingerprint) const {
+        auto h1{ fingerprint };
+        auto h2{ mix64(fingerprint) | 1 };
+        for (uint64_t i = 0; i < probes; i++) {
+            auto bit{ (h1 + i * h2) & _bits_mask };
+            if ((_words[static_cast<size_t>(bit / 64)] & (1ull << (bit % 64))) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is_saturated() const { return _items > _expected_items; }
+
+    size_t size() const { return _items; }
+};
+}
@@ -0,0 +1,95 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+namespace comon_ext
+{
+/*
+ * Bounded multi-producer multi-consumer queue over a ring of cells (after Dmitry Vyukov's
+ * design). Each push and pop takes a ticket with a single atomic increment and owns one
+ * cell in one lap of the ring, so no lock is taken. The sequence of a cell tells which
+ * ticket may use it next; a producer of a full queue or a consumer of an empty queue waits
+ * on that sequence instead of spinning.
+*/
+template<typename T>
+class bounded_queue
+{
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        std::optional<T> value;
+    };
+
+    const size_t _mask;
+    const std::unique_ptr<cell[]> _cells;
+
+    std::atomic<size_t> _push_ticket{};
+    std::atomic<size_t> _pop_ticket{};
+
+    static void wait_for(std::atomic<size_t>& sequence, size_t expected) {
+        for (auto current{ sequence.load(std::memory_order_acquire) }; current != expected;
+            current = sequence.load(std::memory_order_acquire)) {
+            sequence.wait(current, std::memory_order_acquire);
+        }
+    }
+
+public:
+    explicit bounded_queue(size_t capacity) :
+        _mask{ std::bit_ceil(std::max<size_t>(capacity, 2)) - 1 }, _cells{ std::make_unique<cell[]>(_mask + 1) } {
+        for (size_t i = 0; i <= _mask; i++) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bounded_queue(const bounded_queue&) = delete;
+    bounded_queue& operator=(const bounded_queue&) = delete;
+
+    // blocks while the queue is full
+    void push(T value) {
+        auto ticket{ _push_ticket.fetch_add(1, std::memory_order_relaxed) };
+        auto& c{ _cells[ticket & _mask] };
+
+        wait_for(c.sequence, ticket);
+        c.value.emplace(std::move(value));
+        c.sequence.store(ticket + 1, std::memory_order_release);
+        c.sequence.notify_all();
+    }
+
+    // blocks while the queue is empty
+    T pop() {
+        auto ticket{ _pop_ticket.fetch_add(1, std::memory_order_relaxed) };
+        auto& c{ _cells[ticket & _mask] };
+
+        wait_for(c.sequence, ticket + 1);
+        T value{ std::move(*c.value) };
+        c.value.reset();
+        c.sequence.store(ticket + _mask + 1, std::memory_order_release);
+        c.sequence.notify_all();
+
+        return value;
+    }
+
+    size_t capacity() const { return _mask + 1; }
+};
+}
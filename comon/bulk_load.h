@@ -0,0 +1,184 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <SQLiteCpp/Database.h>
+#include <SQLiteCpp/Statement.h>
+
+namespace comon_ext
+{
+/*
+ * Named SQLite savepoint. Unlike a transaction, it may be opened inside another transaction
+ * (for example, a bulk load batch). Its changes are rolled back unless it is released.
+*/
+class savepoint
+{
+    SQLite::Database& _db;
+    const std::string _name;
+    bool _released{};
+
+public:
+    savepoint(SQLite::Database& db, std::string name): _db{ db }, _name{ std::move(name) } {
+        _db.exec("savepoint " + _name);
+    }
+
+    savepoint(const savepoint&) = delete;
+    savepoint& operator=(const savepoint&) = delete;
+
+    ~savepoint() {
+        if (!_released) {
+            _db.tryExec("rollback to " + _name);
+            _db.tryExec("release " + _name);
+        }
+    }
+
+    void release() {
+        _db.exec("release " + _name);
+        _released = true;
+    }
+};
+
+/*
+ * Writes large amounts of rows with relaxed durability. The rows are committed in batches
+ * of at least batch_rows, the journal is kept in memory and never synced, and the secondary
+ * indexes of the loaded tables are dropped and rebuilt once the load completes. As the
+ * journal is still written, savepoints inside a batch can roll back. If the load does not
+ * complete (for example, the caller returns early), the destructor commits the rows written
+ * so far and restores the indexes and the previous settings.
+ *
+ * A database in WAL mode keeps its journal, as other sessions may read it during the load.
+ * Each batch takes the write lock when it begins, so it waits for the writers of other
+ * sessions (up to the busy timeout) instead of failing on a snapshot they made stale.
+*/
+class bulk_load
+{
+    struct deferred_index
+    {
+        std::string name;
+        std::string sql;
+    };
+
+    SQLite::Database& _db;
+    const int64_t _batch_rows;
+
+    std::string _journal_mode{};
+    int _synchronous{};
+    int _cache_size{};
+    std::vector<deferred_index> _deferred_indexes{};
+
+    const std::chrono::steady_clock::time_point _start;
+    const int64_t _start_changes;
+    int64_t _batch_start_changes;
+    bool _completed{};
+
+    int64_t total_changes() const { return _db.getTotalChanges(); }
+
+public:
+    bulk_load(SQLite::Database& db, std::initializer_list<const char*> tables, int64_t batch_rows):
+        _db{ db }, _batch_rows{ batch_rows }, _start{ std::chrono::steady_clock::now() },
+        _start_changes{ total_changes() }, _batch_start_changes{ _start_changes } {
+
+        _journal_mode = _db.execAndGet("pragma main.journal_mode").getString();
+        _synchronous = _db.execAndGet("pragma main.synchronous").getInt();
+        _cache_size = _db.execAndGet("pragma main.cache_size").getInt();
+
+        for (auto table : tables) {
+            // automatic indexes (primary keys) have no SQL and stay in place
+            SQLite::Statement query{ _db, "select name, sql from main.sqlite_master where type = 'index' and tbl_name = :table and sql is not null" };
+            query.bind(":table", table);
+            while (query.executeStep()) {
+                // the index is recreated in the main schema, as a temporary view may hide the table (see cometa::attach_base)
+                auto name{ query.getColumn(0).getString() };
+                auto sql{ query.getColumn(1).getString() };
+                if (auto name_pos{ sql.find(name) }; name_pos != std::string::npos) {
+                    sql.insert(name_pos, "main.");
+                }
+                _deferred_indexes.push_back({ std::move(name), std::move(sql) });
+            }
+        }
+
+        if (_journal_mode != "wal") {
+            _db.exec("pragma main.journal_mode = memory");
+        }
+        _db.exec("pragma main.synchronous = off");
+        // 64 MB of page cache (negative values are in KiB)
+        _db.exec("pragma main.cache_size = -65536");
+
+        for (auto& index : _deferred_indexes) {
+            _db.exec("drop index main." + index.name);
+        }
+
+        _db.exec("begin immediate");
+    }
+
+    bulk_load(const bulk_load&) = delete;
+    bulk_load& operator=(const bulk_load&) = delete;
+
+    ~bulk_load() {
+        if (!_completed) {
+            _db.tryExec("commit");
+            for (auto& index : _deferred_indexes) {
+                _db.tryExec(index.sql);
+            }
+            _db.tryExec("pragma main.cache_size = " + std::to_string(_cache_size));
+            _db.tryExec("pragma main.synchronous = " + std::to_string(_synchronous));
+            if (_journal_mode != "wal") {
+                _db.tryExec("pragma main.journal_mode = " + _journal_mode);
+            }
+        }
+    }
+
+    // must be called outside of any savepoint; returns true if the batch was full and got committed
+    bool checkpoint() {
+        if (total_changes() - _batch_start_changes < _batch_rows) {
+            return false;
+        }
+        _db.exec("commit");
+        _db.exec("begin immediate");
+        _batch_start_changes = total_changes();
+        return true;
+    }
+
+    // commits the last batch, rebuilds the deferred indexes, and restores the previous settings
+    void complete() {
+        _db.exec("commit");
+        for (auto& index : _deferred_indexes) {
+            _db.exec(index.sql);
+        }
+        _db.exec("pragma main.cache_size = " + std::to_string(_cache_size));
+        _db.exec("pragma main.synchronous = " + std::to_string(_synchronous));
+        if (_journal_mode != "wal") {
+            _db.exec("pragma main.journal_mode = " + _journal_mode);
+        }
+        _completed = true;
+    }
+
+    int64_t rows() const { return total_changes() - _start_changes; }
+
+    double rows_per_second() const {
+        std::chrono::duration<double> elapsed{ std::chrono::steady_clock::now() - _start };
+        return elapsed.count() > 0 ? static_cast<double>(rows()) / elapsed.count() : 0.0;
+    }
+};
+}
@@ -0,0 +1,989 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
+#include <cassert>
+#include <stdexcept>
+
+#include "flat_hash.h"
+
+namespace comon_ext
+{
+/*
+ * A bounded cache with a pluggable eviction policy. The cache owns a fixed pool of
+ * slots (allocated up front) and a key index, while the policy keeps only its own
+ * metadata per slot. When the cache is full, the policy picks a victim slot which
+ * is then reused for the new entry.
+ *
+ * A policy must provide:
+ * - explicit Policy(index_t capacity)
+ * - void on_hit(index_t slot, const K& key)
+ * - index_t on_insert(const K& key, index_t free_slot, std::span<const std::optional<K>> keys)
+ *     free_slot is nil when the cache is full; the policy then returns an occupied slot
+ *     and the cache evicts its current key (keys[slot])
+ * - void clear()
+*/
+
+namespace cache_detail
+{
+using index_t = uint32_t;
+constexpr index_t nil{ std::numeric_limits<index_t>::max() };
+
+// Intrusive doubly-linked lists over slot indexes. A slot belongs to at most one list at a time.
+class slot_lists
+{
+    struct link
+    {
+        index_t prev{ nil };
+        index_t next{ nil };
+    };
+
+    std::vector<link> _links;
+
+public:
+    struct list
+    {
+        index_t head{ nil };
+        index_t tail{ nil };
+        index_t size{};
+    };
+
+    explicit slot_lists(index_t count): _links(count) {}
+
+    void push_front(list& l, index_t i) {
+        auto& lnk{ _links[i] };
+        lnk.prev = nil;
+        lnk.next = l.head;
+        if (l.head != nil) {
+            _links[l.head].prev = i;
+        } else {
+            l.tail = i;
+        }
+        l.head = i;
+        l.size++;
+    }
+
+    void remove(list& l, index_t i) {
+        auto& lnk{ _links[i] };
+        if (lnk.prev != nil) {
+            _links[lnk.prev].next = lnk.next;
+        } else {
+            l.head = lnk.next;
+        }
+        if (lnk.next != nil) {
+            _links[lnk.next].prev = lnk.prev;
+        } else {
+            l.tail = lnk.prev;
+        }
+        lnk.prev = lnk.next = nil;
+        assert(l.size > 0);
+        l.size--;
+    }
+
+    index_t pop_back(list& l) {
+        assert(l.tail != nil);
+        auto i{ l.tail };
+        remove(l, i);
+        return i;
+    }
+
+    void move_to_front(list& l, index_t i) {
+        if (l.head != i) {
+            remove(l, i);
+            push_front(l, i);
+        }
+    }
+
+    // moves all the elements of src in front of the dst elements
+    void splice_front(list& dst, list& src) {
+        if (src.head == nil) {
+            return;
+        }
+        if (dst.head != nil) {
+            _links[src.tail].next = dst.head;
+            _links[dst.head].prev = src.tail;
+        } else {
+            dst.tail = src.tail;
+        }
+        dst.head = src.head;
+        dst.size += src.size;
+        src = list{};
+    }
+
+    index_t next(index_t i) const { return _links[i].next; }
+
+    void clear() {
+        std::ranges::fill(_links, link{});
+    }
+};
+
+// Keys of recently evicted entries (ARC and S3-FIFO ghosts). Each ghost is tagged with the list it belongs to.
+template<typename K>
+class ghost_lists
+{
+    slot_lists _links;
+    std::vector<std::optional<K>> _keys;
+    std::vector<uint8_t> _tags;
+    std::vector<index_t> _free{};
+    flat_hash_map<K, index_t> _index{};
+
+public:
+    using list = slot_lists::list;
+
+    explicit ghost_lists(index_t capacity): _links{ capacity }, _keys(capacity), _tags(capacity) {
+        _index.reserve(capacity);
+        clear();
+    }
+
+    std::optional<uint8_t> find(const K& key) const {
+        if (auto iter{ _index.find(key) }; iter != std::end(_index)) {
+            return _tags[iter->second];
+        }
+        return std::nullopt;
+    }
+
+    void remove(list& l, const K& key) {
+        auto iter{ _index.find(key) };
+        assert(iter != std::end(_index));
+        auto i{ iter->second };
+        _index.erase(iter);
+        _links.remove(l, i);
+        _keys[i].reset();
+        _free.push_back(i);
+    }
+
+    void pop_back(list& l) {
+        auto i{ _links.pop_back(l) };
+        _index.erase(*_keys[i]);
+        _keys[i].reset();
+        _free.push_back(i);
+    }
+
+    void push_front(list& l, uint8_t tag, const K& key) {
+        assert(!_free.empty() && !_index.contains(key));
+        auto i{ _free.back() };
+        _free.pop_back();
+        _keys[i].emplace(key);
+        _tags[i] = tag;
+        _index.emplace(key, i);
+        _links.push_front(l, i);
+    }
+
+    void clear() {
+        _links.clear();
+        _index.clear();
+        std::ranges::fill(_keys, std::nullopt);
+        _free.clear();
+        for (index_t i = static_cast<index_t>(_keys.size()); i > 0; i--) {
+            _free.push_back(i - 1);
+        }
+    }
+};
+
+// Count-min sketch with 4-bit (saturating) counters. The counters are halved after
+// every 10 * capacity increments, so the estimates follow recent popularity.
+template<typename K>
+class count_min_sketch
+{
+    static constexpr size_t depth{ 4 };
+    static constexpr uint8_t max_count{ 15 };
+    static constexpr std::array<uint64_t, depth> seeds{
+        0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull, 0xd6e8feb86659fd93ull };
+
+    const size_t _width_mask;
+    const size_t _sample_size;
+    size_t _additions{};
+    std::vector<uint8_t> _counters;
+
+    static uint64_t mix(uint64_t h) {
+        // splitmix64 finalizer
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return h;
+    }
+
+    size_t counter_index(size_t h, size_t row) const {
+        return row * (_width_mask + 1) + static_cast<size_t>(mix(h + seeds[row]) & _width_mask);
+    }
+
+public:
+    explicit count_min_sketch(index_t capacity):
+        _width_mask{ std::bit_ceil(std::max<size_t>(16, static_cast<size_t>(capacity) * 2)) - 1 },
+        _sample_size{ static_cast<size_t>(capacity) * 10 }, _counters(depth * (_width_mask + 1)) {}
+
+    void increment(const K& key) {
+        auto h{ std::hash<K>{}(key) };
+        for (size_t row = 0; row < depth; row++) {
+            if (auto& c{ _counters[counter_index(h, row)] }; c < max_count) {
+                c++;
+            }
+        }
+
+        if (++_additions >= _sample_size) {
+            for (auto& c : _counters) {
+                c = static_cast<uint8_t>(c >> 1);
+            }
+            _additions /= 2;
+        }
+    }
+
+    uint8_t estimate(const K& key) const {
+        auto h{ std::hash<K>{}(key) };
+        uint8_t result{ max_count };
+        for (size_t row = 0; row < depth; row++) {
+            result = std::min(result, _counters[counter_index(h, row)]);
+        }
+        return result;
+    }
+
+    void clear() {
+        std::ranges::fill(_counters, uint8_t{});
+        _additions = 0;
+    }
+};
+}
+
+/*
+ * LFU with O(1) operations. Slots sharing the same frequency form a list attached to
+ * a frequency bucket, and buckets are kept in a list sorted by frequency (the least
+ * frequent first). Within a bucket, the most recently touched slot is at the head,
+ * so we evict from the tail of the first bucket.
+ *
+ * If aging_period is set, all frequencies are halved after every aging_period accesses
+ * (hits and inserts). Without aging, entries that were hot at some point (for example,
+ * IClassFactory lookups when the monitor attaches) would stay in the cache forever.
+*/
+template<typename K>
+class lfu_policy
+{
+    using index_t = cache_detail::index_t;
+    static constexpr index_t nil{ cache_detail::nil };
+
+    struct bucket
+    {
+        int32_t freq{};
+        cache_detail::slot_lists::list slots{};
+        index_t prev{ nil };
+        index_t next{ nil };
+    };
+
+    const size_t _aging_period;
+    size_t _accesses_since_aging{};
+
+    cache_detail::slot_lists _slots;
+    std::vector<index_t> _slot_buckets;
+
+    // we need at most one bucket per slot and one more while a slot moves between buckets;
+    // free buckets are single-linked through their next fields
+    std::vector<bucket> _buckets;
+    index_t _free_buckets{ nil };
+
+    // the bucket with the lowest frequency
+    index_t _first_bucket{ nil };
+
+    index_t allocate_bucket(int32_t freq, index_t prev, index_t next) {
+        assert(_free_buckets != nil);
+        auto b{ _free_buckets };
+        _free_buckets = _buckets[b].next;
+
+        _buckets[b] = bucket{ freq, {}, prev, next };
+        if (prev != nil) {
+            _buckets[prev].next = b;
+        } else {
+            _first_bucket = b;
+        }
+        if (next != nil) {
+            _buckets[next].prev = b;
+        }
+        return b;
+    }
+
+    void release_bucket(index_t b) {
+        auto& bk{ _buckets[b] };
+        assert(bk.slots.size == 0);
+
+        if (bk.prev != nil) {
+            _buckets[bk.prev].next = bk.next;
+        } else {
+            _first_bucket = bk.next;
+        }
+        if (bk.next != nil) {
+            _buckets[bk.next].prev = bk.prev;
+        }
+
+        bk.next = _free_buckets;
+        _free_buckets = b;
+    }
+
+    void link_slot(index_t slot, index_t b) {
+        _slot_buckets[slot] = b;
+        _slots.push_front(_buckets[b].slots, slot);
+    }
+
+    void record_access() {
+        if (_aging_period > 0 && ++_accesses_since_aging >= _aging_period) {
+            _accesses_since_aging = 0;
+            age();
+        }
+    }
+
+    void age() {
+        // halving keeps the buckets sorted, but neighbouring buckets may end up with the same
+        // frequency - we then move the slots of the higher bucket in front of the lower one
+        // so the slots that were less frequent are still evicted first
+        for (auto b{ _first_bucket }; b != nil;) {
+            auto& bk{ _buckets[b] };
+            bk.freq = std::max(bk.freq / 2, 1);
+
+            auto next_b{ bk.next };
+            if (auto prev_b{ bk.prev }; prev_b != nil && _buckets[prev_b].freq == bk.freq) {
+                for (auto slot{ bk.slots.head }; slot != nil; slot = _slots.next(slot)) {
+                    _slot_buckets[slot] = prev_b;
+                }
+                _slots.splice_front(_buckets[prev_b].slots, bk.slots);
+                release_bucket(b);
+            }
+            b = next_b;
+        }
+    }
+
+public:
+    static constexpr size_t default_aging_factor{ 10 };
+
+    explicit lfu_policy(index_t capacity): lfu_policy(capacity, default_aging_factor * capacity) {}
+
+    lfu_policy(index_t capacity, size_t aging_period):
+        _aging_period{ aging_period }, _slots{ capacity }, _slot_buckets(capacity, nil), _buckets(static_cast<size_t>(capacity) + 1) {
+        clear();
+    }
+
+    // 0 if the frequencies are never halved
+    size_t aging_period() const { return _aging_period; }
+
+    void on_hit(index_t slot, [[maybe_unused]] const K& key) {
+        auto b{ _slot_buckets[slot] };
+        auto& bk{ _buckets[b] };
+        auto new_freq{ bk.freq + 1 };
+
+        if (bk.slots.size == 1 && (bk.next == nil || _buckets[bk.next].freq != new_freq)) {
+            // the slot is alone in its bucket, so we may simply bump the bucket frequency
+            bk.freq = new_freq;
+        } else {
+            auto next_b{ bk.next };
+            if (next_b == nil || _buckets[next_b].freq != new_freq) {
+                next_b = allocate_bucket(new_freq, b, next_b);
+            }
+
+            _slots.remove(_buckets[b].slots, slot);
+            link_slot(slot, next_b);
+
+            if (_buckets[b].slots.size == 0) {
+                release_bucket(b);
+            }
+        }
+
+        record_access();
+    }
+
+    index_t on_insert([[maybe_unused]] const K& key, index_t free_slot, [[maybe_unused]] std::span<const std::optional<K>> keys) {
+        auto slot{ free_slot };
+        if (slot == nil) {
+            assert(_first_bucket != nil);
+            auto b{ _first_bucket };
+            slot = _slots.pop_back(_buckets[b].slots);
+            if (_buckets[b].slots.size == 0) {
+                release_bucket(b);
+            }
+        }
+
+        auto b{ _first_bucket };
+        if (b == nil || _buckets[b].freq != 1) {
+            b = allocate_bucket(1, nil, b);
+        }
+        link_slot(slot, b);
+
+        record_access();
+        return slot;
+    }
+
+    void clear() {
+        _slots.clear();
+        std::ranges::fill(_slot_buckets, nil);
+        std::ranges::fill(_buckets, bucket{});
+        for (index_t i = 0; i < _buckets.size(); i++) {
+            _buckets[i].next = i + 1 < _buckets.size() ? i + 1 : nil;
+        }
+        _free_buckets = 0;
+        _first_bucket = nil;
+        _accesses_since_aging = 0;
+    }
+};
+
+template<typename K>
+class lru_policy
+{
+    using index_t = cache_detail::index_t;
+    static constexpr index_t nil{ cache_detail::nil };
+
+    cache_detail::slot_lists _slots;
+    cache_detail::slot_lists::list _lru{};
+
+public:
+    explicit lru_policy(index_t capacity): _slots{ capacity } {}
+
+    void on_hit(index_t slot, [[maybe_unused]] const K& key) {
+        _slots.move_to_front(_lru, slot);
+    }
+
+    index_t on_insert([[maybe_unused]] const K& key, index_t free_slot, [[maybe_unused]] std::span<const std::optional<K>> keys) {
+        auto slot{ free_slot != nil ? free_slot : _slots.pop_back(_lru) };
+        _slots.push_front(_lru, slot);
+        return slot;
+    }
+
+    void clear() {
+        _slots.clear();
+        _lru = {};
+    }
+};
+
+/*
+ * Adaptive Replacement Cache (Megiddo, Modha). T1 holds entries seen once recently, T2 entries
+ * seen at least twice. B1 and B2 remember the keys recently evicted from T1 and T2, and hits
+ * in them move the target size of T1 (p) towards the list that would have kept the entry.
+*/
+template<typename K>
+class arc_policy
+{
+    using index_t = cache_detail::index_t;
+    static constexpr index_t nil{ cache_detail::nil };
+
+    static constexpr uint8_t b1_tag{ 1 };
+    static constexpr uint8_t b2_tag{ 2 };
+
+    const index_t _capacity;
+    index_t _p{};
+
+    cache_detail::slot_lists _slots;
+    cache_detail::slot_lists::list _t1{};
+    cache_detail::slot_lists::list _t2{};
+    std::vector<uint8_t> _in_t2;
+
+    cache_detail::ghost_lists<K> _ghosts;
+    cache_detail::slot_lists::list _b1{};
+    cache_detail::slot_lists::list _b2{};
+
+    index_t replace(bool hit_in_b2, std::span<const std::optional<K>> keys) {
+        if (_t1.size > 0 && (_t2.size == 0 || _t1.size > _p || (hit_in_b2 && _t1.size == _p))) {
+            auto slot{ _slots.pop_back(_t1) };
+            _ghosts.push_front(_b1, b1_tag, *keys[slot]);
+            return slot;
+        } else {
+            auto slot{ _slots.pop_back(_t2) };
+            _ghosts.push_front(_b2, b2_tag, *keys[slot]);
+            _in_t2[slot] = false;
+            return slot;
+        }
+    }
+
+public:
+    explicit arc_policy(index_t capacity):
+        _capacity{ capacity }, _slots{ capacity }, _in_t2(capacity), _ghosts{ capacity + 1 } {}
+
+    void on_hit(index_t slot, [[maybe_unused]] const K& key) {
+        if (_in_t2[slot]) {
+            _slots.move_to_front(_t2, slot);
+        } else {
+            _slots.remove(_t1, slot);
+            _slots.push_front(_t2, slot);
+            _in_t2[slot] = true;
+        }
+    }
+
+    index_t on_insert(const K& key, index_t free_slot, std::span<const std::optional<K>> keys) {
+        // ghosts appear only after the first eviction, so we never need to evict when there is a free slot
+        auto slot{ free_slot };
+
+        if (auto tag{ _ghosts.find(key) }; tag && *tag == b1_tag) {
+            _p = std::min(_capacity, _p + std::max<index_t>(_b2.size / _b1.size, 1));
+            _ghosts.remove(_b1, key);
+            if (slot == nil) {
+                slot = replace(false, keys);
+            }
+            _slots.push_front(_t2, slot);
+            _in_t2[slot] = true;
+        } else if (tag && *tag == b2_tag) {
+            _p -= std::min(_p, std::max<index_t>(_b1.size / _b2.size, 1));
+            _ghosts.remove(_b2, key);
+            if (slot == nil) {
+                slot = replace(true, keys);
+            }
+            _slots.push_front(_t2, slot);
+            _in_t2[slot] = true;
+        } else {
+            if (_t1.size + _b1.size == _capacity) {
+                if (_t1.size < _capacity) {
+                    _ghosts.pop_back(_b1);
+                    if (slot == nil) {
+                        slot = replace(false, keys);
+                    }
+                } else if (slot == nil) {
+                    // B1 is empty - we drop the LRU entry of T1 without remembering it
+                    slot = _slots.pop_back(_t1);
+                }
+            } else if (auto total{ _t1.size + _t2.size + _b1.size + _b2.size }; total >= _capacity) {
+                if (total == 2 * _capacity) {
+                    _ghosts.pop_back(_b2);
+                }
+                if (slot == nil) {
+                    slot = replace(false, keys);
+                }
+            }
+            assert(slot != nil);
+            _slots.push_front(_t1, slot);
+            _in_t2[slot] = false;
+        }
+        return slot;
+    }
+
+    void clear() {
+        _slots.clear();
+        _ghosts.clear();
+        _t1 = _t2 = _b1 = _b2 = {};
+        std::ranges::fill(_in_t2, uint8_t{});
+        _p = 0;
+    }
+};
+
+/*
+ * S3-FIFO (Yang et al.). New keys enter a small FIFO queue (10% of the capacity). Keys accessed
+ * more than once while in the small queue move to the main queue, the rest are evicted and
+ * remembered in a ghost queue. Keys found in the ghost queue are inserted directly to the main
+ * queue. The main queue is a FIFO with reinsertion (up to 3 times) of the accessed keys.
+*/
+template<typename K>
+class s3fifo_policy
+{
+    using index_t = cache_detail::index_t;
+    static constexpr index_t nil{ cache_detail::nil };
+
+    static constexpr uint8_t ghost_tag{ 1 };
+    static constexpr uint8_t max_freq{ 3 };
+
+    const index_t _small_target;
+    const index_t _ghost_capacity;
+
+    cache_detail::slot_lists _slots;
+    cache_detail::slot_lists::list _small{};
+    cache_detail::slot_lists::list _main{};
+    std::vector<uint8_t> _freqs;
+
+    cache_detail::ghost_lists<K> _ghosts;
+    cache_detail::slot_lists::list _ghost{};
+
+    index_t evict(std::span<const std::optional<K>> keys) {
+        while (true) {
+            if (_small.size >= _small_target || _main.size == 0) {
+                auto slot{ _slots.pop_back(_small) };
+                if (_freqs[slot] > 1) {
+                    _freqs[slot] = 0;
+                    _slots.push_front(_main, slot);
+                } else {
+                    if (_ghost.size >= _ghost_capacity) {
+                        _ghosts.pop_back(_ghost);
+                    }
+                    _ghosts.push_front(_ghost, ghost_tag, *keys[slot]);
+                    return slot;
+                }
+            } else {
+                auto slot{ _slots.pop_back(_main) };
+                if (_freqs[slot] > 0) {
+                    _freqs[slot]--;
+                    _slots.push_front(_main, slot);
+                } else {
+                    return slot;
+                }
+            }
+        }
+    }
+
+public:
+    explicit s3fifo_policy(index_t capacity):
+        _small_target{ std::max<index_t>(capacity / 10, 1) }, _ghost_capacity{ std::max<index_t>(capacity - _small_target, 1) },
+        _slots{ capacity }, _freqs(capacity), _ghosts{ _ghost_capacity } {}
+
+    void on_hit(index_t slot, [[maybe_unused]] const K& key) {
+        if (_freqs[slot] < max_freq) {
+            _freqs[slot]++;
+        }
+    }
+
+    index_t on_insert(const K& key, index_t free_slot, std::span<const std::optional<K>> keys) {
+        bool ghost_hit{ _ghosts.find(key).has_value() };
+        if (ghost_hit) {
+            _ghosts.remove(_ghost, key);
+        }
+
+        auto slot{ free_slot != nil ? free_slot : evict(keys) };
+        _freqs[slot] = 0;
+        _slots.push_front(ghost_hit ? _main : _small, slot);
+        return slot;
+    }
+
+    void clear() {
+        _slots.clear();
+        _ghosts.clear();
+        _small = _main = _ghost = {};
+        std::ranges::fill(_freqs, uint8_t{});
+    }
+};
+
+/*
+ * W-TinyLFU (Einziger, Friedman, Manes). New keys enter a small LRU window (1% of the capacity).
+ * The main area is a segmented LRU (20% probation, 80% protected). When the window overflows,
+ * its LRU key is admitted to the main area only if the count-min sketch estimates it is more
+ * popular than the main area victim.
+*/
+template<typename K>
+class wtinylfu_policy
+{
+    using index_t = cache_detail::index_t;
+    static constexpr index_t nil{ cache_detail::nil };
+
+    enum class region : uint8_t { window, probation, protected_ };
+
+    const index_t _window_target;
+    const index_t _protected_target;
+
+    cache_detail::slot_lists _slots;
+    cache_detail::slot_lists::list _window{};
+    cache_detail::slot_lists::list _probation{};
+    cache_detail::slot_lists::list _protected{};
+    std::vector<region> _regions;
+
+    cache_detail::count_min_sketch<K> _sketch;
+
+    cache_detail::slot_lists::list& main_victim_list() {
+        return _probation.size > 0 ? _probation : _protected;
+    }
+
+public:
+    explicit wtinylfu_policy(index_t capacity):
+        _window_target{ std::max<index_t>(capacity / 100, 1) },
+        _protected_target{ (capacity - std::min(capacity, std::max<index_t>(capacity / 100, 1))) * 4 / 5 },
+        _slots{ capacity }, _regions(capacity), _sketch{ capacity } {}
+
+    void on_hit(index_t slot, const K& key) {
+        _sketch.increment(key);
+
+        switch (_regions[slot]) {
+        case region::window:
+            _slots.move_to_front(_window, slot);
+            break;
+        case region::probation:
+            _slots.remove(_probation, slot);
+            _slots.push_front(_protected, slot);
+            _regions[slot] = region::protected_;
+            if (_protected.size > _protected_target) {
+                auto demoted{ _slots.pop_back(_protected) };
+                _slots.push_front(_probation, demoted);
+                _regions[demoted] = region::probation;
+            }
+            break;
+        case region::protected_:
+            _slots.move_to_front(_protected, slot);
+            break;
+        }
+    }
+
+    index_t on_insert(const K& key, index_t free_slot, std::span<const std::optional<K>> keys) {
+        _sketch.increment(key);
+
+        auto slot{ free_slot };
+        if (slot == nil) {
+            auto main_size{ _probation.size + _protected.size };
+            if (_window.size >= _window_target || main_size == 0) {
+                auto candidate{ _window.tail };
+                if (main_size > 0) {
+                    auto& victim_list{ main_victim_list() };
+                    if (_sketch.estimate(*keys[candidate]) > _sketch.estimate(*keys[victim_list.tail])) {
+                        // the candidate wins and moves to the main area
+                        slot = _slots.pop_back(victim_list);
+                        _slots.remove(_window, candidate);
+                        _slots.push_front(_probation, candidate);
+                        _regions[candidate] = region::probation;
+                    }
+                }
+                if (slot == nil) {
+                    slot = _slots.pop_back(_window);
+                }
+            } else {
+                slot = _slots.pop_back(main_victim_list());
+            }
+        }
+
+        _slots.push_front(_window, slot);
+        _regions[slot] = region::window;
+
+        if (free_slot != nil && _window.size > _window_target) {
+            // while the cache is filling up, the window overflow goes to the main area
+            auto moved{ _slots.pop_back(_window) };
+            _slots.push_front(_probation, moved);
+            _regions[moved] = region::probation;
+        }
+        return slot;
+    }
+
+    void clear() {
+        _slots.clear();
+        _window = _probation = _protected = {};
+        std::ranges::fill(_regions, region::window);
+        _sketch.clear();
+    }
+};
+
+struct cache_stats
+{
+    uint64_t hits;
+    uint64_t inserts;
+    uint64_t updates;
+    uint64_t evictions;
+};
+
+template<typename K, typename O, template<typename> typename Policy>
+class cache
+{
+    using index_t = cache_detail::index_t;
+    static constexpr index_t nil{ cache_detail::nil };
+
+    static index_t validate_capacity(size_t capacity) {
+        if (capacity <= 0 || capacity >= nil) {
+            throw std::invalid_argument{ "capacity" };
+        }
+        return static_cast<index_t>(capacity);
+    }
+
+    const index_t _capacity;
+
+    flat_hash_map<K, index_t> _index{};
+
+    // slots are filled in order and, once the cache is full, reused for the evicted entries
+    std::vector<std::optional<K>> _keys;
+    std::vector<std::optional<std::remove_const_t<O>>> _values;
+
+    Policy<K> _policy;
+
+    cache_stats _stats{};
+
+public:
+    template<typename... Args>
+    explicit cache(size_t capacity, Args&&... policy_args):
+        _capacity{ validate_capacity(capacity) }, _keys(_capacity), _values(_capacity),
+        _policy(_capacity, std::forward<Args>(policy_args)...) {
+        _index.reserve(capacity);
+    }
+
+    size_t capacity() const { return _capacity; }
+
+    const Policy<K>& policy() const { return _policy; }
+
+    size_t size() const { return _index.size(); }
+
+    // the counters survive clear() and are reset only on request
+    const cache_stats& stats() const { return _stats; }
+
+    void reset_stats() { _stats = {}; }
+
+    bool contains(const K& key) const {
+        return _index.contains(key);
+    }
+
+    const O& get(const K& key) {
+        assert(_index.contains(key));
+        auto slot{ _index.find(key)->second };
+        _policy.on_hit(slot, key);
+        _stats.hits++;
+        return *_values[slot];
+    }
+
+    void insert(const K& key, const O& data) {
+        if (_index.contains(key)) {
+            return;
+        }
+
+        auto free_slot{ _index.size() < _capacity ? static_cast<index_t>(_index.size()) : nil };
+        auto slot{ _policy.on_insert(key, free_slot, _keys) };
+        if (free_slot == nil) {
+            assert(_keys[slot]);
+            _index.erase(*_keys[slot]);
+            _stats.evictions++;
+        } else {
+            assert(slot == free_slot);
+        }
+
+        _keys[slot].emplace(key);
+        _values[slot].emplace(data);
+        _index.emplace(key, slot);
+        _stats.inserts++;
+    }
+
+    // replaces the data of a cached key without affecting its eviction priority
+    void insert_or_assign(const K& key, const O& data) {
+        if (auto iter{ _index.find(key) }; iter != std::end(_index)) {
+            _values[iter->second].emplace(data);
+            _stats.updates++;
+        } else {
+            insert(key, data);
+        }
+    }
+
+    void clear() {
+        _index.clear();
+        std::ranges::fill(_keys, std::nullopt);
+        for (auto& v : _values) {
+            v.reset();
+        }
+        _policy.clear();
+    }
+};
+
+template<typename K, typename O>
+using lfu_cache = cache<K, O, lfu_policy>;
+
+enum class cache_policy
+{
+    lfu,
+    lru,
+    arc,
+    s3fifo,
+    wtinylfu
+};
+
+constexpr std::wstring_view cache_policy_name(cache_policy policy) {
+    switch (policy) {
+    case cache_policy::lfu: return L"lfu";
+    case cache_policy::lru: return L"lru";
+    case cache_policy::arc: return L"arc";
+    case cache_policy::s3fifo: return L"s3fifo";
+    case cache_policy::wtinylfu: return L"wtinylfu";
+    default: return L"unknown";
+    }
+}
+
+inline std::optional<cache_policy> parse_cache_policy(std::string_view name) {
+    for (auto policy : { cache_policy::lfu, cache_policy::lru, cache_policy::arc, cache_policy::s3fifo, cache_policy::wtinylfu }) {
+        if (std::ranges::equal(name, cache_policy_name(policy), [](char c, wchar_t wc) { return static_cast<wchar_t>(c) == wc; })) {
+            return policy;
+        }
+    }
+    return std::nullopt;
+}
+
+// A cache which eviction policy may be changed at runtime. The variant alternatives
+// must be in the same order as the cache_policy values.
+template<typename K, typename O>
+class policy_cache
+{
+    using cache_variant = std::variant<cache<K, O, lfu_policy>, cache<K, O, lru_policy>, cache<K, O, arc_policy>,
+        cache<K, O, s3fifo_policy>, cache<K, O, wtinylfu_policy>>;
+
+    cache_variant _cache;
+
+    static cache_variant make_cache(cache_policy policy, size_t capacity, std::optional<size_t> aging_period) {
+        switch (policy) {
+        case cache_policy::lfu: return cache_variant{ std::in_place_index<0>, capacity,
+            aging_period.value_or(lfu_policy<K>::default_aging_factor * capacity) };
+        case cache_policy::lru: return cache_variant{ std::in_place_index<1>, capacity };
+        case cache_policy::arc: return cache_variant{ std::in_place_index<2>, capacity };
+        case cache_policy::s3fifo: return cache_variant{ std::in_place_index<3>, capacity };
+        case cache_policy::wtinylfu: return cache_variant{ std::in_place_index<4>, capacity };
+        default: throw std::invalid_argument{ "policy" };
+        }
+    }
+
+public:
+    // the aging period applies to the LFU policy only (see lfu_policy), by default 10 * capacity
+    policy_cache(cache_policy policy, size_t capacity, std::optional<size_t> aging_period = std::nullopt):
+        _cache{ make_cache(policy, capacity, aging_period) } {}
+
+    void reset(cache_policy policy, size_t capacity, std::optional<size_t> aging_period = std::nullopt) {
+        switch (policy) {
+        case cache_policy::lfu: _cache.template emplace<0>(capacity, aging_period.value_or(lfu_policy<K>::default_aging_factor * capacity)); break;
+        case cache_policy::lru: _cache.template emplace<1>(capacity); break;
+        case cache_policy::arc: _cache.template emplace<2>(capacity); break;
+        case cache_policy::s3fifo: _cache.template emplace<3>(capacity); break;
+        case cache_policy::wtinylfu: _cache.template emplace<4>(capacity); break;
+        default: throw std::invalid_argument{ "policy" };
+        }
+    }
+
+    cache_policy policy() const { return static_cast<cache_policy>(_cache.index()); }
+
+    size_t capacity() const { return std::visit([](const auto& c) { return c.capacity(); }, _cache); }
+
+    // nullopt if the policy does not age the entries
+    std::optional<size_t> aging_period() const {
+        if (auto lfu{ std::get_if<0>(&_cache) }; lfu) {
+            return lfu->policy().aging_period();
+        }
+        return std::nullopt;
+    }
+
+    size_t size() const { return std::visit([](const auto& c) { return c.size(); }, _cache); }
+
+    // switching the policy starts with fresh counters
+    cache_stats stats() const { return std::visit([](const auto& c) { return c.stats(); }, _cache); }
+
+    void reset_stats() {
+        std::visit([](auto& c) { c.reset_stats(); }, _cache);
+    }
+
+    bool contains(const K& key) const {
+        return std::visit([&key](const auto& c) { return c.contains(key); }, _cache);
+    }
+
+    const O& get(const K& key) {
+        return std::visit([&key](auto& c) -> const O& { return c.get(key); }, _cache);
+    }
+
+    void insert(const K& key, const O& data) {
+        std::visit([&key, &data](auto& c) { c.insert(key, data); }, _cache);
+    }
+
+    void insert_or_assign(const K& key, const O& data) {
+        std::visit([&key, &data](auto& c) { c.insert_or_assign(key, data); }, _cache);
+    }
+
+    void clear() {
+        std::visit([](auto& c) { c.clear(); }, _cache);
+    }
+};
+}
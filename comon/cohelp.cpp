@@ -39,12 +39,51 @@ extern "C" HRESULT CALLBACK cohelp(IDebugClient * dbgclient, [[maybe_unused]] PC
   !cometa index
       - indexes COM metadata found in the system (registered type libraries, CLSIDs,
         and interfaces). The results are saved to a cometa.db3 file in the user temporary
-        folder. They should be automatically loaded on the next run.
+        folder. They should be automatically loaded on the next run. When run again,
+        it parses only the type libraries that changed since the previous run. The method
+        signatures of the registered interfaces are read from their type libraries on first use.
+        Running it is optional: an IID or CLSID missing from the database is looked up in its
+        registry key on first use, together with the type library the key references.
+        The indexing runs in the background, and the debugger stays usable. The lookups use
+        the previous metadata until the indexing completes and its results are swapped in.
+  !cometa index --methods
+      - indexes as above, and parses the method signatures of all the registered type libraries
+        too, so the database has the method layouts without the type libraries. Use it for
+        a database you plan to share with other machines (to merge it or use it as a base).
+  !cometa index status
+      - shows the messages of the background indexing and how long it has been running.
+  !cometa index cancel
+      - stops the background indexing, keeping the previous metadata.
   !cometa index <path_to_tlb_or_dll_file>
       - indexes COM metadata from the provided TLB or DLL file. The results are saved
         to a cometa.db3 file in the user temporary folder. They should be automatically
         loaded on the next run.
 
+  !cometa merge <path_to_db3_file> [newest|ours|theirs]
+      - merges the types, classes, and virtual tables of another metadata database (for example,
+        indexed on a different machine) into the current one, in a single transaction. When both
+        databases have a virtual table of the same CLSID and IID, newest (the default) keeps the one
+        from the module with the newer timestamp, ours keeps the current one, and theirs takes the
+        merged one. A type without methods is always replaced by a merged type with methods, and
+        a type indexed without its method signatures gets the merged ones. The type libraries
+        indexed in the merged database are carried over when this machine has the same files.
+        Databases with an older schema are upgraded in a temporary copy.
+
+  !cometa base [<path>|off]
+      - layers the metadata database over a read-only base database (for example, a fully indexed
+        database shared by a team). The lookups check this database first and then the base, and
+        all the new metadata and virtual tables are saved to this database only. The base is
+        remembered, so the next sessions use it too; if its file changes, the metadata snapshot is
+        exported again. off stops using the base, and no arguments show the current base.
+        !cometa save copies only this database. A base with an older schema is not used until
+        it is opened in a debugger session, which upgrades it.
+
+  !cometa workingset [on|off]
+      - on loads the virtual tables of the debuggee architecture into memory. The lookups read
+        them from memory, and the new ones are saved to the database file by a background thread
+        every 5 seconds, when the monitor detaches, and when the extension unloads. Without
+        arguments, shows the current mode and the number of virtual tables waiting to be saved.
+
   !cometa showi <iid>
       - shows information about a given IID (COM interface ID). This command will show
         interface methods (if available) and virtual tables registered for this IID.
@@ -52,6 +91,27 @@ extern "C" HRESULT CALLBACK cohelp(IDebugClient * dbgclient, [[maybe_unused]] PC
       - shows virtual tables registered for a given CLSID (COM class ID)
   !cometa showm <module_name>
       - shows virtual tables registered for a given module (DLL or EXE file)
+  !cometa find <text|guid_prefix>
+      - finds interfaces, classes, and methods whose names contain a given text (case-insensitive),
+        or whose IIDs or CLSIDs start with a given GUID prefix (at least four hex digits). Exact
+        matches are listed first, followed by prefix and substring matches. Only the methods of
+        the interfaces used since indexing (or indexed from a file) are searchable.
+
+  !cometa cache
+      - shows the eviction policy, capacity, and number of entries of the metadata caches (types,
+        classes, and flattened vtable layouts)
+  !cometa cache policy <lfu|lru|arc|s3fifo|wtinylfu> <capacity> [aging]
+      - switches the metadata caches to a given eviction policy and capacity (the cached
+        entries are dropped). LFU (the default) suits tight loops over a handful of interfaces,
+        while ARC, S3-FIFO, or W-TinyLFU cope better with scans over many types. For LFU, aging
+        sets after how many accesses the use counts are halved (10 * capacity by default, 0
+        turns the aging off), so the entries hot only at some point get evicted.
+  !cometa cachestats [reset|--json]
+      - shows the cache hits, inserts, and evictions, the size of the interned name pool, the
+        number of prepared SQL statements, the size of the metadata snapshot, and, for each
+        metadata lookup, the number of calls, snapshot reads, SQL statements and rows, and
+        a latency histogram (power-of-two microsecond buckets).
+        Use reset to zero the counters and --json to print them as a single JSON line.
 
   !comon attach [[-i|-e] {clsid1} {clsid2} ...]
       - starts COM monitor for the active process. If you're debugging a 32-bit WOW64
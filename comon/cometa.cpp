@@ -20,13 +20,19 @@
 #include <cassert>
 #include <ranges>
 #include <algorithm>
+#include <iterator>
 #include <variant>
 #include <functional>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
 
 #include <SQLiteCpp/Database.h>
 #include <SQLiteCpp/Statement.h>
 #include <SQLiteCpp/Transaction.h>
+#include <sqlite3.h>
 
 #include <Windows.h>
 #include <wil/com.h>
@@ -35,6 +41,10 @@
 
 #include "comon.h"
 #include "cometa.h"
+#include "bounded_queue.h"
+#include "bulk_load.h"
+#include "cometa_schema.h"
+#include "cometa_signature.h"
 
 using namespace comon_ext;
 
@@ -43,12 +53,170 @@ namespace fs = std::filesystem;
 
 /* *** COM METADATA *** */
 
-// increment whenever the database schema changes
-constexpr int schema_version{ 5 };
+// the oldest schema of a base database, the layered tables keep the same columns since the type libraries and
+// signatures got their architecture
+constexpr int layered_schema_version{ 12 };
+
+// rows written by !cometa index between two commits
+constexpr int64_t bulk_load_batch_rows{ 20'000 };
+
+// how long a connection waits for the write lock held by another session (for example, a running index)
+constexpr int busy_timeout_ms{ 5'000 };
+// the vtables are saved from the breakpoint handlers, which must not stall the debugger
+constexpr int vtable_busy_timeout_ms{ 100 };
+// the same for the metadata resolved from the registry by a lookup
+constexpr int resolve_busy_timeout_ms{ 100 };
+// how often the background writer saves the vtables of the working set
+constexpr std::chrono::seconds working_set_flush_interval{ 5 };
+
+constexpr std::string_view insert_vtable_sql{ R"(insert or replace into main.vtables (arch, clsid, iid, module_name, module_timestamp, vtable)
+values (:arch, :clsid, :iid, :module_name, :module_timestamp, :vtable))" };
+
+namespace
+{
+uint64_t module_fingerprint(std::string_view module_name_u8, ULONG module_timestamp) {
+    return mix64(static_cast<uint64_t>(std::hash<std::string_view>{}(module_name_u8)) ^ mix64(module_timestamp));
+}
+
+/*
+ * Many debugger sessions (and the indexer) may share one database file. In WAL mode the readers never
+ * block the writer or each other, and the writers wait for the lock instead of failing right away.
+ * A database another session still opens with a rollback journal keeps it until all of them close.
+*/
+void configure_connection(SQLite::Database& db, bool in_memory, const dbgeng_logger& log) {
+    db.setBusyTimeout(busy_timeout_ms);
+    if (in_memory) {
+        return;
+    }
+
+    try {
+        if (auto journal_mode{ db.execAndGet("pragma journal_mode = wal").getString() }; journal_mode == "wal") {
+            // in WAL mode, a power loss may roll back the last commits, but never corrupts the database
+            db.exec("pragma synchronous = normal");
+        } else {
+            log.log_info(std::format(L"The metadata database stays in the '{}' journal mode.", widen(journal_mode)));
+        }
+    } catch (const SQLite::Exception& ex) {
+        log.log_info(std::format(L"The metadata database is open in other sessions, so it stays in its journal mode ({}: '{}').",
+            ex.getErrorCode(), widen(ex.getErrorStr())));
+    }
+}
+
+bool is_64bit_os() {
+#if ARCH_X64
+    return true;
+#else
+    BOOL wow64{};
+    return ::IsWow64Process(::GetCurrentProcess(), &wow64) && wow64;
+#endif
+}
+
+std::variant<std::vector<covtable_method>, HRESULT> decode_signature(const IID& iid, const SQLite::Column& column, string_pool& names) {
+    return signature::decode({ static_cast<const std::byte*>(column.getBlob()), static_cast<size_t>(column.getBytes()) }, iid, names);
+}
+
+/*
+ * With a base database, each connection attaches it as "base" and reads the layered tables through temporary views
+ * of the same names, which hide the tables of the main database (the overlay). A view returns the overlay rows
+ * and the base rows with a key missing from the overlay, so the overlay wins. The writes must name the main
+ * tables explicitly, as the views are read-only.
+ *
+ * A type library of the base that the overlay removed or indexed again gets a tombstone (its path in
+ * base_tombstones). The views hide its base rows, and the base rows of the GUIDs that only it defines.
+*/
+struct layered_table
+{
+    std::string_view name;
+    std::string_view columns;
+    // matches an overlay row (o) with a base row (b) of the same primary key
+    std::string_view key_match;
+    // the column of the base row with its type library path or with its GUID (empty if the rows have no owner)
+    std::string_view path_column;
+    std::string_view guid_column;
+};
+
+constexpr std::array layered_tables{
+    layered_table{ "cotypes", "iid, type, name, parent_iid, methods_available", "o.iid = b.iid", "", "iid" },
+    layered_table{ "cotype_signatures", "iid, arch, signature", "o.iid = b.iid and o.arch = b.arch", "", "iid" },
+    layered_table{ "coclasses", "clsid, name", "o.clsid = b.clsid", "", "clsid" },
+    layered_table{ "typelibs", "path, registered, size, last_write_time, hash, arch", "o.path = b.path", "path", "" },
+    layered_table{ "typelib_guids", "path, guid", "o.path = b.path and o.guid = b.guid", "path", "" },
+    layered_table{ "vtables", "arch, clsid, iid, module_name, module_timestamp, vtable",
+        "o.arch = b.arch and o.clsid = b.clsid and o.iid = b.iid", "", "" },
+};
+
+// the metadata copied to the staging database of the background index (the vtables stay in the open database)
+struct index_table
+{
+    std::string_view name;
+    std::string_view columns;
+    std::string_view key;
+    // the other rows replaced by the indexed ones (a type library indexed again has a new set of GUIDs)
+    std::string_view replaced;
+};
+
+constexpr std::array index_tables{
+    index_table{ "cotypes", "iid, type, name, parent_iid, methods_available", "iid", "" },
+    index_table{ "cotype_signatures", "iid, arch, signature", "iid, arch", "" },
+    index_table{ "coclasses", "clsid, name", "clsid", "" },
+    index_table{ "typelibs", "path, registered, size, last_write_time, hash, arch", "path", "" },
+    index_table{ "typelib_guids", "path, guid", "path, guid", "path in (select path from metadata_source.typelibs)" },
+    index_table{ "base_tombstones", "path", "path", "" },
+};
+
+// the statements prepared on the connection must be finalized first
+void detach_base_db(SQLite::Database& db) noexcept {
+    for (const auto& table : layered_tables) {
+        db.tryExec(std::format("drop view if exists temp.{}", table.name));
+    }
+    db.tryExec("detach database base");
+}
 
-std::unique_ptr<SQLite::Database> cometa::init_db(const fs::path& path, IDebugControl4* dbgcontrol) {
-    dbgeng_logger log{ dbgcontrol };
+void attach_base_db(SQLite::Database& db, const fs::path& base_path) {
+    {
+        SQLite::Statement attach{ db, "attach database :path as base" };
+        attach.bind(":path", to_utf8(base_path.c_str()));
+        attach.exec();
+    }
 
+    try {
+        for (const auto& [name, columns, key_match, path_column, guid_column] : layered_tables) {
+            std::string removed{};
+            if (!path_column.empty()) {
+                removed = std::format(" and b.{} not in (select path from main.base_tombstones)", path_column);
+            } else if (!guid_column.empty()) {
+                // a GUID with an owner left in the base stays visible
+                removed = std::format(R"( and not (exists (select 1 from base.typelib_guids g where g.guid = b.{0} and g.path in (select path from main.base_tombstones))
+and not exists (select 1 from base.typelib_guids g where g.guid = b.{0} and g.path not in (select path from main.base_tombstones))))", guid_column);
+            }
+            db.exec(std::format(R"(create temp view {0} as select {1} from main.{0}
+union all select {1} from base.{0} b where not exists (select 1 from main.{0} o where {2}){3})", name, columns, key_match, removed));
+        }
+    } catch (const SQLite::Exception&) {
+        detach_base_db(db);
+        throw;
+    }
+}
+
+// the schema version of a database (0 if it is not a metadata database)
+int db_schema_version(const fs::path& path) {
+    SQLite::Database db{ to_utf8(path.c_str()), SQLite::OPEN_READONLY };
+    return db.tableExists("schema_version") ? db.execAndGet("select version from schema_version").getInt() : 0;
+}
+
+// the size and the last write time of the base database (or a size of -1 if it is missing)
+std::pair<int64_t, int64_t> base_db_fingerprint(const fs::path& base_path) {
+    std::error_code ec{};
+    auto size{ fs::file_size(base_path, ec) };
+    if (ec) {
+        return { -1, 0 };
+    }
+    auto last_write_time{ fs::last_write_time(base_path, ec) };
+    return { static_cast<int64_t>(size), ec ? 0 : static_cast<int64_t>(last_write_time.time_since_epoch().count()) };
+}
+}
+
+std::unique_ptr<SQLite::Database> cometa::init_db(const fs::path& path, const dbgeng_logger& log) {
     if (path.empty()) {
         log.log_info(L"Could not open the metadata database from the dafault location. Switching to a temporary in-memory database.");
     } else {
@@ -56,74 +224,500 @@ std::unique_ptr<SQLite::Database> cometa::init_db(const fs::path& path, IDebugCo
     }
 
     auto db{ std::make_unique<SQLite::Database>(to_utf8(path.c_str()), SQLite::OPEN_CREATE | SQLite::OPEN_READWRITE) };
+    configure_connection(*db, path.empty(), log);
 
-    db->exec(R"(create table schema_version (version integer not null);)");
-    db->exec(std::format("insert into schema_version (version) values({})", schema_version));
-
-    db->exec(R"(create table cotypes (
-iid blob primary key, 
-type integer not null,
-name text not null,
-parent_iid blob not null,
-methods_available int not null) without rowid)");
-
-    db->exec(R"(create table cotype_methods (
-iid blob not null,
-ordinal integer not null,
-name text not null,
-callconv integer not null,
-dispid integer null,
-return_type text not null,
-primary key (iid, ordinal)) without rowid)");
-
-    db->exec(R"(create table cotype_method_args (
-iid blob not null,
-method_ordinal integer not null,
-name text not null,
-ordinal integer not null,
-type text not null,
-flags int not null,
-primary key (iid, method_ordinal, ordinal)) without rowid)");
-
-    db->exec(R"(create table coclasses (
-clsid blob primary key, 
-name text not null
-) without rowid)");
-
-    db->exec(R"(create table vtables (
-clsid blob not null, 
-iid blob not null,
-module_name text not null,
-module_timestamp integer not null,
-vtable integer not null,
-primary key (clsid, iid)) without rowid;
-create index IX_vtables_iid on vtables (iid);
-create index IX_vtables_module_name on vtables (module_name))");
+    create_base_schema(*db);
+    upgrade_schema(*db, base_schema_version, nullptr);
 
     return db;
 }
 
-std::unique_ptr<SQLite::Database> cometa::open_db(const fs::path& path, IDebugControl4* dbgcontrol) {
-    dbgeng_logger log{ dbgcontrol };
+std::unique_ptr<SQLite::Database> cometa::open_db(const fs::path& path, const dbgeng_logger& log) {
     log.log_info(std::format(L"Opening an existing metadata database from '{}'.", path.c_str()));
 
     auto db{ std::make_unique<SQLite::Database>(to_utf8(path.c_str()), SQLite::OPEN_READWRITE) };
-    if (SQLite::Statement query{ *db, "select version from schema_version" };
-        !query.executeStep() || query.getColumn("version").getInt() != schema_version) {
+    configure_connection(*db, false, log);
+
+    int version{};
+    if (SQLite::Statement query{ *db, "select version from schema_version" }; query.executeStep()) {
+        version = query.getColumn("version").getInt();
+    }
+
+    if (version < base_schema_version || version > schema_version) {
         log.log_error(L"Incorrect version of the schema detected.", E_FAIL);
         throw std::invalid_argument{ "incorrect database schema" };
     }
+
+    if (version < schema_version) {
+        log.log_info(std::format(L"Upgrading the metadata database schema from version {} to {}.", version, schema_version));
+        try {
+            upgrade_schema(*db, version, &log);
+        } catch (const SQLite::Exception& ex) {
+            log.log_error(std::format(L"Error {} when trying to upgrade the metadata database: '{}'.",
+                ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
+            throw;
+        } catch (const std::runtime_error& ex) {
+            log.log_error(std::format(L"Error when trying to upgrade the metadata database: '{}'.", widen(ex.what())), E_FAIL);
+            throw;
+        }
+    }
     return db;
 }
 
+std::unique_ptr<SQLite::Database> cometa::open_read_db(const SQLite::Database& db, const fs::path& path) {
+    // without WAL, a read-only connection would still block the writers of other sessions
+    if (path.empty() || db.execAndGet("pragma journal_mode").getString() != "wal") {
+        return nullptr;
+    }
 
-cometa::cometa(IDebugControl4* dbgcontrol, bool is_wow64, const fs::path& db_path, bool create_new):
-    _logger{ dbgcontrol }, _is_wow64{ is_wow64 },
-    _db{ create_new ? init_db(db_path, dbgcontrol) : open_db(db_path, dbgcontrol) } {
+    auto read_db{ std::make_unique<SQLite::Database>(to_utf8(path.c_str()), SQLite::OPEN_READONLY) };
+    read_db->setBusyTimeout(busy_timeout_ms);
+    return read_db;
+}
+
+cometa::cometa(const dbgeng_logger& logger, USHORT arch, const fs::path& db_path, bool create_new,
+    std::span<const legacy_database> legacy_databases):
+    _logger{ logger }, _arch{ arch },
+    _db{ create_new ? init_db(db_path, logger) : open_db(db_path, logger) },
+    _read_db{ open_read_db(*_db, db_path) }, _statements{ *_db },
+    _read_statements{ _read_db ? std::make_unique<statement_cache>(*_read_db) : nullptr },
+    _snapshot_path{ db_path.empty() ? fs::path{} : fs::path{ db_path }.replace_extension(L".snapshot") } {
 
     if (create_new) {
         fill_known_iids();
+
+        // a snapshot left by a previous database could have the same revision as the new one
+        if (std::error_code ec{}; !_snapshot_path.empty()) {
+            fs::remove(_snapshot_path, ec);
+        }
+
+        for (const auto& legacy : legacy_databases) {
+            _logger.log_info(std::format(L"Importing the metadata from '{}'.", legacy.path.c_str()));
+            merge(legacy.path.native(), merge_policy::newest, legacy.arch);
+        }
+        if (!legacy_databases.empty()) {
+            _logger.log_info(L"The imported files are no longer used and may be deleted. The next !cometa index parses all the type libraries again.");
+        }
+    } else {
+        // the revision changes if the base database changed since the previous session
+        open_base();
+        open_snapshot();
+    }
+
+    // the snapshot answers the type and class lookups, including the negative ones
+    if (!_snapshot) {
+        load_known_guids();
+    }
+    load_known_modules();
+}
+
+cometa::~cometa() {
+    poll_index_job();
+    if (_index_job) {
+        // waits for the indexing thread to stop
+        _index_job->cancel();
+        _index_job.reset();
+        remove_staging_db();
+    }
+
+    if (_working_set) {
+        // waits for the background writer, so the remaining rows are written here
+        _working_set->writer.reset();
+    }
+    flush_vtables();
+
+    if (_snapshot_stale) {
+        // the next session exports the snapshot again, with the rows resolved from the registry
+        bump_metadata_revision();
+    }
+}
+
+void cometa::load_known_guids() noexcept {
+    assert(_db);
+
+    _known_guids_loaded = false;
+
+    auto load = [this](bloom_filter& filter, const char* count_sql, const char* guids_sql) {
+        filter.reset(static_cast<size_t>(_db->execAndGet(count_sql).getInt64()) * 2);
+
+        SQLite::Statement query{ *_db, guids_sql };
+        while (query.executeStep()) {
+            filter.add(guid_fingerprint(*reinterpret_cast<const GUID*>(query.getColumn(0).getBlob())));
+        }
+    };
+
+    try {
+        load(_known_types, "select count(*) from cotypes", "select iid from cotypes");
+        load(_known_classes, "select count(*) from coclasses", "select clsid from coclasses");
+        _known_guids_loaded = true;
+    } catch (const SQLite::Exception& ex) {
+        // without the filters, all the lookups go to the database
+        _logger.log_error(std::format(L"Error {} when loading the known GUIDs: '{}'.",
+            ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
+    }
+}
+
+void cometa::load_known_modules() noexcept {
+    assert(_db);
+
+    _known_modules_loaded = false;
+
+    try {
+        // the modules of the base are probed on their first load (see _base_module_probes)
+        SQLite::Statement query{ *_db, "select distinct module_name,module_timestamp from main.vtables where arch = :arch" };
+        query.bind(":arch", static_cast<int>(_arch));
+
+        std::vector<uint64_t> fingerprints{};
+        while (query.executeStep()) {
+            fingerprints.push_back(module_fingerprint(query.getColumn(0).getText(), static_cast<ULONG>(query.getColumn(1).getInt64())));
+        }
+
+        _known_modules.reset(fingerprints.size() * 2);
+        for (auto fingerprint : fingerprints) {
+            _known_modules.add(fingerprint);
+        }
+        _base_module_probes.clear();
+        _known_modules_loaded = true;
+    } catch (const SQLite::Exception& ex) {
+        // without the filter, all the module lookups go to the database
+        _logger.log_error(std::format(L"Error {} when loading the known modules: '{}'.",
+            ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
+    }
+}
+
+uint32_t cometa::metadata_revision() {
+    return static_cast<uint32_t>(_db->execAndGet("pragma user_version").getInt());
+}
+
+void cometa::bump_metadata_revision() noexcept {
+    try {
+        _db->exec(std::format("pragma user_version = {}", static_cast<int32_t>(metadata_revision() + 1)));
+    } catch (const SQLite::Exception& ex) {
+        _logger.log_error(std::format(L"Error {} when updating the metadata revision: '{}'.",
+            ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
+    }
+}
+
+HRESULT cometa::export_snapshot(uint32_t revision) {
+    snapshot_builder builder{};
+
+    auto guid_of = [](const SQLite::Column& column) { return *reinterpret_cast<const GUID*>(column.getBlob()); };
+
+    SQLite::Statement types{ *_db, "select iid,name,type,parent_iid,methods_available from cotypes" };
+    while (types.executeStep()) {
+        builder.add_type(guid_of(types.getColumn(0)), from_utf8(types.getColumn(1).getText()),
+            types.getColumn(2).getUInt(), guid_of(types.getColumn(3)), types.getColumn(4).getInt() != 0);
+    }
+
+    // the snapshot is shared by the sessions of both architectures, the lookups read the other signatures from the database
+    string_pool names{};
+    SQLite::Statement signatures{ *_db, "select iid,signature from cotype_signatures where arch = 0" };
+    while (signatures.executeStep()) {
+        auto iid{ guid_of(signatures.getColumn(0)) };
+        auto methods{ decode_signature(iid, signatures.getColumn(1), names) };
+        if (std::holds_alternative<HRESULT>(methods)) {
+            return std::get<HRESULT>(methods);
+        }
+
+        for (const auto& [method, args] : std::get<std::vector<covtable_method>>(methods)) {
+            builder.add_method(iid, method.name, method.ordinal, static_cast<uint32_t>(method.callconv), method.dispid, method.return_type);
+            for (const auto& arg : args) {
+                builder.add_method_arg(iid, method.ordinal, arg.name, arg.type, arg.flags);
+            }
+        }
+    }
+
+    SQLite::Statement classes{ *_db, "select clsid,name from coclasses" };
+    while (classes.executeStep()) {
+        builder.add_class(guid_of(classes.getColumn(0)), from_utf8(classes.getColumn(1).getText()));
+    }
+
+    return builder.write(_snapshot_path, schema_version, revision);
+}
+
+void cometa::build_name_index(uint32_t revision) {
+    using namespace std::chrono;
+
+    auto build_start{ steady_clock::now() };
+    auto guid_of = [](const SQLite::Column& column) { return *reinterpret_cast<const GUID*>(column.getBlob()); };
+
+    auto index{ std::make_unique<name_index>() };
+
+    SQLite::Statement types{ *_db, "select iid,name from cotypes" };
+    while (types.executeStep()) {
+        index->add(name_kind::type, guid_of(types.getColumn(0)), from_utf8(types.getColumn(1).getText()));
+    }
+
+    SQLite::Statement classes{ *_db, "select clsid,name from coclasses" };
+    while (classes.executeStep()) {
+        index->add(name_kind::coclass, guid_of(classes.getColumn(0)), from_utf8(classes.getColumn(1).getText()));
+    }
+
+    // the method names are the same in the signatures of both architectures
+    string_pool method_names{};
+    SQLite::Statement signatures{ *_db, "select iid,signature,max(arch) from cotype_signatures group by iid" };
+    while (signatures.executeStep()) {
+        auto iid{ guid_of(signatures.getColumn(0)) };
+        if (auto methods{ decode_signature(iid, signatures.getColumn(1), method_names) }; std::holds_alternative<HRESULT>(methods)) {
+            _logger.log_error(std::format(L"Invalid method signature of {:b}, its methods are not searchable.", iid), std::get<HRESULT>(methods));
+        } else {
+            for (const auto& [method, args] : std::get<std::vector<covtable_method>>(methods)) {
+                index->add(name_kind::method, iid, method.name);
+            }
+        }
+    }
+
+    index->build();
+
+    _logger.log_info(std::format(L"Name index built: {} names, {} entries in {} ms", index->names_count(), index->entries_count(),
+        duration_cast<milliseconds>(steady_clock::now() - build_start).count()));
+
+    _name_index = std::move(index);
+    _name_index_revision = revision;
+}
+
+std::variant<name_search_result, HRESULT> cometa::find_names(std::wstring_view text, size_t max_results) {
+    try {
+        if (auto revision{ metadata_revision() }; !_name_index || _name_index_revision != revision) {
+            build_name_index(revision);
+        }
+        return _name_index->find(text, max_results);
+    } catch (const SQLite::Exception& ex) {
+        _logger.log_error(std::format(L"Error {} when building the name index: '{}'.",
+            ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
+        return E_FAIL;
+    }
+}
+
+void cometa::open_snapshot() noexcept {
+    if (_snapshot_stale) {
+        // the rows resolved from the registry go into the new snapshot
+        bump_metadata_revision();
+        _snapshot_stale = false;
+    }
+    _snapshot.reset();
+    _written_since_snapshot.clear();
+    if (_snapshot_path.empty()) {
+        return;
+    }
+
+    try {
+        auto revision{ metadata_revision() };
+        auto snapshot{ metadata_snapshot::open(_snapshot_path, schema_version, revision) };
+        if (std::holds_alternative<HRESULT>(snapshot)) {
+            // the snapshot is missing or was exported from an older revision of the database
+            _logger.log_info(std::format(L"Exporting the metadata snapshot to '{}'.", _snapshot_path.c_str()));
+            if (auto hr{ export_snapshot(revision) }; FAILED(hr)) {
+                _logger.log_error(L"Could not export the metadata snapshot", hr);
+                return;
+            }
+            snapshot = metadata_snapshot::open(_snapshot_path, schema_version, revision);
+        }
+
+        if (std::holds_alternative<HRESULT>(snapshot)) {
+            _logger.log_error(L"Could not open the metadata snapshot", std::get<HRESULT>(snapshot));
+        } else {
+            _snapshot = std::move(std::get<std::unique_ptr<metadata_snapshot>>(snapshot));
+        }
+    } catch (const std::exception& ex) {
+        // without the snapshot, all the lookups go to the database
+        _logger.log_error(std::format(L"Error when loading the metadata snapshot: '{}'.", widen(ex.what())), E_FAIL);
+    }
+}
+
+void cometa::reload_metadata() noexcept {
+    invalidate_cache();
+    if (_is_staging) {
+        // the lookups never read the staging database, its metadata is merged into the open one
+        return;
+    }
+    open_snapshot();
+    if (!_snapshot) {
+        load_known_guids();
+    }
+    load_known_modules();
+    // the new metadata may define the GUIDs missing from the registry
+    _registry_misses.clear();
+
+    if (_working_set) {
+        // the new vtables are loaded into memory again
+        disable_working_set();
+        enable_working_set();
+    }
+}
+
+void cometa::open_base() noexcept {
+    try {
+        SQLite::Statement query{ *_db, "select path from main.base_database" };
+        if (!query.executeStep()) {
+            return;
+        }
+        fs::path base_path{ from_utf8(query.getColumn(0).getText()) };
+        query.reset();
+
+        // a missing base is recorded too, so the snapshot exported without it is not used when it comes back
+        if (std::error_code ec{}; !fs::is_regular_file(base_path, ec)) {
+            _logger.log_warning(std::format(L"Can't find the base metadata database '{}', only the overlay is used.", base_path.c_str()));
+        } else if (auto version{ db_schema_version(base_path) }; version < layered_schema_version || version > schema_version) {
+            // the views would read the columns missing from an older schema
+            _logger.log_warning(std::format(L"The base metadata database '{}' has an unsupported schema (version {}), only the overlay "
+                L"is used. Open it in a new session to upgrade it.", base_path.c_str(), version));
+        } else {
+            attach_base(base_path);
+        }
+
+        if (save_base_record(base_path)) {
+            bump_metadata_revision();
+        }
+    } catch (const SQLite::Exception& ex) {
+        _logger.log_error(std::format(L"Error {} when attaching the base metadata database: '{}'.",
+            ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
+    }
+}
+
+void cometa::attach_base(const fs::path& base_path) {
+    attach_base_db(*_db, base_path);
+    if (_read_db) {
+        try {
+            attach_base_db(*_read_db, base_path);
+        } catch (const SQLite::Exception&) {
+            detach_base_db(*_db);
+            throw;
+        }
     }
+    _base_path = base_path;
+}
+
+void cometa::detach_base() noexcept {
+    // the cached statements read the views
+    _statements.clear();
+    if (_read_statements) {
+        _read_statements->clear();
+        detach_base_db(*_read_db);
+    }
+    detach_base_db(*_db);
+    _base_path.clear();
+}
+
+bool cometa::save_base_record(const fs::path& base_path) {
+    auto [size, last_write_time] { base_db_fingerprint(base_path) };
+    auto path_u8{ to_utf8(base_path.c_str()) };
+
+    {
+        SQLite::Statement query{ *_db, "select 1 from main.base_database where path = :path and size = :size and last_write_time = :last_write_time" };
+        query.bind(":path", path_u8);
+        query.bind(":size", static_cast<long long>(size));
+        query.bind(":last_write_time", static_cast<long long>(last_write_time));
+        if (query.executeStep()) {
+            return false;
+        }
+    }
+
+    SQLite::Transaction transaction{ *_db };
+    {
+        // the tombstones belong to the type libraries of the previous base
+        SQLite::Statement other_base{ *_db, "select 1 from main.base_database where path <> :path" };
+        other_base.bind(":path", path_u8);
+        if (other_base.executeStep()) {
+            _db->exec("delete from main.base_tombstones");
+        }
+    }
+    _db->exec("delete from main.base_database");
+    SQLite::Statement insert{ *_db, "insert into main.base_database (path, size, last_write_time) values (:path, :size, :last_write_time)" };
+    insert.bind(":path", path_u8);
+    insert.bind(":size", static_cast<long long>(size));
+    insert.bind(":last_write_time", static_cast<long long>(last_write_time));
+    insert.exec();
+    transaction.commit();
+    return true;
+}
+
+HRESULT cometa::set_base(std::wstring_view base_path) {
+    assert(_db);
+
+    if (_index_job) {
+        _logger.log_error(L"The metadata index is running in the background (see !cometa index status).", E_NOT_VALID_STATE);
+        return E_NOT_VALID_STATE;
+    }
+
+    std::error_code ec{};
+    // attach would create an empty database for a missing file
+    if (!fs::is_regular_file(base_path, ec)) {
+        _logger.log_error(std::format(L"Can't find the metadata database '{}'.", base_path), HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND));
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
+    auto path{ fs::absolute(base_path, ec) };
+    if (ec || fs::equivalent(path, from_utf8(_db->getFilename()), ec)) {
+        _logger.log_error(std::format(L"'{}' can't be the base of its own metadata.", base_path), E_INVALIDARG);
+        return E_INVALIDARG;
+    }
+
+    try {
+        if (auto version{ db_schema_version(path) }; version < layered_schema_version || version > schema_version) {
+            _logger.log_error(std::format(L"'{}' is not a metadata database with a supported schema (version {}). Open it in a "
+                L"new session to upgrade it.", base_path, version), E_INVALIDARG);
+            return E_INVALIDARG;
+        }
+
+        // the revision changes before the metadata, so the snapshot and the name index are rebuilt
+        _snapshot.reset();
+        bump_metadata_revision();
+        auto refresh_caches{ wil::scope_exit([this]() { reload_metadata(); }) };
+
+        detach_base();
+        attach_base(path);
+        save_base_record(path);
+
+        auto count_rows = [this](const char* table) { return _db->execAndGet(std::format("select count(*) from base.{}", table)).getInt64(); };
+        _logger.log_info(std::format(L"The metadata is layered over '{}' ({} types, {} classes, and {} vtables). The new metadata "
+            L"is saved to '{}'.", path.c_str(), count_rows("cotypes"), count_rows("coclasses"), count_rows("vtables"),
+            from_utf8(_db->getFilename())));
+        return S_OK;
+    } catch (const SQLite::Exception& ex) {
+        _logger.log_error(std::format(L"Error {} when attaching the base metadata database: '{}'.",
+            ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
+        return E_FAIL;
+    }
+}
+
+HRESULT cometa::remove_base() {
+    assert(_db);
+
+    if (_index_job) {
+        _logger.log_error(L"The metadata index is running in the background (see !cometa index status).", E_NOT_VALID_STATE);
+        return E_NOT_VALID_STATE;
+    }
+
+    try {
+        // a missing base is not attached, but stays recorded
+        if (_base_path.empty() && _db->execAndGet("select count(*) from main.base_database").getInt() == 0) {
+            return base_status();
+        }
+
+        _snapshot.reset();
+        bump_metadata_revision();
+        auto refresh_caches{ wil::scope_exit([this]() { reload_metadata(); }) };
+
+        detach_base();
+        _db->exec("delete from main.base_database; delete from main.base_tombstones");
+
+        _logger.log_info(L"The metadata is no longer layered, only this database is used.");
+        return S_OK;
+    } catch (const SQLite::Exception& ex) {
+        _logger.log_error(std::format(L"Error {} when removing the base metadata database: '{}'.",
+            ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
+        return E_FAIL;
+    }
+}
+
+HRESULT cometa::base_status() {
+    if (_base_path.empty()) {
+        _logger.log_info(L"The metadata is not layered.");
+    } else {
+        _logger.log_info(std::format(L"The metadata is layered over the read-only '{}', the new metadata is saved to '{}'.",
+            _base_path.c_str(), from_utf8(_db->getFilename())));
+    }
+    return S_OK;
 }
 
 void cometa::fill_known_iids() {
@@ -134,326 +728,1009 @@ void cometa::fill_known_iids() {
     // IUnknown
     insert_cotype(cotype{ __uuidof(IUnknown), L"IUnknown", cotype_kind::Interface, {}, true });
 
-    insert_cotype_method(comethod{ __uuidof(IUnknown), L"QueryInterface", 0, CC_STDCALL, std::nullopt, L"HRESULT" });
-    insert_cotype_method_arg(__uuidof(IUnknown), 0, { L"this", L"void*", 0 }, 0);
-    insert_cotype_method_arg(__uuidof(IUnknown), 0, { L"riid", L"GUID*", IDLFLAG_FIN }, 1);
-    insert_cotype_method_arg(__uuidof(IUnknown), 0, { L"ppvObject", L"void**", IDLFLAG_FOUT }, 2);
-
-    insert_cotype_method(comethod{ __uuidof(IUnknown), L"AddRef", 1, CC_STDCALL, std::nullopt, L"ULONG" });
-    insert_cotype_method_arg(__uuidof(IUnknown), 1, { L"this", L"void*", 0 }, 0);
-
-    insert_cotype_method(comethod{ __uuidof(IUnknown), L"Release", 2, CC_STDCALL, std::nullopt, L"ULONG" });
-    insert_cotype_method_arg(__uuidof(IUnknown), 2, { L"this", L"void*", 0 }, 0);
+    insert_cotype_methods(__uuidof(IUnknown), std::array{
+        covtable_method{ { __uuidof(IUnknown), L"QueryInterface", 0, CC_STDCALL, std::nullopt, L"HRESULT" },
+            { { L"this", L"void*", 0 }, { L"riid", L"GUID*", IDLFLAG_FIN }, { L"ppvObject", L"void**", IDLFLAG_FOUT } } },
+        covtable_method{ { __uuidof(IUnknown), L"AddRef", 1, CC_STDCALL, std::nullopt, L"ULONG" },
+            { { L"this", L"void*", 0 } } },
+        covtable_method{ { __uuidof(IUnknown), L"Release", 2, CC_STDCALL, std::nullopt, L"ULONG" },
+            { { L"this", L"void*", 0 } } } });
 
     // IDispatch
     insert_cotype(cotype{ __uuidof(IDispatch), L"IDispatch", cotype_kind::Interface, __uuidof(IUnknown), true });
 
-    insert_cotype_method(comethod{ __uuidof(IDispatch), L"GetTypeInfoCount", 0, CC_STDCALL, std::nullopt, L"HRESULT" });
-    insert_cotype_method_arg(__uuidof(IDispatch), 0, { L"this", L"void*", 0 }, 0);
-    insert_cotype_method_arg(__uuidof(IDispatch), 0, { L"pctinfo", L"UINT*", IDLFLAG_FOUT }, 1);
-
-    insert_cotype_method(comethod{ __uuidof(IDispatch), L"GetTypeInfo", 1, CC_STDCALL, std::nullopt, L"HRESULT" });
-    insert_cotype_method_arg(__uuidof(IDispatch), 1, { L"this", L"void*", 0 }, 0);
-    insert_cotype_method_arg(__uuidof(IDispatch), 1, { L"iTInfo", L"UINT", IDLFLAG_FIN }, 1);
-    insert_cotype_method_arg(__uuidof(IDispatch), 1, { L"lcid", L"unsigned short", IDLFLAG_FIN }, 2);
-    insert_cotype_method_arg(__uuidof(IDispatch), 1, { L"ppTInfo", L"ITypeInfo**", IDLFLAG_FOUT }, 3);
-
-    insert_cotype_method(comethod{ __uuidof(IDispatch), L"GetIDsOfNames", 2, CC_STDCALL, std::nullopt, L"HRESULT" });
-    insert_cotype_method_arg(__uuidof(IDispatch), 2, { L"this", L"void*", 0 }, 0);
-    insert_cotype_method_arg(__uuidof(IDispatch), 2, { L"riid", L"GUID*", IDLFLAG_FIN }, 1);
-    insert_cotype_method_arg(__uuidof(IDispatch), 2, { L"rgszNames", L"LPOLESTR*", IDLFLAG_FIN }, 2);
-    insert_cotype_method_arg(__uuidof(IDispatch), 2, { L"cNames", L"UINT", IDLFLAG_FIN }, 3);
-    insert_cotype_method_arg(__uuidof(IDispatch), 2, { L"lcid", L"unsigned short", IDLFLAG_FIN }, 4);
-    insert_cotype_method_arg(__uuidof(IDispatch), 2, { L"rgDispId", L"DISPID*", IDLFLAG_FOUT }, 5);
-
-    insert_cotype_method(comethod{ __uuidof(IDispatch), L"Invoke", 3, CC_STDCALL, std::nullopt, L"HRESULT" });
-    insert_cotype_method_arg(__uuidof(IDispatch), 3, { L"this", L"void*", 0 }, 0);
-    insert_cotype_method_arg(__uuidof(IDispatch), 3, comethod_arg{ L"dispIdMember", L"DISPID", IDLFLAG_FIN }, 1);
-    insert_cotype_method_arg(__uuidof(IDispatch), 3, comethod_arg{ L"riid", L"GUID*", IDLFLAG_FIN }, 2);
-    insert_cotype_method_arg(__uuidof(IDispatch), 3, comethod_arg{ L"lcid", L"unsigned short", IDLFLAG_FIN }, 3);
-    insert_cotype_method_arg(__uuidof(IDispatch), 3, comethod_arg{ L"wFlags", L"unsigned short", IDLFLAG_FIN }, 4);
-    insert_cotype_method_arg(__uuidof(IDispatch), 3, comethod_arg{ L"pDispParams", L"DISPPARAMS*", IDLFLAG_FIN }, 5);
-    insert_cotype_method_arg(__uuidof(IDispatch), 3, comethod_arg{ L"pVarResult", L"VARIANT*", IDLFLAG_FOUT }, 6);
-    insert_cotype_method_arg(__uuidof(IDispatch), 3, comethod_arg{ L"pExcepInfo", L"EXCEPINFO*", IDLFLAG_FOUT }, 7);
-    insert_cotype_method_arg(__uuidof(IDispatch), 3, comethod_arg{ L"puArgErr", L"unsigned int*", IDLFLAG_FOUT }, 8);
+    insert_cotype_methods(__uuidof(IDispatch), std::array{
+        covtable_method{ { __uuidof(IDispatch), L"GetTypeInfoCount", 0, CC_STDCALL, std::nullopt, L"HRESULT" },
+            { { L"this", L"void*", 0 }, { L"pctinfo", L"UINT*", IDLFLAG_FOUT } } },
+        covtable_method{ { __uuidof(IDispatch), L"GetTypeInfo", 1, CC_STDCALL, std::nullopt, L"HRESULT" },
+            { { L"this", L"void*", 0 }, { L"iTInfo", L"UINT", IDLFLAG_FIN }, { L"lcid", L"unsigned short", IDLFLAG_FIN },
+                { L"ppTInfo", L"ITypeInfo**", IDLFLAG_FOUT } } },
+        covtable_method{ { __uuidof(IDispatch), L"GetIDsOfNames", 2, CC_STDCALL, std::nullopt, L"HRESULT" },
+            { { L"this", L"void*", 0 }, { L"riid", L"GUID*", IDLFLAG_FIN }, { L"rgszNames", L"LPOLESTR*", IDLFLAG_FIN },
+                { L"cNames", L"UINT", IDLFLAG_FIN }, { L"lcid", L"unsigned short", IDLFLAG_FIN }, { L"rgDispId", L"DISPID*", IDLFLAG_FOUT } } },
+        covtable_method{ { __uuidof(IDispatch), L"Invoke", 3, CC_STDCALL, std::nullopt, L"HRESULT" },
+            { { L"this", L"void*", 0 }, { L"dispIdMember", L"DISPID", IDLFLAG_FIN }, { L"riid", L"GUID*", IDLFLAG_FIN },
+                { L"lcid", L"unsigned short", IDLFLAG_FIN }, { L"wFlags", L"unsigned short", IDLFLAG_FIN },
+                { L"pDispParams", L"DISPPARAMS*", IDLFLAG_FIN }, { L"pVarResult", L"VARIANT*", IDLFLAG_FOUT },
+                { L"pExcepInfo", L"EXCEPINFO*", IDLFLAG_FOUT }, { L"puArgErr", L"unsigned int*", IDLFLAG_FOUT } } } });
 
     transaction.commit();
 
     _known_iids.insert_range(std::array<IID, 2> { __uuidof(IUnknown), __uuidof(IDispatch) });
 }
 
-bool cometa::is_valid_db(const fs::path& path) {
-    try {
-        auto db{ std::make_unique<SQLite::Database>(to_utf8(path.c_str()), SQLite::OPEN_READWRITE) };
-        SQLite::Statement query{ *db, "select version from schema_version" };
-        return query.executeStep() && query.getColumn("version").getInt() == schema_version;
-    } catch (...) {
-        return false;
+void cometa::insert_cotype(const cotype& typedesc, row_source source) {
+    if (_known_iids.contains(typedesc.iid)) {
+        return;
     }
+
+    assert(_db);
+    auto name_u8{ to_utf8(typedesc.name) };
+
+    _known_types.add(guid_fingerprint(typedesc.iid));
+    mark_written(typedesc.iid);
+
+    auto stmt{ _statements.acquire(source == row_source::typelib ?
+        R"(insert or replace into main.cotypes (iid, type, name, parent_iid, methods_available) 
+    values (:iid, :type, :name, :parent_iid, :methods_available))" :
+        R"(insert into main.cotypes (iid, type, name, parent_iid, methods_available)
+    values (:iid, :type, :name, :parent_iid, :methods_available)
+    on conflict (iid) do update set type = excluded.type, name = excluded.name, parent_iid = excluded.parent_iid,
+        methods_available = excluded.methods_available
+    where not exists (select 1 from typelib_guids where guid = excluded.iid))") };
+    stmt->bindNoCopy(":iid", &typedesc.iid, sizeof(GUID));
+    stmt->bind(":type", static_cast<int>(typedesc.type));
+    stmt->bindNoCopy(":name", name_u8);
+    stmt->bindNoCopy(":parent_iid", &typedesc.parent_iid, sizeof(GUID));
+    stmt->bind(":methods_available", static_cast<int>(typedesc.methods_available));
+
+    stmt->exec();
 }
 
-void cometa::insert_cotype(const cotype& typedesc) {
-    if (_known_iids.contains(typedesc.iid)) {
+void cometa::insert_cotype_methods(const IID& iid, std::span<const covtable_method> methods, USHORT arch) {
+    if (_known_iids.contains(iid)) {
         return;
     }
 
     assert(_db);
-    auto name_u8{ to_utf8(typedesc.name) };
+    auto blob{ signature::encode(methods) };
+
+    mark_written(iid);
+
+    auto stmt{ _statements.acquire("insert or replace into main.cotype_signatures (iid, arch, signature) values (:iid, :arch, :signature)") };
+    stmt->bindNoCopy(":iid", &iid, sizeof(GUID));
+    stmt->bind(":arch", static_cast<int>(arch));
+    stmt->bindNoCopy(":signature", blob.data(), static_cast<int>(blob.size()));
+
+    stmt->exec();
+}
+
+void cometa::insert_coclass(const coclass& classdesc, row_source source) {
+    assert(_db);
+    auto name_u8{ to_utf8(classdesc.name) };
+
+    _known_classes.add(guid_fingerprint(classdesc.clsid));
+    mark_written(classdesc.clsid);
+
+    auto stmt{ _statements.acquire(source == row_source::typelib ?
+        "insert or replace into main.coclasses (clsid, name) values (:clsid, :name)" :
+        R"(insert into main.coclasses (clsid, name) values (:clsid, :name)
+    on conflict (clsid) do update set name = excluded.name
+    where not exists (select 1 from typelib_guids where guid = excluded.clsid))") };
+    stmt->bindNoCopy(":clsid", &classdesc.clsid, sizeof(GUID));
+    stmt->bindNoCopy(":name", name_u8);
+
+    stmt->exec();
+}
+
+void cometa::insert_typelib_guid(std::wstring_view tlb_path, const GUID& guid) {
+    assert(_db);
+    auto path_u8{ to_utf8(tlb_path) };
+
+    auto stmt{ _statements.acquire("insert or ignore into main.typelib_guids (path, guid) values (:path, :guid)") };
+    stmt->bindNoCopy(":path", path_u8);
+    stmt->bindNoCopy(":guid", &guid, sizeof(GUID));
+
+    stmt->exec();
+}
+
+std::optional<typelib_fingerprint> cometa::find_typelib_fingerprint(std::wstring_view tlb_path) {
+    assert(_db);
+    auto path_u8{ to_utf8(tlb_path) };
+
+    auto query{ _statements.acquire("select size,last_write_time,hash from typelibs where path = :path") };
+    query->bindNoCopy(":path", path_u8);
+
+    if (!query->executeStep()) {
+        return std::nullopt;
+    }
+    return typelib_fingerprint{
+        .size = static_cast<uint64_t>(query->getColumn(0).getInt64()),
+        .last_write_time = query->getColumn(1).getInt64(),
+        .hash = static_cast<uint64_t>(query->getColumn(2).getInt64()) };
+}
+
+USHORT cometa::find_typelib_arch(std::wstring_view tlb_path) {
+    assert(_db);
+    auto path_u8{ to_utf8(tlb_path) };
+
+    auto query{ _statements.acquire("select arch from typelibs where path = :path") };
+    query->bindNoCopy(":path", path_u8);
+
+    return query->executeStep() ? static_cast<USHORT>(query->getColumn(0).getUInt()) : 0;
+}
+
+std::vector<std::pair<std::wstring, bool>> cometa::get_indexed_typelibs() {
+    assert(_db);
+
+    auto query{ _statements.acquire("select path,registered from typelibs") };
+
+    std::vector<std::pair<std::wstring, bool>> typelibs{};
+    while (query->executeStep()) {
+        typelibs.push_back({ from_utf8(query->getColumn(0).getText()), query->getColumn(1).getInt() != 0 });
+    }
+    return typelibs;
+}
+
+void cometa::save_typelib(std::wstring_view tlb_path, const typelib_fingerprint& fingerprint, bool registered, USHORT arch) {
+    assert(_db);
+    auto path_u8{ to_utf8(tlb_path) };
+
+    // a library indexed manually becomes registered once the full index finds it in the registry
+    auto stmt{ _statements.acquire(R"(insert into main.typelibs (path, registered, size, last_write_time, hash, arch)
+    values (:path, :registered, :size, :last_write_time, :hash, :arch)
+    on conflict (path) do update set registered = max(registered, excluded.registered), size = excluded.size,
+        last_write_time = excluded.last_write_time, hash = excluded.hash, arch = excluded.arch)") };
+    stmt->bindNoCopy(":path", path_u8);
+    stmt->bind(":registered", registered ? 1 : 0);
+    stmt->bind(":arch", static_cast<int>(arch));
+    stmt->bind(":size", static_cast<long long>(fingerprint.size));
+    stmt->bind(":last_write_time", static_cast<long long>(fingerprint.last_write_time));
+    stmt->bind(":hash", static_cast<long long>(fingerprint.hash));
+
+    stmt->exec();
+}
+
+void cometa::remove_typelib(std::wstring_view tlb_path, bool forget) {
+    assert(_db);
+    auto path_u8{ to_utf8(tlb_path) };
+
+    // the GUIDs with a flag set if no other library (for example, the file of the other architecture) defines them
+    std::vector<std::pair<GUID, bool>> guids{};
+    {
+        auto query{ _statements.acquire(R"(select g.guid, not exists (select 1 from typelib_guids o where o.guid = g.guid and o.path <> :path)
+    from typelib_guids g where g.path = :path)") };
+        query->bindNoCopy(":path", path_u8);
+        while (query->executeStep()) {
+            guids.push_back({ *reinterpret_cast<const GUID*>(query->getColumn(0).getBlob()), query->getColumn(1).getInt() != 0 });
+        }
+    }
+
+    auto arch{ find_typelib_arch(tlb_path) };
+
+    for (auto& [guid, only_owner] : guids) {
+        if (only_owner) {
+            for (auto sql : { "delete from main.cotypes where iid = :guid", "delete from main.cotype_signatures where iid = :guid",
+                "delete from main.coclasses where clsid = :guid" }) {
+                auto stmt{ _statements.acquire(sql) };
+                stmt->bindNoCopy(":guid", &guid, sizeof(GUID));
+                stmt->exec();
+            }
+        } else {
+            // the type stays, but its signature is parsed again from the library that still defines it
+            auto stmt{ _statements.acquire("delete from main.cotype_signatures where iid = :guid and arch = :arch") };
+            stmt->bindNoCopy(":guid", &guid, sizeof(GUID));
+            stmt->bind(":arch", static_cast<int>(arch));
+            stmt->exec();
+        }
+        mark_written(guid);
+    }
+
+    auto stmt{ _statements.acquire("delete from main.typelib_guids where path = :path") };
+    stmt->bindNoCopy(":path", path_u8);
+    stmt->exec();
+
+    if (!_base_path.empty()) {
+        // the base rows of the library can't be deleted, so the views hide them
+        auto tombstone_stmt{ _statements.acquire(
+            "insert or ignore into main.base_tombstones (path) select path from base.typelibs where path = :path") };
+        tombstone_stmt->bindNoCopy(":path", path_u8);
+        tombstone_stmt->exec();
+    }
+
+    if (forget) {
+        auto forget_stmt{ _statements.acquire("delete from main.typelibs where path = :path") };
+        forget_stmt->bindNoCopy(":path", path_u8);
+        forget_stmt->exec();
+    }
+}
+
+bool cometa::typelib_methods_parsed(std::wstring_view tlb_path) {
+    assert(_db);
+    auto path_u8{ to_utf8(tlb_path) };
+
+    // methods_available tells only that the type has methods, the signature row tells that they were parsed
+    auto query{ _statements.acquire(R"(select not exists (select 1 from typelib_guids g join cotypes t on t.iid = g.guid
+    where g.path = :path and t.methods_available <> 0
+    and not exists (select 1 from cotype_signatures s where s.iid = g.guid and s.arch = :arch)))") };
+    query->bindNoCopy(":path", path_u8);
+    query->bind(":arch", static_cast<int>(find_typelib_arch(tlb_path)));
+
+    return query->executeStep() && query->getColumn(0).getInt() != 0;
+}
 
-    SQLite::Statement stmt{ *_db, R"(insert or replace into cotypes (iid, type, name, parent_iid, methods_available) 
-    values (:iid, :type, :name, :parent_iid, :methods_available))" };
-    stmt.bindNoCopy(":iid", &typedesc.iid, sizeof(GUID));
-    stmt.bind(":type", static_cast<int>(typedesc.type));
-    stmt.bindNoCopy(":name", name_u8);
-    stmt.bindNoCopy(":parent_iid", &typedesc.parent_iid, sizeof(GUID));
-    stmt.bind(":methods_available", static_cast<int>(typedesc.methods_available));
+void cometa::forget_typelib_for_any_arch(std::wstring_view tlb_path) {
+    // an older version (or !cometa index with the path) indexed the file for any architecture, so the sessions of the
+    // other architecture would read its signatures; its own sessions parse it again
+    if (find_typelib_arch(tlb_path) == 0 && find_typelib_fingerprint(tlb_path)) {
+        remove_typelib(tlb_path, true);
+    }
+}
+
+HRESULT cometa::index_tlb_file(std::wstring_view tlb_path, bool registered, USHORT arch, const std::optional<typelib_fingerprint>& fingerprint,
+    const std::variant<parsed_typelib, HRESULT>& parsed) {
+    // the previous rows go first, so the types that the new version no longer defines disappear
+    remove_typelib(tlb_path, false);
+
+    HRESULT hr{ S_OK };
+    if (auto tlb{ std::get_if<parsed_typelib>(&parsed) }; tlb) {
+        write_tlb(tlb_path, arch, *tlb);
+    } else {
+        hr = std::get<HRESULT>(parsed);
+    }
+
+    // a library that failed to parse keeps an empty fingerprint, so the next index parses it again
+    save_typelib(tlb_path, SUCCEEDED(hr) && fingerprint ? *fingerprint : typelib_fingerprint{}, registered, arch);
 
-    stmt.exec();
+    return hr;
+}
+
+std::vector<covtable> cometa::get_module_vtables(const comodule& comodule) {
+    assert(_db);
+    poll_index_job();
+
+    auto& stats{ stats_of(lookup_path::get_module_vtables) };
+    lookup_timer timer{ stats };
+
+    auto module_name_u8{ to_utf8(comodule.name) };
+    if (auto fingerprint{ module_fingerprint(module_name_u8, comodule.timestamp) };
+        _known_modules_loaded && !_known_modules.may_contain(fingerprint)) {
+        if (_base_path.empty() || !_base_module_probes.insert(fingerprint).second) {
+            // most of the loaded modules have no saved vtables
+            stats.filtered++;
+            return {};
+        }
+
+        auto probe{ lookup_statements().acquire(
+            "select 1 from base.vtables where arch = :arch and module_name = :module_name and module_timestamp = :module_timestamp limit 1") };
+        probe->bind(":arch", static_cast<int>(_arch));
+        probe->bindNoCopy(":module_name", module_name_u8);
+        probe->bind(":module_timestamp", static_cast<const uint32_t>(comodule.timestamp));
+        stats.sql_statements++;
+        if (!probe->executeStep()) {
+            return {};
+        }
+        _known_modules.add(fingerprint);
+    }
+
+    auto query{ vtable_statements().acquire(
+        "select clsid,iid,vtable from vtables where arch = :arch and module_name = :module_name and module_timestamp = :module_timestamp") };
+    query->bind(":arch", static_cast<int>(_arch));
+    query->bindNoCopy(":module_name", module_name_u8);
+    query->bind(":module_timestamp", static_cast<const uint32_t>(comodule.timestamp));
+    stats.sql_statements++;
+
+    std::vector<covtable> vtables{};
+    while (query->executeStep()) {
+        stats.sql_rows++;
+        vtables.push_back({
+            *(reinterpret_cast<const GUID*>(query->getColumn(0).getBlob())),
+            *(reinterpret_cast<const GUID*>(query->getColumn(1).getBlob())),
+            static_cast<ULONG>(query->getColumn(2).getInt64())
+            });
+    }
+    return vtables;
+}
+
+void cometa::save_module_vtable(const comodule& comodule, const covtable& covtable) {
+    assert(_db);
+    auto module_name_u8{ to_utf8(comodule.name) };
+
+    _known_modules.add(module_fingerprint(module_name_u8, comodule.timestamp));
+
+    pending_vtable vtable{ std::move(module_name_u8), comodule.timestamp, covtable.clsid, covtable.iid, covtable.address };
+    if (_working_set) {
+        // the lookups see the row at once, and the background writer saves it to the file
+        write_vtables(*_working_set->db, *_working_set->statements, _arch, { &vtable, 1 });
+
+        std::scoped_lock lock{ _working_set->dirty->lock };
+        _working_set->dirty->rows.push_back(std::move(vtable));
+    } else {
+        _pending_vtables.push_back(std::move(vtable));
+        if (!flush_pending_vtables(vtable_busy_timeout_ms) && _pending_vtables.size() == 1) {
+            _logger.log_warning(L"The metadata database is locked by another session, the vtables will be saved later.");
+        }
+    }
+
+    if (_known_modules.is_saturated()) {
+        load_known_modules();
+    }
+}
+
+bool cometa::flush_pending_vtables(int lock_timeout_ms) noexcept {
+    if (_pending_vtables.empty()) {
+        return true;
+    }
+
+    try {
+        _db->setBusyTimeout(lock_timeout_ms);
+        auto restore_busy_timeout{ wil::scope_exit([this]() {
+            try {
+                _db->setBusyTimeout(busy_timeout_ms);
+            } catch (const SQLite::Exception&) {
+                // sqlite3_busy_timeout does not fail
+            }
+        }) };
+
+        write_vtables(*_db, _statements, _arch, _pending_vtables);
+        _pending_vtables.clear();
+        return true;
+    } catch (const SQLite::Exception& ex) {
+        if (ex.getErrorCode() == SQLITE_BUSY) {
+            return false;
+        }
+        _logger.log_error(std::format(L"Error {} when saving {} vtables: '{}'.", ex.getErrorCode(), _pending_vtables.size(),
+            widen(ex.getErrorStr())), E_FAIL);
+        _pending_vtables.clear();
+        return true;
+    }
+}
+
+void cometa::write_vtables(SQLite::Database& db, statement_cache& statements, USHORT arch, std::span<const pending_vtable> vtables) {
+    // a short write transaction; its first statement writes, so it waits for the lock with a fresh snapshot
+    savepoint vtables_savepoint{ db, "save_vtables" };
+
+    auto query{ statements.acquire(insert_vtable_sql) };
+    for (const auto& vtable : vtables) {
+        query->bind(":arch", static_cast<int>(arch));
+        query->bindNoCopy(":clsid", &vtable.clsid, sizeof(GUID));
+        query->bindNoCopy(":iid", &vtable.iid, sizeof(GUID));
+        query->bindNoCopy(":module_name", vtable.module_name_u8);
+        query->bind(":module_timestamp", static_cast<const uint32_t>(vtable.module_timestamp));
+        query->bind(":vtable", static_cast<long long>(vtable.address));
+        query->exec();
+        query->reset();
+    }
+
+    vtables_savepoint.release();
+}
+
+void cometa::flush_vtables() noexcept {
+    if (_working_set) {
+        auto& dirty{ *_working_set->dirty };
+        std::scoped_lock write_guard{ dirty.write_lock };
+        {
+            std::scoped_lock lock{ dirty.lock };
+            std::ranges::move(dirty.rows, std::back_inserter(_pending_vtables));
+            dirty.rows.clear();
+        }
+
+        if (!flush_pending_vtables(busy_timeout_ms)) {
+            // back to the queue, before the rows saved later
+            std::scoped_lock lock{ dirty.lock };
+            dirty.rows.insert(std::begin(dirty.rows), std::make_move_iterator(std::begin(_pending_vtables)),
+                std::make_move_iterator(std::end(_pending_vtables)));
+            _pending_vtables.clear();
+            _logger.log_warning(std::format(L"{} vtables could not be saved, as the metadata database is locked by another session.",
+                dirty.rows.size()));
+        }
+    } else if (!flush_pending_vtables(busy_timeout_ms)) {
+        _logger.log_warning(std::format(L"{} vtables could not be saved, as the metadata database is locked by another session.",
+            _pending_vtables.size()));
+    }
+}
+
+HRESULT cometa::enable_working_set() {
+    assert(_db);
+    using namespace std::chrono;
+
+    if (_working_set) {
+        return working_set_status();
+    }
+
+    fs::path db_path{ from_utf8(_db->getFilename()) };
+    if (db_path.empty()) {
+        _logger.log_info(L"The metadata database is already in memory.");
+        return S_OK;
+    }
+
+    // the copy starts with all the vtables saved so far
+    flush_vtables();
+
+    try {
+        auto load_start{ steady_clock::now() };
+
+        auto memory_db{ std::make_unique<SQLite::Database>(":memory:", SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE) };
+        {
+            SQLite::Statement attach{ *memory_db, "attach database :path as metadata_file" };
+            attach.bind(":path", to_utf8(db_path.c_str()));
+            attach.exec();
+        }
+
+        // the same table and indexes as in the file (the table goes first)
+        std::vector<std::string> schema{};
+        {
+            SQLite::Statement query{ *memory_db,
+                "select sql from metadata_file.sqlite_master where tbl_name = 'vtables' and sql is not null order by type desc" };
+            while (query.executeStep()) {
+                schema.push_back(query.getColumn(0).getString());
+            }
+        }
+        for (const auto& sql : schema) {
+            memory_db->exec(sql);
+        }
+
+        SQLite::Statement copy{ *memory_db, "insert into main.vtables select * from metadata_file.vtables where arch = :arch" };
+        copy.bind(":arch", static_cast<int>(_arch));
+        auto vtables_count{ copy.exec() };
+        memory_db->exec("detach database metadata_file");
+
+        if (!_base_path.empty()) {
+            // the vtables of the overlay hide the base ones with the same key
+            SQLite::Statement attach{ *memory_db, "attach database :path as base_file" };
+            attach.bind(":path", to_utf8(_base_path.c_str()));
+            attach.exec();
+
+            SQLite::Statement copy_base{ *memory_db, R"(insert or ignore into main.vtables (arch, clsid, iid, module_name, module_timestamp, vtable)
+select arch, clsid, iid, module_name, module_timestamp, vtable from base_file.vtables where arch = :arch)" };
+            copy_base.bind(":arch", static_cast<int>(_arch));
+            vtables_count += copy_base.exec();
+            memory_db->exec("detach database base_file");
+        }
+
+        auto statements{ std::make_unique<statement_cache>(*memory_db) };
+        auto dirty{ std::make_shared<dirty_vtables>() };
+
+        auto writer{ std::make_unique<background_job>([dirty, db_path, arch = _arch](std::stop_token stop_token, const dbgeng_logger& logger) {
+            SQLite::Database file_db{ to_utf8(db_path.c_str()), SQLite::OPEN_READWRITE };
+            file_db.setBusyTimeout(busy_timeout_ms);
+            statement_cache file_statements{ file_db };
+
+            std::vector<pending_vtable> rows{};
+            while (true) {
+                {
+                    std::unique_lock lock{ dirty->lock };
+                    dirty->wakeup.wait_for(lock, stop_token, working_set_flush_interval, [] { return false; });
+                }
+                if (stop_token.stop_requested()) {
+                    // the session writes the remaining rows itself after stopping the writer
+                    return S_OK;
+                }
+
+                std::scoped_lock write_guard{ dirty->write_lock };
+                {
+                    std::scoped_lock lock{ dirty->lock };
+                    rows.swap(dirty->rows);
+                }
+                if (rows.empty()) {
+                    continue;
+                }
+
+                try {
+                    write_vtables(file_db, file_statements, arch, rows);
+                } catch (const SQLite::Exception& ex) {
+                    if (ex.getErrorCode() == SQLITE_BUSY) {
+                        // retried on the next tick, before the rows saved in the meantime
+                        std::scoped_lock lock{ dirty->lock };
+                        dirty->rows.insert(std::begin(dirty->rows), std::make_move_iterator(std::begin(rows)), std::make_move_iterator(std::end(rows)));
+                    } else {
+                        logger.log_error(std::format(L"Error {} when saving {} vtables: '{}'.", ex.getErrorCode(), rows.size(),
+                            widen(ex.getErrorStr())), E_FAIL);
+                    }
+                }
+                rows.clear();
+            }
+        }) };
+
+        _working_set = std::make_unique<working_set>(working_set{ std::move(memory_db), std::move(statements), std::move(dirty), std::move(writer) });
+
+        _logger.log_info(std::format(L"Loaded {} vtables into memory in {} ms. The new vtables are saved to the database file every {} s.",
+            vtables_count, duration_cast<milliseconds>(steady_clock::now() - load_start).count(), working_set_flush_interval.count()));
+        return S_OK;
+    } catch (const SQLite::Exception& ex) {
+        _logger.log_error(std::format(L"Error {} when loading the vtables into memory: '{}'.", ex.getErrorCode(),
+            widen(ex.getErrorStr())), E_FAIL);
+        return E_FAIL;
+    }
+}
+
+HRESULT cometa::disable_working_set() {
+    if (!_working_set) {
+        return working_set_status();
+    }
+
+    _working_set->writer.reset();
+    flush_vtables();
+
+    if (std::scoped_lock lock{ _working_set->dirty->lock }; !_working_set->dirty->rows.empty()) {
+        // the rows could not be written, so they stay pending in the file mode
+        std::ranges::move(_working_set->dirty->rows, std::back_inserter(_pending_vtables));
+    }
+    _working_set.reset();
+
+    _logger.log_info(L"The vtables are read from and saved to the database file.");
+    return S_OK;
+}
+
+HRESULT cometa::working_set_status() {
+    if (!_working_set) {
+        _logger.log_info(L"The vtables are read from and saved to the database file.");
+        return S_OK;
+    }
+
+    size_t dirty_count{};
+    {
+        std::scoped_lock lock{ _working_set->dirty->lock };
+        dirty_count = _working_set->dirty->rows.size();
+    }
+    _logger.log_info(std::format(L"The vtables are kept in memory, {} of them are waiting to be saved to the database file.", dirty_count));
+    _working_set->writer->write_output(_logger);
+    if (_working_set->writer->is_done()) {
+        _logger.log_error(L"The background writer of the vtables stopped, run !cometa workingset off to save them",
+            _working_set->writer->result());
+    }
+    return S_OK;
+}
+
+void cometa::write_tlb(std::wstring_view tlb_path, USHORT arch, const parsed_typelib& parsed) {
+    assert(_db);
+
+    // a savepoint, as the type library is written inside a bulk load batch
+    savepoint tlb_savepoint{ *_db, "write_tlb" };
+
+    for (const auto& [type, methods] : parsed.types) {
+        insert_cotype(type);
+        insert_typelib_guid(tlb_path, type.iid);
+
+        if (parsed.methods_parsed) {
+            insert_cotype_methods(type.iid, methods, arch);
+        }
+    }
+
+    for (const auto& classdesc : parsed.classes) {
+        insert_coclass(classdesc);
+        insert_typelib_guid(tlb_path, classdesc.clsid);
+    }
+
+    tlb_savepoint.release();
+}
+
+HRESULT cometa::index(std::wstring_view tlb_path) {
+    if (!_db) {
+        _logger.log_error(L"no open database", E_FAIL);
+        return E_FAIL;
+    }
+    // the swap at the end of the background index would replace the metadata of this library
+    if (_index_job) {
+        _logger.log_error(L"The metadata index is running in the background (see !cometa index status).", E_NOT_VALID_STATE);
+        return E_NOT_VALID_STATE;
+    }
+
+    // only the cached entries for GUIDs rewritten by this type library become stale
+    _generation++;
+
+    // the revision changes before any write, so the snapshot is exported again when the database is reopened
+    _snapshot.reset();
+    bump_metadata_revision();
+
+    // a registered library keeps the architecture the full index found for it
+    auto hr{ index_tlb_file(tlb_path, false, find_typelib_arch(tlb_path),
+        typelib::get_tlb_fingerprint(tlb_path, find_typelib_fingerprint(tlb_path)), typelib::parse_tlb(tlb_path, true)) };
+
+    if (!_known_guids_loaded || _known_types.is_saturated() || _known_classes.is_saturated()) {
+        load_known_guids();
+    }
+
+    if (SUCCEEDED(hr)) {
+        _logger.log_info_dml(std::format(L"'{}' : <col fg=\"srccmnt\">PARSED</col>", tlb_path));
+        return S_OK;
+    } else {
+        _logger.log_error_dml(std::format(L"'{}'", tlb_path), hr);
+        return hr;
+    }
+}
+
+HRESULT cometa::save([[maybe_unused]] std::wstring_view dbpath) {
+    assert(_db);
+    // the copy includes the vtables of the working set
+    flush_vtables();
+
+    try {
+        _db->backup(to_utf8(dbpath).c_str(), SQLite::Database::BackupType::Save);
+        return S_OK;
+    } catch (const SQLite::Exception& ex) {
+        _logger.log_error(std::format(L"Error {} when trying to save COM metadata database: '{}'.",
+            ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
+        return E_FAIL;
+    }
 }
 
-void cometa::insert_cotype_method(const comethod& method) {
-    if (_known_iids.contains(method.iid)) {
-        return;
+HRESULT cometa::start_index(bool with_methods) {
+    assert(_db);
+    if (_index_job) {
+        _logger.log_error(L"The metadata index is already running in the background.", E_NOT_VALID_STATE);
+        return E_NOT_VALID_STATE;
     }
 
-    assert(_db);
+    fs::path db_path{ from_utf8(_db->getFilename()) };
+    if (db_path.empty()) {
+        // the staging database could not read the in-memory database of this connection
+        return index({}, with_methods);
+    }
 
-    auto name_u8{ to_utf8(method.name) };
-    auto return_type_u8{ to_utf8(method.return_type) };
+    _staging_path = fs::temp_directory_path() / std::format(L"cometa_staging_{}.db3", ::GetCurrentProcessId());
+    remove_staging_db();
 
-    SQLite::Statement stmt{ *_db, R"(insert or replace into cotype_methods (iid, ordinal, name, dispid, callconv, return_type)
-    values (:iid, :ordinal, :name, :dispid, :callconv, :return_type))" };
-    stmt.bindNoCopy(":iid", &method.iid, sizeof(GUID));
-    stmt.bind(":ordinal", method.ordinal);
-    stmt.bindNoCopy(":name", name_u8);
-    if (method.dispid) {
-        stmt.bind(":dispid", static_cast<int>(*method.dispid));
-    } else {
-        stmt.bind(":dispid");
-    }
-    stmt.bind(":callconv", static_cast<int>(method.callconv));
-    stmt.bindNoCopy(":return_type", return_type_u8);
+    _index_job = std::make_unique<background_job>([arch = _arch, db_path, staging_path = _staging_path, base_path = _base_path, with_methods](
+        std::stop_token stop_token, const dbgeng_logger& logger) {
+        auto com_hr{ ::CoInitializeEx(nullptr, COINIT_MULTITHREADED) };
+        auto com_cleanup{ wil::scope_exit([com_hr]() {
+            if (SUCCEEDED(com_hr)) {
+                ::CoUninitialize();
+            }
+        }) };
+
+        try {
+            // the staging database starts with the current metadata, so the unchanged type libraries are skipped
+            cometa staging{ logger, arch, staging_path, true };
+            staging._is_staging = true;
+            staging.copy_metadata(db_path);
+            if (!base_path.empty()) {
+                // the libraries indexed in the base are skipped too, and the removed ones get their tombstones
+                staging.attach_base(base_path);
+            }
+            return staging.index(stop_token, with_methods);
+        } catch (const SQLite::Exception& ex) {
+            logger.log_error(std::format(L"Error {} in the staging metadata database: '{}'.", ex.getErrorCode(),
+                widen(ex.getErrorStr())), E_FAIL);
+            return E_FAIL;
+        }
+    });
 
-    stmt.exec();
+    _logger.log_info(L"The metadata index started in the background. Use !cometa index status to see its progress, "
+        L"and !cometa index cancel to stop it. The lookups use the current metadata until it completes.");
+    return S_OK;
 }
 
-void cometa::insert_cotype_method_arg(const GUID& iid, int method_ordinal, const comethod_arg& arg, int arg_ordinal) {
-    if (_known_iids.contains(iid)) {
-        return;
+HRESULT cometa::index_status() {
+    if (!_index_job) {
+        _logger.log_info(L"No metadata index is running in the background.");
+        return S_OK;
     }
 
-    assert(_db);
-
-    auto name_u8{ to_utf8(arg.name) };
-    auto type_u8{ to_utf8(arg.type) };
-
-    SQLite::Statement stmt{ *_db, R"(insert or replace into cotype_method_args (iid, method_ordinal, ordinal, name, type, flags)
-    values (:iid, :method_ordinal, :ordinal, :name, :type, :flags))" };
-    stmt.bindNoCopy(":iid", &iid, sizeof(GUID));
-    stmt.bind(":method_ordinal", method_ordinal);
-    stmt.bind(":ordinal", arg_ordinal);
-    stmt.bindNoCopy(":name", name_u8);
-    stmt.bindNoCopy(":type", type_u8);
-    stmt.bind(":flags", arg.flags);
-
-    stmt.exec();
+    _index_job->write_output(_logger);
+    _logger.log_info(std::format(L"The metadata index has been running in the background for {} s{}.",
+        std::chrono::duration_cast<std::chrono::seconds>(_index_job->elapsed()).count(),
+        _index_job->is_cancelled() ? L" (cancelling)" : L""));
+    return S_OK;
 }
 
-void cometa::insert_coclass(const coclass& classdesc) {
-    assert(_db);
-    auto name_u8{ to_utf8(classdesc.name) };
+HRESULT cometa::cancel_index() {
+    if (!_index_job) {
+        _logger.log_info(L"No metadata index is running in the background.");
+        return S_OK;
+    }
 
-    SQLite::Statement stmt{ *_db, "insert or replace into coclasses (clsid, name) values (:clsid, :name)" };
-    stmt.bindNoCopy(":clsid", &classdesc.clsid, sizeof(GUID));
-    stmt.bindNoCopy(":name", name_u8);
+    // the job stops at the next registry key or type library, and the next lookup or command reports it
+    _index_job->cancel();
+    _logger.log_info(L"Cancelling the background metadata index.");
+    return S_OK;
+}
 
-    stmt.exec();
+void cometa::attach_metadata_source(const fs::path& source_path) {
+    SQLite::Statement attach{ *_db, "attach database :path as metadata_source" };
+    attach.bind(":path", to_utf8(source_path.c_str()));
+    attach.exec();
 }
 
-std::vector<covtable> cometa::get_module_vtables(const comodule& comodule) {
-    assert(_db);
-    auto module_name_u8{ to_utf8(comodule.name) };
-    SQLite::Statement query{ *_db,
-        "select clsid,iid,vtable from vtables where module_name = :module_name and module_timestamp = :module_timestamp" };
-    query.bindNoCopy(":module_name", module_name_u8);
-    query.bind(":module_timestamp", static_cast<const uint32_t>(comodule.timestamp));
+void cometa::copy_metadata(const fs::path& source_path) {
+    // both databases have the current schema (the source of the background index is the open database)
+    attach_metadata_source(source_path);
+    auto detach{ wil::scope_exit([this]() {
+        _db->tryExec("detach database metadata_source");
+    }) };
 
-    std::vector<covtable> vtables{};
-    while (query.executeStep()) {
-        vtables.push_back({
-            *(reinterpret_cast<const GUID*>(query.getColumn("clsid").getBlob())),
-            *(reinterpret_cast<const GUID*>(query.getColumn("iid").getBlob())),
-            static_cast<ULONG>(query.getColumn("vtable").getInt64())
-            });
+    SQLite::Transaction transaction{ *_db };
+    for (const auto& table : index_tables) {
+        _db->exec(std::format("delete from main.{}", table.name));
+        _db->exec(std::format("insert into main.{0} ({1}) select {1} from metadata_source.{0}", table.name, table.columns));
+        // the keys of the copied rows tell the rows written to the source later apart from the ones the index removed
+        _db->exec(std::format("create table main.{0}_at_start as select {1} from main.{0}", table.name, table.key));
     }
-    return vtables;
+    transaction.commit();
 }
 
-void cometa::save_module_vtable(const comodule& comodule, const covtable& covtable) {
-    assert(_db);
-    auto module_name_u8{ to_utf8(comodule.name) };
-
-    SQLite::Statement query{ *_db, R"(insert or replace into vtables (clsid, iid, module_name, module_timestamp, vtable) 
-        values (:clsid, :iid, :module_name, :module_timestamp, :vtable))" };
-
-    query.bindNoCopy(":clsid", &covtable.clsid, sizeof(GUID));
-    query.bindNoCopy(":iid", &covtable.iid, sizeof(GUID));
-    query.bindNoCopy(":module_name", module_name_u8);
-    query.bind(":module_timestamp", static_cast<const uint32_t>(comodule.timestamp));
-    query.bind(":vtable", static_cast<long long>(covtable.address));
-
-    query.exec();
+void cometa::merge_index_results(const fs::path& staging_path) {
+    attach_metadata_source(staging_path);
+    auto detach{ wil::scope_exit([this]() {
+        _db->tryExec("detach database metadata_source");
+    }) };
+
+    /*
+     * The rows present when the index started, and the rows the index wrote, are replaced by the indexed
+     * ones. The rows written since the index started (the methods parsed on demand and the GUIDs resolved
+     * from the registry, in this and the other sessions) are kept, unless the index wrote the same keys.
+    */
+    SQLite::Transaction transaction{ *_db };
+    for (const auto& table : index_tables) {
+        _db->exec(std::format(R"(delete from main.{0} where ({1}) in (select {1} from metadata_source.{0}_at_start)
+    or ({1}) in (select {1} from metadata_source.{0}){2}{3})", table.name, table.key, table.replaced.empty() ? "" : " or ",
+            table.replaced));
+        _db->exec(std::format("insert into main.{0} ({1}) select {1} from metadata_source.{0}", table.name, table.columns));
+    }
+    transaction.commit();
 }
 
-HRESULT cometa::index_tlb(std::wstring_view tlb_path) {
-    using namespace std::literals;
-    assert(_db);
-
-    wil::com_ptr_t<ITypeLib> typelib{};
-    RETURN_IF_FAILED(::LoadTypeLibEx(tlb_path.data(), REGKIND_NONE, typelib.put()));
-
-    auto types_len = typelib->GetTypeInfoCount();
-    for (UINT type_num = 0; type_num < types_len; type_num++) {
-        wil::com_ptr_t<ITypeInfo> typeinfo{};
-        RETURN_IF_FAILED(typelib->GetTypeInfo(type_num, typeinfo.put()));
-
-        wil::unique_bstr name{};
-        RETURN_IF_FAILED(typeinfo->GetDocumentation(MEMBERID_NIL, name.put(), nullptr, nullptr, nullptr));
-
-        auto typeattr_res{ typelib::get_typeinfo_attr(typeinfo.get()) };
-        if (std::holds_alternative<HRESULT>(typeattr_res)) {
-            return std::get<HRESULT>(typeattr_res);
-        }
+void cometa::complete_index_job() noexcept {
+    using namespace std::chrono;
+    assert(_index_job && _index_job->is_done());
 
-        auto typeattr{ std::move(std::get<typelib::typeattr_t>(typeattr_res)) };
-        switch (typeattr->typekind) {
-        case TKIND_INTERFACE:
-        case TKIND_DISPATCH: {
-            auto kind{ typeattr->typekind == TKIND_INTERFACE ? cotype_kind::Interface : cotype_kind::DispInterface };
+    _index_job->write_output(_logger);
+    auto hr{ _index_job->result() };
+    auto elapsed_s{ duration_cast<seconds>(_index_job->elapsed()).count() };
+    _index_job.reset();
 
-            auto get_type_name = [typeinfo, kind](const TYPEDESC* tdesc) {
-                auto type_name{ typelib::get_type_desc(typeinfo.get(), tdesc) };
-                return std::holds_alternative<std::wstring>(type_name) ? std::get<std::wstring>(type_name) :
-                    std::wstring{ typelib::bad_type_name };
-            };
+    auto remove_staging{ wil::scope_exit([this]() { remove_staging_db(); }) };
 
-            auto parent_iid_v{ typelib::get_type_parent_iid(typeinfo.get(), kind, typeattr->cImplTypes) };
-            if (std::holds_alternative<HRESULT>(parent_iid_v)) {
-                return std::get<HRESULT>(parent_iid_v);
-            }
-            auto& parent_iid{ std::get<GUID>(parent_iid_v) };
+    if (hr == HRESULT_FROM_WIN32(ERROR_CANCELLED)) {
+        _logger.log_info(L"The background metadata index was cancelled, the metadata did not change.");
+        return;
+    }
+    if (FAILED(hr)) {
+        _logger.log_error(L"The background metadata index failed, the metadata did not change", hr);
+        return;
+    }
 
-            auto funcdesc_deleter = [typeinfo](FUNCDESC* fd) { typeinfo->ReleaseFuncDesc(fd); };
+    // the revision changes before the swap, so the snapshot and the name index are rebuilt
+    _snapshot.reset();
+    bump_metadata_revision();
 
-            SQLite::Transaction transaction{ *_db };
+    auto refresh_caches{ wil::scope_exit([this]() { reload_metadata(); }) };
 
-            insert_cotype({ typeattr->guid, name.get(), kind, parent_iid, true });
+    try {
+        // a single transaction, so the lookups (in this and the other sessions) see either the old or the new metadata
+        auto swap_start{ steady_clock::now() };
+        merge_index_results(_staging_path);
+        _logger.log_info(std::format(L"The background metadata index completed in {} s, its results were swapped in ({} ms).",
+            elapsed_s, duration_cast<milliseconds>(steady_clock::now() - swap_start).count()));
+    } catch (const SQLite::Exception& ex) {
+        _logger.log_error(std::format(L"Error {} when swapping in the indexed metadata: '{}'.", ex.getErrorCode(),
+            widen(ex.getErrorStr())), E_FAIL);
+    }
+}
 
-            // TODO: typeattr->cVars for properties in dispinterfaces
+void cometa::remove_staging_db() noexcept {
+    if (_staging_path.empty()) {
+        return;
+    }
 
-            for (int ordinal = 0; ordinal < typeattr->cFuncs; ) {
-                FUNCDESC* p_fd;
-                RETURN_IF_FAILED(typeinfo->GetFuncDesc(ordinal, &p_fd));
-                typelib::funcdesc_t fd{ p_fd, funcdesc_deleter };
+    std::error_code ec{};
+    for (auto suffix : { L"", L"-wal", L"-shm" }) {
+        fs::remove(fs::path{ _staging_path } += suffix, ec);
+    }
+}
 
-                if (auto names_v{ typelib::get_comethod_names(typeinfo.get(), fd.get()) }; std::holds_alternative<HRESULT>(names_v)) {
-                    return std::get<HRESULT>(names_v);
-                } else {
-                    auto& names = std::get<std::vector<wil::unique_bstr>>(names_v);
-                    assert(names.size() > 0);
+HRESULT cometa::merge(std::wstring_view dbpath, merge_policy policy, std::optional<USHORT> legacy_arch) {
+    assert(_db);
+    using namespace std::chrono;
 
-                    if (ordinal == 0 && names[0].get() == L"QueryInterface"sv) {
-                        // skip IUnknown
-                        ordinal += 3;
-                        continue;
-                    }
-                    if ((ordinal == 0 || ordinal == 3) && names[0].get() == L"GetTypeInfoCount"sv) {
-                        // skip IDispatch
-                        ordinal += 4;
-                        continue;
-                    }
+    if (_index_job) {
+        _logger.log_error(L"The metadata index is running in the background (see !cometa index status).", E_NOT_VALID_STATE);
+        return E_NOT_VALID_STATE;
+    }
 
-                    std::wstring method_name{ names[0].get() };
-                    if (fd->invkind & INVOKE_PROPERTYPUTREF) {
-                        method_name.insert(0, L"putref_");
-                    } else if (fd->invkind & INVOKE_PROPERTYPUT) {
-                        method_name.insert(0, L"put_");
-                    } else if (fd->invkind & INVOKE_PROPERTYGET) {
-                        method_name.insert(0, L"get_");
-                    }
-                    std::optional<DISPID> dispid = kind == cotype_kind::DispInterface ? std::make_optional(fd->memid) : std::nullopt;
-
-                    assert((SHORT)names.size() == fd->cParams + 1);
-
-                    // first parameter is this pointer
-                    int arg_ordinal{};
-                    insert_cotype_method_arg(typeattr->guid, ordinal, { L"this", L"void*", 0 }, arg_ordinal);
-                    arg_ordinal += 1;
-
-                    for (int param_num = 0; param_num < fd->cParams; param_num++) {
-                        auto elem_desc{ fd->lprgelemdescParam + param_num };
-                        comethod_arg arg{
-                            std::wstring { names[param_num + 1].get()},
-                            get_type_name(&elem_desc->tdesc),
-                            elem_desc->idldesc.wIDLFlags
-                        };
-                        insert_cotype_method_arg(typeattr->guid, ordinal, arg, arg_ordinal);
-                        arg_ordinal += 1;
-                    }
+    // attach would create an empty database for a missing file
+    if (std::error_code ec{}; !fs::is_regular_file(dbpath, ec)) {
+        _logger.log_error(std::format(L"Can't find the metadata database '{}'.", dbpath), HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND));
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
 
-                    auto result_vt{ fd->elemdescFunc.tdesc.vt & 0xFFF };
-                    if (kind == cotype_kind::DispInterface && result_vt != VT_HRESULT && result_vt != VT_VOID) {
-                        // the return value is passed as an out parameter
-                        TYPEDESC tdesc{ .lptdesc = &fd->elemdescFunc.tdesc, .vt = VT_PTR };
-                        comethod_arg arg{
-                            std::wstring { L"result" },
-                            get_type_name(&tdesc),
-                            IDLFLAG_FOUT | IDLFLAG_FRETVAL
-                        };
-                        insert_cotype_method_arg(typeattr->guid, ordinal, arg, arg_ordinal);
-
-                        insert_cotype_method({ typeattr->guid, method_name, ordinal, fd->callconv, dispid, typelib::vt_to_string(VT_HRESULT) });
-                    } else {
-                        insert_cotype_method({ typeattr->guid, method_name, ordinal, fd->callconv, dispid, get_type_name(&fd->elemdescFunc.tdesc) });
-                    }
+    fs::path source_path{ dbpath };
+    auto remove_upgraded_copy{ wil::scope_exit([&source_path, dbpath]() {
+        if (std::error_code ec{}; source_path.native() != dbpath) {
+            for (auto suffix : { L"", L"-wal", L"-shm" }) {
+                fs::remove(fs::path{ source_path } += suffix, ec);
+            }
+        }
+    }) };
 
-                    // TODO: I'm still missing handling of the optional parameters
+    try {
+        auto version{ db_schema_version(dbpath) };
+        if (version < base_schema_version || version > schema_version) {
+            _logger.log_error(std::format(L"'{}' is not a metadata database with a supported schema (version {}).", dbpath, version), E_INVALIDARG);
+            return E_INVALIDARG;
+        }
 
-                    ordinal += 1;
-                }
+        // an older database is upgraded in a temporary copy, so the merged file is never modified
+        if (version < schema_version) {
+            // one copy per process, as other sessions may merge at the same time; the backup (unlike a file
+            // copy) includes the rows committed to the WAL file of the source but not checkpointed yet
+            source_path = fs::temp_directory_path() / std::format(L"cometa_merge_{}.db3", ::GetCurrentProcessId());
+            for (auto suffix : { L"", L"-wal", L"-shm" }) {
+                fs::remove(fs::path{ source_path } += suffix);
             }
+            SQLite::Database{ to_utf8(dbpath), SQLite::OPEN_READONLY }.backup(to_utf8(source_path.c_str()).c_str(),
+                SQLite::Database::BackupType::Save);
 
-            transaction.commit();
-            break;
+            SQLite::Database source{ to_utf8(source_path.c_str()), SQLite::OPEN_READWRITE };
+            upgrade_schema(source, version, &_logger);
         }
-        case TKIND_COCLASS: {
-            insert_coclass({ typeattr->guid, name.get() });
-            break;
+
+        {
+            SQLite::Statement attach{ *_db, "attach database :path as merge_source" };
+            attach.bind(":path", to_utf8(source_path.c_str()));
+            attach.exec();
         }
-        default:
-            break;
+        auto detach{ wil::scope_exit([this]() {
+            try {
+                _db->exec("detach database merge_source");
+            } catch (const SQLite::Exception&) {
+                // the next merge fails to attach the same alias and reports it
+            }
+        }) };
+
+        // the revision changes before any write, so the snapshot and the name index are rebuilt
+        _snapshot.reset();
+        bump_metadata_revision();
+
+        // the newest policy compares with the vtables saved by this session too
+        flush_vtables();
+
+        auto refresh_caches{ wil::scope_exit([this]() { reload_metadata(); }) };
+
+        // the merged rows land all over the primary keys and the vtables indexes, 64 MB of page cache (as
+        // in the bulk load) makes the merge of a million vtables about 1.5x faster
+        auto cache_size{ _db->execAndGet("pragma cache_size").getInt() };
+        _db->exec("pragma cache_size = -65536");
+        auto restore_cache_size{ wil::scope_exit([this, cache_size]() {
+            _db->tryExec("pragma cache_size = " + std::to_string(cache_size));
+        }) };
+
+        /*
+         * The merged database may have indexed only the type headers, and its method signatures are parsed on
+         * demand from the owning type libraries. A library indexed there but not here is carried over when
+         * this machine has the same file, so the layouts of its types are available here too. The rows of a
+         * library missing here are not, as the next index would remove its types.
+        */
+        _db->exec("drop table if exists temp.merge_typelibs");
+        _db->exec(R"(create temp table merge_typelibs (
+path text primary key,
+size integer not null,
+last_write_time integer not null,
+hash integer not null,
+arch integer not null) without rowid)");
+        auto drop_merge_typelibs{ wil::scope_exit([this]() {
+            _db->tryExec("drop table if exists temp.merge_typelibs");
+        }) };
+        {
+            SQLite::Statement query{ *_db, R"(select path, size, last_write_time, hash, arch from merge_source.typelibs
+where path <> '' and path not in (select path from typelibs))" };
+            SQLite::Statement insert{ *_db, R"(insert into temp.merge_typelibs (path, size, last_write_time, hash, arch)
+values (:path, :size, :last_write_time, :hash, :arch))" };
+            while (query.executeStep()) {
+                typelib_fingerprint merged{
+                    .size = static_cast<uint64_t>(query.getColumn(1).getInt64()),
+                    .last_write_time = query.getColumn(2).getInt64(),
+                    .hash = static_cast<uint64_t>(query.getColumn(3).getInt64()) };
+                if (auto local{ typelib::get_tlb_fingerprint(from_utf8(query.getColumn(0).getText()), merged) };
+                    local && local->size == merged.size && local->hash == merged.hash) {
+                    insert.bind(":path", query.getColumn(0).getText());
+                    insert.bind(":size", static_cast<long long>(local->size));
+                    insert.bind(":last_write_time", static_cast<long long>(local->last_write_time));
+                    insert.bind(":hash", static_cast<long long>(local->hash));
+                    insert.bind(":arch", query.getColumn(4).getInt());
+                    insert.exec();
+                    insert.reset();
+                }
+            }
         }
-    }
-
-    return S_OK;
-}
 
-HRESULT cometa::save([[maybe_unused]] std::wstring_view dbpath) {
-    assert(_db);
-    try {
-        _db->backup(to_utf8(dbpath).c_str(), SQLite::Database::BackupType::Save);
+        auto merge_start{ steady_clock::now() };
+        SQLite::Transaction transaction{ *_db };
+
+        auto theirs{ policy == merge_policy::theirs };
+
+        // Unless the merged rows win, a merged signature only fills in a type whose signature is missing here (for
+        // example, indexed without its methods). The methods_available flag tells only that the type has methods.
+        auto signatures{ _db->exec(std::format(R"(insert into main.cotype_signatures (iid, arch, signature)
+select iid, arch, signature from merge_source.cotype_signatures where true
+on conflict (iid, arch) do {})", theirs ? "update set signature = excluded.signature" : "nothing")) };
+
+        // the libraries are merged as indexed manually, so the next index removes them only when their files are gone
+        auto typelibs{ _db->exec(R"(insert into main.typelibs (path, registered, size, last_write_time, hash, arch)
+select path, 0, size, last_write_time, hash, arch from temp.merge_typelibs)") };
+        _db->exec(R"(insert or ignore into main.typelib_guids (path, guid)
+select path, guid from merge_source.typelib_guids where path in (select path from temp.merge_typelibs))");
+
+        auto types{ _db->exec(std::format(R"(insert into main.cotypes (iid, type, name, parent_iid, methods_available)
+select iid, type, name, parent_iid, methods_available from merge_source.cotypes where true
+on conflict (iid) do update set type = excluded.type, name = excluded.name, parent_iid = excluded.parent_iid,
+methods_available = excluded.methods_available where {})", theirs ?
+            "excluded.methods_available <> 0 or cotypes.methods_available = 0" :
+            "excluded.methods_available <> 0 and cotypes.methods_available = 0")) };
+
+        auto classes{ _db->exec(std::format(R"(insert into main.coclasses (clsid, name) select clsid, name from merge_source.coclasses where true
+on conflict (clsid) do {})", theirs ? "update set name = excluded.name" : "nothing")) };
+
+        auto vtables_conflict = [policy]() -> std::string_view {
+            switch (policy) {
+            case merge_policy::ours: return "nothing";
+            case merge_policy::theirs: return R"(update set module_name = excluded.module_name, module_timestamp = excluded.module_timestamp,
+vtable = excluded.vtable)";
+            default: return R"(update set module_name = excluded.module_name, module_timestamp = excluded.module_timestamp,
+vtable = excluded.vtable where excluded.module_timestamp > vtables.module_timestamp)";
+            }
+        };
+        auto vtables{ _db->exec(std::format(R"(insert into main.vtables (arch, clsid, iid, module_name, module_timestamp, vtable)
+select coalesce(nullif(arch, 0), {}), clsid, iid, module_name, module_timestamp, vtable from merge_source.vtables where true
+on conflict (arch, clsid, iid) do {})", legacy_arch.value_or(_arch), vtables_conflict())) };
+
+        transaction.commit();
+
+        auto elapsed_ms{ duration_cast<milliseconds>(steady_clock::now() - merge_start).count() };
+        auto rows{ static_cast<int64_t>(signatures) + typelibs + types + classes + vtables };
+        _logger.log_info(std::format(L"Merged '{}' ({} policy) in {} ms: {} types, {} method signatures, {} type libraries, {} classes, "
+            L"and {} vtables inserted or updated ({:.0f} rows/s).", dbpath, merge_policy_name(policy), elapsed_ms, types, signatures,
+            typelibs, classes, vtables, static_cast<double>(rows) * 1000.0 / static_cast<double>(std::max<int64_t>(elapsed_ms, 1))));
         return S_OK;
     } catch (const SQLite::Exception& ex) {
-        _logger.log_error(std::format(L"Error {} when trying to save COM metadata database: '{}'.",
+        _logger.log_error(std::format(L"Error {} when trying to merge the metadata database: '{}'.",
             ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
         return E_FAIL;
+    } catch (const fs::filesystem_error& ex) {
+        _logger.log_error(std::format(L"Error when copying the metadata database for upgrade: '{}'.", widen(ex.what())), E_FAIL);
+        return E_FAIL;
+    } catch (const std::runtime_error& ex) {
+        _logger.log_error(std::format(L"Error when trying to upgrade the merged database: '{}'.", widen(ex.what())), E_FAIL);
+        return E_FAIL;
     }
 }
 
-HRESULT cometa::index() {
+HRESULT cometa::index(std::stop_token stop_token, bool with_methods) {
     assert(_db);
 
-    auto index_typelibs = [this]() {
+    // the revision changes before any write, and the snapshot file is replaced once the index is complete
+    _snapshot.reset();
+    bump_metadata_revision();
+
+    // the full index rewrites most of the database, so we drop all the cached entries
+    auto refresh_caches{ wil::scope_exit([this]() { reload_metadata(); }) };
+
+    // without a surrounding transaction each registry key would be a separate synced commit
+    bulk_load bulk{ *_db, { "cotypes", "cotype_signatures", "coclasses" }, bulk_load_batch_rows };
+
+    auto checkpoint = [this, &bulk]() {
+        if (bulk.checkpoint()) {
+            _logger.log_info(std::format(L"{} rows written ({:.0f} rows/s)", bulk.rows(), bulk.rows_per_second()));
+        }
+    };
+
+    struct typelib_to_parse
+    {
+        std::wstring key_name;
+        typelib_info info;
+        std::optional<typelib_fingerprint> fingerprint;
+    };
+
+    std::vector<typelib_to_parse> typelibs_to_parse{};
+    size_t parsed_typelibs{};
+    size_t skipped_typelibs{};
+    size_t removed_typelibs{};
+    size_t failed_typelibs{};
+
+    // The type libraries are checked before the registry keys are indexed. The rows of the libraries that changed
+    // or disappeared are removed first, so the registry entries of their GUIDs are written again.
+    auto check_typelibs = [&]() {
         // HKEY_LOCAL_MACHINE\SOFTWARE\Classes\Wow6432Node\Typelib is linked to HKEY_LOCAL_MACHINE\SOFTWARE\Classes\Typelib
         // so we don't need to query it. However, the typelibs may contain both win32 and win64 folders, for example:
         // 
@@ -463,40 +1740,142 @@ HRESULT cometa::index() {
         //     - win32 -> C:\Program Files (x86)\Common Files\System\ado\msado21.tlb
         //     - win64 -> C:\Program Files\Common Files\System\ado\msado21.tlb
         //   - FLAGS
-        _logger.log_info(L"\nIndexing TypeLibraries...");
+        _logger.log_info(L"\nChecking TypeLibraries...");
+
+        flat_hash_set<std::wstring> registered_paths{};
 
         wil::unique_hkey typelibs_hkey{};
         RETURN_IF_WIN32_ERROR(::RegOpenKeyEx(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Classes\\TypeLib", 0, KEY_READ, typelibs_hkey.put()));
         for (const auto& name : registry::get_child_key_names(typelibs_hkey.get())) {
+            if (stop_token.stop_requested()) {
+                return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            }
+
             wil::unique_hkey typelib_hkey{};
             if (auto err{ ::RegOpenKeyEx(typelibs_hkey.get(), name.c_str(), 0, KEY_READ, typelib_hkey.put()) }; err != NO_ERROR) {
                 _logger.log_error(name, HRESULT_FROM_WIN32(err));
                 continue;
             }
 
-            if (auto ti{ typelib::get_tlbinfo(typelib_hkey.get()) }; std::holds_alternative<HRESULT>(ti)) {
+            if (auto ti{ typelib::get_tlbinfo(typelib_hkey.get(), _arch) }; std::holds_alternative<HRESULT>(ti)) {
                 auto hr = std::get<HRESULT>(ti);
                 _logger.log_error(name, hr);
-            } else {
-                auto& tlbinfo{ std::get<typelib_info>(ti) };
-                if (auto hr{ index_tlb(tlbinfo.tlb_path.c_str()) }; SUCCEEDED(hr)) {
-                    _logger.log_info_dml(std::format(L"{} ({}) : <col fg=\"srccmnt\">PARSED</col>", name, tlbinfo.name));
+            } else if (auto& tlbinfo{ std::get<typelib_info>(ti) }; registered_paths.insert(tlbinfo.tlb_path).second) {
+                if (!tlbinfo.other_tlb_path.empty()) {
+                    registered_paths.insert(tlbinfo.other_tlb_path);
+                    forget_typelib_for_any_arch(tlbinfo.other_tlb_path);
+                }
+
+                auto indexed{ find_typelib_fingerprint(tlbinfo.tlb_path) };
+                auto current{ typelib::get_tlb_fingerprint(tlbinfo.tlb_path, indexed) };
+
+                // a library indexed for any architecture before it was known to have a file for each is parsed again, and
+                // so is a library indexed without some of its methods when they are requested
+                if (indexed && current && indexed->size == current->size && indexed->hash == current->hash &&
+                    find_typelib_arch(tlbinfo.tlb_path) == typelib_arch(tlbinfo) &&
+                    (!with_methods || typelib_methods_parsed(tlbinfo.tlb_path))) {
+                    // refreshes the last write time and marks manually indexed libraries as registered
+                    save_typelib(tlbinfo.tlb_path, *current, true, typelib_arch(tlbinfo));
+                    skipped_typelibs++;
                 } else {
-                    _logger.log_error(std::format(L"{} ({})", name, tlbinfo.name), hr);
+                    // the file of the other architecture keeps its rows, the sessions of that architecture read its methods
+                    remove_typelib(tlbinfo.tlb_path, false);
+                    typelibs_to_parse.push_back({ name, std::move(tlbinfo), current });
                 }
             }
+            checkpoint();
+        }
+
+        // the manually indexed libraries are removed only when their files are gone
+        for (const auto& [path, registered] : get_indexed_typelibs()) {
+            if (registered ? !registered_paths.contains(path) : !typelib::get_tlb_fingerprint(path, find_typelib_fingerprint(path))) {
+                remove_typelib(path, true);
+                removed_typelibs++;
+                _logger.log_info_dml(std::format(L"{} : <col fg=\"srccmnt\">REMOVED</col>", path));
+            }
         }
         return S_OK;
     };
 
-    auto index_coclasses = [this](bool request_wow6432 = false) {
-        _logger.log_info(request_wow6432 ? L"Indexing CLSIDs... (only errors are reported) - 32-bit" :
-            L"Indexing CLSIDs... (only errors are reported)");
+    // The type libraries are parsed by a pool of workers, and this thread is the only writer. It drains the parsed
+    // libraries from a bounded queue, so the workers stop when the writer falls behind.
+    auto index_typelibs = [&]() {
+        using parse_result = std::pair<size_t, std::variant<parsed_typelib, HRESULT>>;
+
+        auto typelibs_count{ typelibs_to_parse.size() };
+        if (typelibs_count == 0) {
+            return;
+        }
+
+        auto workers_count{ std::clamp<size_t>(std::thread::hardware_concurrency(), 1, typelibs_count) };
+        _logger.log_info(std::format(L"\nIndexing TypeLibraries... ({} workers)", workers_count));
+
+        bounded_queue<parse_result> parsed_queue{ 2 * workers_count };
+        std::atomic<size_t> next_typelib{};
+
+        std::vector<std::jthread> workers{};
+        // stops the workers if the writer fails, and receives the libraries they already took, so none of them
+        // blocks on a full queue (must be declared after the workers, as it runs before they are joined)
+        size_t received{};
+        auto drain_queue{ wil::scope_exit([&]() {
+            for (auto taken{ std::min(next_typelib.exchange(typelibs_count), typelibs_count) }; received < taken; received++) {
+                parsed_queue.pop();
+            }
+        }) };
+
+        for (size_t i = 0; i < workers_count; i++) {
+            workers.emplace_back([&typelibs_to_parse, &parsed_queue, &next_typelib, typelibs_count]() {
+                auto com_hr{ ::CoInitializeEx(nullptr, COINIT_MULTITHREADED) };
+                auto com_cleanup{ wil::scope_exit([com_hr]() {
+                    if (SUCCEEDED(com_hr)) {
+                        ::CoUninitialize();
+                    }
+                }) };
+
+                for (auto n{ next_typelib.fetch_add(1) }; n < typelibs_count; n = next_typelib.fetch_add(1)) {
+                    std::variant<parsed_typelib, HRESULT> parsed{ E_FAIL };
+                    try {
+                        // by default, only the type headers, the method signatures are parsed when a vtable layout needs them
+                        parsed = typelib::parse_tlb(typelibs_to_parse[n].info.tlb_path, with_methods);
+                    } catch (...) {
+                        parsed = wil::ResultFromCaughtException();
+                    }
+                    parsed_queue.push({ n, std::move(parsed) });
+                }
+            });
+        }
+
+        while (received < typelibs_count && !stop_token.stop_requested()) {
+            auto [n, parsed] { parsed_queue.pop() };
+            received++;
+            auto& tlb{ typelibs_to_parse[n] };
+
+            if (auto hr{ index_tlb_file(tlb.info.tlb_path, true, typelib_arch(tlb.info), tlb.fingerprint, parsed) }; SUCCEEDED(hr)) {
+                parsed_typelibs++;
+                _logger.log_info_dml(std::format(L"{} ({}) : <col fg=\"srccmnt\">PARSED</col>", tlb.key_name, tlb.info.name));
+            } else {
+                failed_typelibs++;
+                _logger.log_error(std::format(L"{} ({})", tlb.key_name, tlb.info.name), hr);
+            }
+            checkpoint();
+        }
+    };
+
+    auto view_name = [](REGSAM view) {
+        return view == KEY_WOW64_32KEY ? L" - 32-bit" : view == KEY_WOW64_64KEY ? L" - 64-bit" : L"";
+    };
+
+    auto index_coclasses = [this, &checkpoint, &view_name, &stop_token](REGSAM view) {
+        _logger.log_info(std::format(L"Indexing CLSIDs... (only errors are reported){}", view_name(view)));
 
-        auto flags{ request_wow6432 ? KEY_READ | KEY_WOW64_32KEY : KEY_READ };
+        auto flags{ KEY_READ | view };
         wil::unique_hkey clsids_hkey{};
         RETURN_IF_WIN32_ERROR(::RegOpenKeyEx(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Classes\\CLSID", 0, flags, clsids_hkey.put()));
         for (const auto& name : registry::get_child_key_names(clsids_hkey.get())) {
+            if (stop_token.stop_requested()) {
+                return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            }
+
             if (name == L"CLSID") {
                 // special key name to skip
                 continue;
@@ -516,22 +1895,26 @@ HRESULT cometa::index() {
             }
 
             if (auto v{ registry::read_text_value(clsid_hkey.get(), nullptr, nullptr) }; std::holds_alternative<HRESULT>(v)) {
-                insert_coclass({ .clsid = clsid, .name = L"" });
+                insert_coclass({ .clsid = clsid, .name = L"" }, row_source::registry);
             } else {
-                insert_coclass({ .clsid = clsid, .name = std::get<std::wstring>(v) });
+                insert_coclass({ .clsid = clsid, .name = std::get<std::wstring>(v) }, row_source::registry);
             }
+            checkpoint();
         }
         return S_OK;
     };
 
-    auto index_interfaces = [this](bool request_wow6432 = false) {
-        _logger.log_info(request_wow6432 ? L"Indexing interfaces... (only errors are reported) - 32-bit" :
-            L"Indexing interfaces... (only errors are reported)");
+    auto index_interfaces = [this, &checkpoint, &view_name, &stop_token](REGSAM view) {
+        _logger.log_info(std::format(L"Indexing interfaces... (only errors are reported){}", view_name(view)));
 
-        auto flags{ request_wow6432 ? KEY_READ | KEY_WOW64_32KEY : KEY_READ };
+        auto flags{ KEY_READ | view };
         wil::unique_hkey interfaces_hkey{};
         RETURN_IF_WIN32_ERROR(::RegOpenKeyEx(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Classes\\Interface", 0, flags, interfaces_hkey.put()));
         for (const auto& name : registry::get_child_key_names(interfaces_hkey.get())) {
+            if (stop_token.stop_requested()) {
+                return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+            }
+
             GUID iid{};
             if (auto hr{ try_parse_guid(name, iid) }; FAILED(hr)) {
                 _logger.log_error(name, hr);
@@ -545,156 +1928,471 @@ HRESULT cometa::index() {
             }
 
             if (auto v{ registry::read_text_value(iid_hkey.get(), nullptr, nullptr) }; std::holds_alternative<HRESULT>(v)) {
-                insert_cotype({ iid, L"", cotype_kind::Interface, __uuidof(IUnknown), false });
+                insert_cotype({ iid, L"", cotype_kind::Interface, __uuidof(IUnknown), false }, row_source::registry);
             } else {
-                insert_cotype({ iid, std::get<std::wstring>(v), cotype_kind::Interface, __uuidof(IUnknown), false });
+                insert_cotype({ iid, std::get<std::wstring>(v), cotype_kind::Interface, __uuidof(IUnknown), false }, row_source::registry);
             }
+            checkpoint();
         }
 
-        invalidate_cache();
-
         return S_OK;
     };
 
-    // index 32-bit nodes first before indexing 64-bit
-    RETURN_IF_FAILED(index_coclasses(_is_wow64));
-    RETURN_IF_FAILED(index_interfaces(_is_wow64));
+    RETURN_IF_FAILED(check_typelibs());
+
+    // The database is shared by the 32-bit and 64-bit debuggees, so both registry views are indexed. The 32-bit
+    // view goes first, so the 64-bit entries win for the GUIDs registered in both.
+    auto views{ is_64bit_os() ? std::vector<REGSAM>{ KEY_WOW64_32KEY, KEY_WOW64_64KEY } : std::vector<REGSAM>{ 0 } };
+    for (auto view : views) {
+        RETURN_IF_FAILED(index_coclasses(view));
+        RETURN_IF_FAILED(index_interfaces(view));
+    }
+
+    index_typelibs();
+    if (stop_token.stop_requested()) {
+        return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+    }
 
-    RETURN_IF_FAILED(index_typelibs());
+    try {
+        bulk.complete();
+    } catch (const SQLite::Exception& ex) {
+        _logger.log_error(std::format(L"Error {} when trying to complete the metadata index: '{}'.",
+            ex.getErrorCode(), widen(ex.getErrorStr())), E_FAIL);
+        return E_FAIL;
+    }
+    _logger.log_info(std::format(L"Indexing completed: {} rows written ({:.0f} rows/s)", bulk.rows(), bulk.rows_per_second()));
+    _logger.log_info(std::format(L"TypeLibraries: {} parsed, {} skipped (unchanged), {} removed, {} failed",
+        parsed_typelibs, skipped_typelibs, removed_typelibs, failed_typelibs));
 
     return S_OK;
 }
 
 std::optional<cotype> cometa::resolve_type(const IID& iid) {
+    poll_index_job();
+
+    auto& stats{ stats_of(lookup_path::resolve_type) };
+    lookup_timer timer{ stats };
+
     if (_cotype_cache.contains(iid)) {
-        return _cotype_cache.get(iid);
+        if (auto& entry{ _cotype_cache.get(iid) }; !is_stale(iid, entry.generation)) {
+            stats.cache_hits++;
+            return entry.value;
+        }
+        stats.stale_hits++;
+    }
+
+    auto result{ read_type(iid, stats) };
+    if (!result && resolve_from_registry(iid, false, stats)) {
+        result = read_type(iid, stats);
+    }
+    _cotype_cache.insert_or_assign(iid, { result, _generation });
+
+    return result;
+}
+
+std::optional<cotype> cometa::read_type(const IID& iid, lookup_stats& stats) {
+    if (_snapshot && !_written_since_snapshot.contains(iid)) {
+        stats.snapshot_reads++;
+        auto record{ _snapshot->find_type(iid) };
+        return !record ? std::nullopt :
+            std::make_optional(cotype{ iid, _names.intern(_snapshot->text(record->name)), static_cast<cotype_kind>(record->kind),
+                record->parent_iid, record->methods_available != 0 });
+    }
+
+    if (_known_guids_loaded && !_known_types.may_contain(guid_fingerprint(iid))) {
+        stats.filtered++;
+        return std::nullopt;
     }
 
     assert(_db);
-    SQLite::Statement query{ *_db, "select * from cotypes where iid = :iid" };
-    query.bindNoCopy(":iid", &iid, sizeof(IID));
+    auto query{ lookup_statements().acquire("select name,type,parent_iid,methods_available from cotypes where iid = :iid") };
+    query->bindNoCopy(":iid", &iid, sizeof(IID));
+    stats.sql_statements++;
 
-    auto result{ !query.executeStep() ? std::nullopt :
-        std::make_optional(cotype{ iid, from_utf8(query.getColumn("name").getText()),
-            static_cast<cotype_kind>(query.getColumn("type").getInt()),
-            *(reinterpret_cast<const GUID*>(query.getColumn("parent_iid").getBlob())),
-            static_cast<bool>(query.getColumn("methods_available").getInt()) }) };
-    _cotype_cache.insert(iid, result);
+    auto result{ !query->executeStep() ? std::nullopt :
+        std::make_optional(cotype{ iid, _names.intern_utf8(query->getColumn(0).getText()),
+            static_cast<cotype_kind>(query->getColumn(1).getInt()),
+            *(reinterpret_cast<const GUID*>(query->getColumn(2).getBlob())),
+            static_cast<bool>(query->getColumn(3).getInt()) }) };
+    stats.sql_rows += result ? 1 : 0;
 
     return result;
 }
 
-std::optional<method_collection> cometa::get_type_methods(const IID& iid) {
-    assert(_db);
-    auto query_methods = [this](const IID& iid) {
-        SQLite::Statement method_query{ *_db, "select * from cotype_methods where iid = :iid order by ordinal" };
-        method_query.bindNoCopy(":iid", &iid, sizeof(IID));
-        method_collection methods{};
-        while (method_query.executeStep()) {
-            auto dispid_column{ method_query.getColumn("dispid") };
-
-            methods.push_back({
-                .iid = iid,
-                .name = from_utf8(method_query.getColumn("name").getText()),
-                .ordinal = method_query.getColumn("ordinal").getInt(),
-                .callconv = static_cast<CALLCONV>(method_query.getColumn("callconv").getInt()),
-                .dispid = !dispid_column.isNull() ? std::optional<DISPID>{ dispid_column.getInt() } : std::nullopt,
-                .return_type = from_utf8(method_query.getColumn("return_type").getText()) });
-        }
-        return methods;
-    };
+covtable_layout_ptr cometa::get_vtable_layout(const IID& iid) {
+    auto& stats{ stats_of(lookup_path::get_vtable_layout) };
+    lookup_timer timer{ stats };
+
+    auto layout{ find_vtable_layout(iid, stats) };
+    return layout->methods.empty() ? nullptr : layout;
+}
+
+covtable_layout_ptr cometa::find_vtable_layout(const IID& iid, lookup_stats& stats) {
+    if (_vtable_layout_cache.contains(iid)) {
+        auto& entry{ _vtable_layout_cache.get(iid) };
+        assert(entry.value && *entry.value);
+        auto& layout{ *entry.value };
+        if (std::ranges::none_of(layout->iid_chain, [this, &entry](const IID& id) { return is_stale(id, entry.generation); })) {
+            stats.cache_hits++;
+            return layout;
+        }
+        stats.stale_hits++;
+    }
+
+    auto layout{ build_vtable_layout(iid, stats) };
+    _vtable_layout_cache.insert_or_assign(iid, { layout, _generation });
+    return layout;
+}
+
+std::vector<covtable_method> cometa::read_methods(const IID& iid, lookup_stats& stats) {
+    std::vector<covtable_method> methods{};
+
+    if (_snapshot && !_written_since_snapshot.contains(iid)) {
+        stats.snapshot_reads++;
+        if (auto type{ _snapshot->find_type(iid) }; type) {
+            for (auto& m : _snapshot->methods_of(*type)) {
+                method_arg_collection args{};
+                for (auto& arg : _snapshot->args_of(m)) {
+                    args.push_back({ .name = _names.intern(_snapshot->text(arg.name)), .type = _names.intern(_snapshot->text(arg.type)),
+                        .flags = static_cast<USHORT>(arg.flags) });
+                }
 
-    if (auto type{ resolve_type(iid) }; type && type->methods_available) {
-        if (auto methods{ query_methods(iid) }; methods.size() == 0 || methods.at(0).name != L"QueryInterface") {
-            // The initial methods must be from the IUnknown interface. We will try to resolve the parent type...
-            if (auto parent_methods{ get_type_methods(type->parent_iid) }; parent_methods) {
-                std::ranges::copy(std::crbegin(*parent_methods), std::crend(*parent_methods), std::front_inserter(methods));
+                methods.push_back({ .method = {
+                    .iid = iid,
+                    .name = _names.intern(_snapshot->text(m.name)),
+                    .ordinal = m.ordinal,
+                    .callconv = static_cast<CALLCONV>(m.callconv),
+                    .dispid = m.has_dispid != 0 ? std::optional<DISPID>{ m.dispid } : std::nullopt,
+                    .return_type = _names.intern(_snapshot->text(m.return_type)) }, .args = std::move(args) });
+            }
+            if (!methods.empty()) {
                 return methods;
-            } else {
-                // we are missing some interface methods - it's safer to show nothing
-                return std::nullopt;
             }
+            // the type was indexed without its methods, they might be in the database already
         } else {
             return methods;
         }
     }
-    return std::nullopt;
+
+    {
+        // the statement lease ends with this block, so building the parent layout reuses the cached statement
+        // the signature parsed from the library of the debuggee architecture wins over the one for any architecture
+        auto query{ lookup_statements().acquire(
+            "select signature from cotype_signatures where iid = :iid and arch in (0, :arch) order by arch desc limit 1") };
+        query->bindNoCopy(":iid", &iid, sizeof(IID));
+        query->bind(":arch", static_cast<int>(_arch));
+        stats.sql_statements++;
+
+        if (query->executeStep()) {
+            stats.sql_rows++;
+            if (auto decoded{ decode_signature(iid, query->getColumn(0), _names) }; std::holds_alternative<HRESULT>(decoded)) {
+                _logger.log_error(std::format(L"Damaged method signatures of {}", wstring_from_guid(iid)), std::get<HRESULT>(decoded));
+            } else {
+                methods = std::move(std::get<std::vector<covtable_method>>(decoded));
+            }
+            return methods;
+        }
+    }
+
+    return parse_methods_on_demand(iid, stats);
+}
+
+std::vector<covtable_method> cometa::parse_methods_on_demand(const IID& iid, lookup_stats& stats) {
+    std::wstring tlb_path{};
+    USHORT tlb_arch{};
+    {
+        // the file registered for the debuggee architecture goes first, then the one for any architecture
+        auto query{ lookup_statements().acquire(R"(select g.path, coalesce(t.arch, 0) as tlb_arch from typelib_guids g
+    left join typelibs t on t.path = g.path where g.guid = :guid and g.path <> ''
+    order by tlb_arch = :arch desc, tlb_arch = 0 desc limit 1)") };
+        query->bindNoCopy(":guid", &iid, sizeof(IID));
+        query->bind(":arch", static_cast<int>(_arch));
+        stats.sql_statements++;
+
+        if (!query->executeStep()) {
+            // the type is not from a type library (for example, registered with !cometa add)
+            return {};
+        }
+        stats.sql_rows++;
+        tlb_path = from_utf8(query->getColumn(0).getText());
+        tlb_arch = static_cast<USHORT>(query->getColumn(1).getUInt());
+    }
+
+    stats.typelib_reads++;
+    auto parsed{ typelib::parse_type_methods(tlb_path, iid, _names) };
+    if (std::holds_alternative<HRESULT>(parsed)) {
+        _logger.log_error(std::format(L"Can't read the methods of {} from '{}'", wstring_from_guid(iid), tlb_path), std::get<HRESULT>(parsed));
+        return {};
+    }
+
+    auto& methods{ std::get<std::vector<covtable_method>>(parsed) };
+    try {
+        // the lookups run in the breakpoint handlers, so they never wait long for the write lock of another session
+        _db->setBusyTimeout(vtable_busy_timeout_ms);
+        auto restore_busy_timeout{ wil::scope_exit([this]() {
+            try {
+                _db->setBusyTimeout(busy_timeout_ms);
+            } catch (const SQLite::Exception&) {
+                // sqlite3_busy_timeout does not fail
+            }
+        }) };
+
+        savepoint methods_savepoint{ *_db, "parse_methods_on_demand" };
+        // the methods are part of the indexed metadata, so the revision stays the same
+        insert_cotype_methods(iid, methods, tlb_arch);
+        methods_savepoint.release();
+    } catch (const SQLite::Exception& ex) {
+        // when the database is locked, the methods are parsed again on the next lookup after the cache eviction
+        if (ex.getErrorCode() != SQLITE_BUSY) {
+            _logger.log_warning(std::format(L"Can't save the methods of {}: {} '{}'", wstring_from_guid(iid), ex.getErrorCode(),
+                widen(ex.getErrorStr())));
+        }
+    }
+    return methods;
 }
 
-std::optional<method_arg_collection> cometa::get_type_method_args(const comethod& method) {
+covtable_layout_ptr cometa::build_vtable_layout(const IID& iid, lookup_stats& stats) {
     assert(_db);
-    if (auto type{ resolve_type(method.iid) }; type && type->methods_available) {
-        SQLite::Statement arg_query{ *_db, "select * from cotype_method_args where iid = :iid and method_ordinal = :method_ordinal order by ordinal" };
-        arg_query.bindNoCopy(":iid", &method.iid, sizeof(IID));
-        arg_query.bind(":method_ordinal", method.ordinal);
-
-        method_arg_collection args{};
-        while (arg_query.executeStep()) {
-            args.push_back({
-                .name = from_utf8(arg_query.getColumn("name").getText()),
-                .type = from_utf8(arg_query.getColumn("type").getText()),
-                .flags = static_cast<USHORT>(arg_query.getColumn("flags").getUInt()) });
-        }
-        return args;
-    } else {
-        return std::nullopt;
+    auto layout{ std::make_shared<covtable_layout>(covtable_layout{ .iid = iid, .methods = {}, .iid_chain = { iid } }) };
+
+    auto type{ resolve_type(iid) };
+    if (!type || !type->methods_available) {
+        return layout;
+    }
+
+    auto methods{ read_methods(iid, stats) };
+
+    if (methods.size() == 0 || methods.at(0).method.name != L"QueryInterface") {
+        // The initial methods must be from the IUnknown interface. We will try to resolve the parent type...
+        if (type->parent_iid == iid) {
+            return layout;
+        }
+
+        auto parent{ find_vtable_layout(type->parent_iid, stats) };
+        layout->iid_chain.insert(std::end(layout->iid_chain), std::cbegin(parent->iid_chain), std::cend(parent->iid_chain));
+        if (parent->methods.empty()) {
+            // we are missing some interface methods - it's safer to show nothing
+            return layout;
+        }
+
+        layout->methods.reserve(parent->methods.size() + methods.size());
+        std::ranges::copy(parent->methods, std::back_inserter(layout->methods));
     }
+    std::ranges::move(methods, std::back_inserter(layout->methods));
+
+    return layout;
 }
 
 std::optional<coclass> cometa::resolve_class(const CLSID& clsid) {
+    poll_index_job();
+
+    auto& stats{ stats_of(lookup_path::resolve_class) };
+    lookup_timer timer{ stats };
+
     if (_coclass_cache.contains(clsid)) {
-        return _coclass_cache.get(clsid);
+        if (auto& entry{ _coclass_cache.get(clsid) }; !is_stale(clsid, entry.generation)) {
+            stats.cache_hits++;
+            return entry.value;
+        }
+        stats.stale_hits++;
+    }
+
+    auto result{ read_class(clsid, stats) };
+    if (!result && resolve_from_registry(clsid, true, stats)) {
+        result = read_class(clsid, stats);
+    }
+    _coclass_cache.insert_or_assign(clsid, { result, _generation });
+
+    return result;
+}
+
+std::optional<coclass> cometa::read_class(const CLSID& clsid, lookup_stats& stats) {
+    if (_snapshot && !_written_since_snapshot.contains(clsid)) {
+        stats.snapshot_reads++;
+        auto record{ _snapshot->find_class(clsid) };
+        return !record ? std::nullopt : std::make_optional(coclass{ clsid, _names.intern(_snapshot->text(record->name)) });
+    }
+
+    if (_known_guids_loaded && !_known_classes.may_contain(guid_fingerprint(clsid))) {
+        stats.filtered++;
+        return std::nullopt;
     }
 
     assert(_db);
-    SQLite::Statement query{ *_db, "select * from coclasses where clsid = :clsid" };
-    query.bindNoCopy(":clsid", &clsid, sizeof(CLSID));
-    auto result{ !query.executeStep() ? std::nullopt :
-        std::make_optional(coclass{ clsid, from_utf8(query.getColumn("name").getText()) })
+    auto query{ lookup_statements().acquire("select name from coclasses where clsid = :clsid") };
+    query->bindNoCopy(":clsid", &clsid, sizeof(CLSID));
+    stats.sql_statements++;
+    auto result{ !query->executeStep() ? std::nullopt :
+        std::make_optional(coclass{ clsid, _names.intern_utf8(query->getColumn(0).getText()) })
     };
+    stats.sql_rows += result ? 1 : 0;
+
     return result;
 }
 
+bool cometa::resolve_from_registry(const GUID& guid, bool is_class, lookup_stats& stats) noexcept {
+    if (!_db || _registry_misses.contains(guid)) {
+        return false;
+    }
+
+    try {
+        stats.registry_reads++;
+        auto key_path{ std::format(L"SOFTWARE\\Classes\\{}\\{}", is_class ? L"CLSID" : L"Interface", wstring_from_guid(guid)) };
+
+        // the registry view of the debuggee goes first
+        auto views{ !is_64bit_os() ? std::vector<REGSAM>{ 0 } : _arch == IMAGE_FILE_MACHINE_AMD64 ?
+            std::vector<REGSAM>{ KEY_WOW64_64KEY, KEY_WOW64_32KEY } : std::vector<REGSAM>{ KEY_WOW64_32KEY, KEY_WOW64_64KEY } };
+        wil::unique_hkey guid_hkey{};
+        for (auto view : views) {
+            if (::RegOpenKeyEx(HKEY_LOCAL_MACHINE, key_path.c_str(), 0, KEY_READ | view, guid_hkey.put()) == NO_ERROR) {
+                break;
+            }
+        }
+        if (!guid_hkey) {
+            _registry_misses.insert(guid);
+            return false;
+        }
+
+        auto name_v{ registry::read_text_value(guid_hkey.get(), nullptr, nullptr) };
+        std::wstring name{ std::holds_alternative<std::wstring>(name_v) ? std::get<std::wstring>(name_v) : L"" };
+
+        // only the type library referenced by the key is parsed, and only its type headers (as in !cometa index)
+        std::optional<typelib_info> tlbinfo{};
+        if (auto libid{ registry::read_text_value(guid_hkey.get(), L"TypeLib", nullptr) }; std::holds_alternative<std::wstring>(libid)) {
+            wil::unique_hkey typelib_hkey{};
+            auto typelib_key_path{ std::format(L"SOFTWARE\\Classes\\TypeLib\\{}", std::get<std::wstring>(libid)) };
+            if (::RegOpenKeyEx(HKEY_LOCAL_MACHINE, typelib_key_path.c_str(), 0, KEY_READ, typelib_hkey.put()) == NO_ERROR) {
+                if (auto ti{ typelib::get_tlbinfo(typelib_hkey.get(), _arch) }; std::holds_alternative<typelib_info>(ti)) {
+                    tlbinfo = std::move(std::get<typelib_info>(ti));
+                }
+            }
+        }
+
+        _db->setBusyTimeout(resolve_busy_timeout_ms);
+        auto restore_busy_timeout{ wil::scope_exit([this]() {
+            try {
+                _db->setBusyTimeout(busy_timeout_ms);
+            } catch (const SQLite::Exception&) {
+                // sqlite3_busy_timeout does not fail
+            }
+        }) };
+
+        savepoint resolve_savepoint{ *_db, "resolve_from_registry" };
+
+        _generation++;
+
+        if (tlbinfo) {
+            if (!tlbinfo->other_tlb_path.empty()) {
+                forget_typelib_for_any_arch(tlbinfo->other_tlb_path);
+            }
+
+            auto indexed{ find_typelib_fingerprint(tlbinfo->tlb_path) };
+            auto current{ typelib::get_tlb_fingerprint(tlbinfo->tlb_path, indexed) };
+            if (!indexed || !current || indexed->size != current->size || indexed->hash != current->hash ||
+                find_typelib_arch(tlbinfo->tlb_path) != typelib_arch(*tlbinfo)) {
+                if (auto hr{ index_tlb_file(tlbinfo->tlb_path, true, typelib_arch(*tlbinfo), current,
+                    typelib::parse_tlb(tlbinfo->tlb_path, false)) }; FAILED(hr)) {
+                    _logger.log_error(std::format(L"'{}'", tlbinfo->tlb_path), hr);
+                }
+            }
+        }
+
+        // the registry row never replaces the one written from the type library
+        if (is_class) {
+            insert_coclass({ .clsid = guid, .name = name }, row_source::registry);
+        } else {
+            insert_cotype({ guid, name, cotype_kind::Interface, __uuidof(IUnknown), false }, row_source::registry);
+        }
+
+        resolve_savepoint.release();
+    } catch (const SQLite::Exception& ex) {
+        if (ex.getErrorCode() != SQLITE_BUSY) {
+            _logger.log_error(std::format(L"Error {} when saving the registry metadata of {}: '{}'.", ex.getErrorCode(),
+                wstring_from_guid(guid), widen(ex.getErrorStr())), E_FAIL);
+            _registry_misses.insert(guid);
+        }
+        // when another session holds the write lock, the next lookup after the cache eviction tries again
+        return false;
+    } catch (...) {
+        _logger.log_error(std::format(L"Can't resolve {} from the registry", wstring_from_guid(guid)), wil::ResultFromCaughtException());
+        _registry_misses.insert(guid);
+        return false;
+    }
+
+    /*
+     * The snapshot stays mapped: the GUIDs written above are in _written_since_snapshot, so their
+     * lookups go to the database, and the other lookups still read the snapshot. Bumping the revision
+     * here would make every later lookup in this session (and the next session) scan the database.
+    */
+    if (_snapshot) {
+        _snapshot_stale = true;
+    } else if (!_known_guids_loaded || _known_types.is_saturated() || _known_classes.is_saturated()) {
+        load_known_guids();
+    }
+    // the name index is rebuilt from the database on the next search
+    _name_index.reset();
+
+    return true;
+}
+
 std::vector<std::tuple<std::wstring, CLSID, ULONG64>> cometa::find_vtables_by_iid(const IID& iid) {
-    SQLite::Statement query{ *_db, "select module_name,clsid,vtable from vtables where iid = :iid" };
-    query.bindNoCopy(":iid", &iid, sizeof(IID));
+    auto& stats{ stats_of(lookup_path::find_vtables_by_iid) };
+    lookup_timer timer{ stats };
+
+    auto query{ vtable_statements().acquire("select module_name,clsid,vtable from vtables where arch = :arch and iid = :iid") };
+    query->bind(":arch", static_cast<int>(_arch));
+    query->bindNoCopy(":iid", &iid, sizeof(IID));
+    stats.sql_statements++;
 
     std::vector<std::tuple<std::wstring, CLSID, ULONG64>> vtables{};
-    while (query.executeStep()) {
+    while (query->executeStep()) {
+        stats.sql_rows++;
         vtables.push_back({
-            from_utf8(query.getColumn("module_name").getString()),
-            *(reinterpret_cast<const GUID*>(query.getColumn("clsid").getBlob())),
-            query.getColumn("vtable").getInt64()
+            from_utf8(query->getColumn(0).getString()),
+            *(reinterpret_cast<const GUID*>(query->getColumn(1).getBlob())),
+            query->getColumn(2).getInt64()
             });
     }
     return vtables;
 }
 
 std::vector<std::tuple<std::wstring, IID, ULONG64>> cometa::find_vtables_by_clsid(const CLSID& clsid) {
-    SQLite::Statement query{ *_db, "select module_name,iid,vtable from vtables where clsid = :clsid" };
-    query.bindNoCopy(":clsid", &clsid, sizeof(CLSID));
+    auto& stats{ stats_of(lookup_path::find_vtables_by_clsid) };
+    lookup_timer timer{ stats };
+
+    auto query{ vtable_statements().acquire("select module_name,iid,vtable from vtables where arch = :arch and clsid = :clsid") };
+    query->bind(":arch", static_cast<int>(_arch));
+    query->bindNoCopy(":clsid", &clsid, sizeof(CLSID));
+    stats.sql_statements++;
 
     std::vector<std::tuple<std::wstring, IID, ULONG64>> vtables{};
-    while (query.executeStep()) {
+    while (query->executeStep()) {
+        stats.sql_rows++;
         vtables.push_back({
-            from_utf8(query.getColumn("module_name").getString()),
-            *(reinterpret_cast<const GUID*>(query.getColumn("iid").getBlob())),
-            query.getColumn("vtable").getInt64()
+            from_utf8(query->getColumn(0).getString()),
+            *(reinterpret_cast<const GUID*>(query->getColumn(1).getBlob())),
+            query->getColumn(2).getInt64()
             });
     }
     return vtables;
 }
 
 std::vector<std::tuple<ULONG, CLSID>> cometa::find_clsids_by_module_name(const std::wstring& module_name) {
-    SQLite::Statement query{ *_db, "select distinct module_timestamp,clsid from vtables where module_name = :module_name" };
+    auto& stats{ stats_of(lookup_path::find_clsids_by_module_name) };
+    lookup_timer timer{ stats };
+
+    auto query{ vtable_statements().acquire("select distinct module_timestamp,clsid from vtables where arch = :arch and module_name = :module_name") };
+    query->bind(":arch", static_cast<int>(_arch));
     auto module_name_u8{ to_utf8(module_name) };
-    query.bindNoCopy(":module_name", module_name_u8.c_str());
+    query->bindNoCopy(":module_name", module_name_u8.c_str());
+    stats.sql_statements++;
 
     std::vector<std::tuple<ULONG, CLSID>> vtables{};
-    while (query.executeStep()) {
+    while (query->executeStep()) {
+        stats.sql_rows++;
         vtables.push_back({
-            query.getColumn("module_timestamp").getUInt(),
-            *(reinterpret_cast<const GUID*>(query.getColumn("clsid").getBlob()))
+            query->getColumn(0).getUInt(),
+            *(reinterpret_cast<const GUID*>(query->getColumn(1).getBlob()))
             });
     }
     return vtables;
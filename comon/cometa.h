@@ -18,18 +18,29 @@
 
 #include <format>
 #include <optional>
-#include <deque>
+#include <memory>
 #include <unordered_set>
 #include <unordered_map>
 #include <filesystem>
 #include <variant>
 #include <functional>
 #include <array>
+#include <span>
+#include <stop_token>
+#include <mutex>
+#include <condition_variable>
 
 #include <SQLiteCpp/Database.h>
 
 #include "comon.h"
-#include "lfu_cache.h"
+#include "background_job.h"
+#include "bloom_filter.h"
+#include "cache.h"
+#include "cometa_snapshot.h"
+#include "lookup_stats.h"
+#include "name_index.h"
+#include "statement_cache.h"
+#include "string_pool.h"
 
 namespace fs = std::filesystem;
 
@@ -55,10 +66,12 @@ struct comodule
     const bool is_64bit;
 };
 
+// the names in the metadata structs point either to literals or to the cometa string pool
+
 struct cotype
 {
     GUID iid{};
-    std::wstring name;
+    std::wstring_view name;
     cotype_kind type{};
     GUID parent_iid{};
     bool methods_available{};
@@ -67,93 +80,459 @@ struct cotype
 struct coclass
 {
     GUID clsid{};
-    std::wstring name;
+    std::wstring_view name;
 };
 
 struct comethod
 {
     GUID iid{};
-    std::wstring name;
+    std::wstring_view name;
     int ordinal;
     CALLCONV callconv;
     std::optional<DISPID> dispid{};
-    std::wstring return_type;
+    std::wstring_view return_type;
 };
 
 struct comethod_arg
 {
-    std::wstring name;
-    std::wstring type;
+    std::wstring_view name;
+    std::wstring_view type;
     USHORT flags; // IDLFLAG_NONE, IDLFLAG_FIN, IDLFLAG_FOUT, IDLFLAG_FRETVAL, etc.
 };
 
+struct cache_info
+{
+    cache_policy policy;
+    size_t capacity;
+    size_t size;
+    cache_stats stats;
+    // LFU only, 0 if the entries never age
+    std::optional<size_t> aging_period;
+};
+
 struct typelib_info
 {
     std::wstring name;
     std::wstring version;
+    // the file registered for the debuggee architecture (or the only one registered)
     std::wstring tlb_path;
+    // the file registered for the other architecture, if it is a different one
+    std::wstring other_tlb_path;
+};
+
+// identifies the content of an indexed type library file, so an unchanged library is not parsed again
+struct typelib_fingerprint
+{
+    uint64_t size;
+    int64_t last_write_time;
+    uint64_t hash;
+};
+
+// the rows read from the registry never replace the rows of the GUIDs defined by an indexed type library
+enum class row_source
+{
+    typelib,
+    registry
+};
+
+/*
+ * Decides which vtable row stays when both databases know the same (CLSID, IID) pair. Types and classes
+ * have no timestamps: a local type is replaced only when it has no methods and the merged one has them,
+ * and a merged method signature is added only when the type has none here, unless the merged rows win (theirs).
+*/
+enum class merge_policy
+{
+    newest, // the vtable of the module with the newer timestamp
+    ours,
+    theirs
+};
+
+constexpr std::wstring_view merge_policy_name(merge_policy policy) {
+    switch (policy) {
+    case merge_policy::newest: return L"newest";
+    case merge_policy::ours: return L"ours";
+    case merge_policy::theirs: return L"theirs";
+    default: return L"unknown";
+    }
+}
+
+inline std::optional<merge_policy> parse_merge_policy(std::string_view name) {
+    for (auto policy : { merge_policy::newest, merge_policy::ours, merge_policy::theirs }) {
+        if (std::ranges::equal(name, merge_policy_name(policy), [](char c, wchar_t wc) { return static_cast<wchar_t>(c) == wc; })) {
+            return policy;
+        }
+    }
+    return std::nullopt;
+}
+
+// a database of the earlier versions, which kept the metadata of each architecture in a separate file
+struct legacy_database
+{
+    fs::path path;
+    USHORT arch;
+};
+
+// cached lookup result stamped with the cometa generation it was read in
+template<typename T>
+struct cache_entry
+{
+    std::optional<T> value;
+    uint64_t generation;
 };
 
-using method_collection = std::deque<comethod>;
 using method_arg_collection = std::vector<comethod_arg>;
 
+struct covtable_method
+{
+    comethod method;
+    method_arg_collection args;
+};
+
+/*
+ * Flattened virtual table of an interface: the inherited methods come first, so the
+ * method index is its vtable slot. The layout is immutable once built and shared
+ * between the breakpoint engine and the display commands.
+*/
+struct covtable_layout
+{
+    IID iid;
+    std::vector<covtable_method> methods;
+    // the interface and its ancestors whose methods are in the layout
+    std::vector<IID> iid_chain;
+};
+
+using covtable_layout_ptr = std::shared_ptr<const covtable_layout>;
+
+struct parsed_cotype
+{
+    cotype type;
+    // the first arg of each method is the this pointer, so the arg ordinal is its index
+    std::vector<covtable_method> methods;
+};
+
+// metadata read from a type library by an indexing worker, the names point to its own string pool
+struct parsed_typelib
+{
+    string_pool names;
+    std::vector<parsed_cotype> types;
+    std::vector<coclass> classes;
+    // false if only the type headers were read
+    bool methods_parsed;
+};
+
 class cometa
 {
     const std::unique_ptr<SQLite::Database> _db;
+    // read-only connection for the lookups when the database is in WAL mode (nullptr otherwise), so they
+    // never wait for the writes of other debugger sessions
+    const std::unique_ptr<SQLite::Database> _read_db;
     const dbgeng_logger _logger;
-    const bool _is_wow64;
+    // IMAGE_FILE_MACHINE_I386 or IMAGE_FILE_MACHINE_AMD64, the vtables are saved and looked up for this architecture
+    const USHORT _arch;
 
-    std::unordered_set<IID> _known_iids{};
+    // must be declared after _db, as the statements are finalized before the database is closed
+    statement_cache _statements;
+    const std::unique_ptr<statement_cache> _read_statements;
 
-    lfu_cache<IID, const std::optional<const cotype>> _cotype_cache{ 100 };
-    lfu_cache<CLSID, const std::optional<const coclass>> _coclass_cache{ 50 };
+    statement_cache& lookup_statements() {
+        return _read_statements ? *_read_statements : _statements;
+    }
 
-    HRESULT index_tlb(std::wstring_view tlb_path);
+    struct pending_vtable
+    {
+        std::string module_name_u8;
+        ULONG module_timestamp;
+        CLSID clsid;
+        IID iid;
+        ULONG64 address;
+    };
+
+    // vtables not saved because another session held the write lock, retried with the next save
+    std::vector<pending_vtable> _pending_vtables{};
+
+    // the vtables saved in the working set mode, waiting for the background writer
+    struct dirty_vtables
+    {
+        std::mutex lock{};
+        // only wakes the writer up when the session stops it
+        std::condition_variable_any wakeup{};
+        std::vector<pending_vtable> rows{};
+        // held while the rows are written, so the rows of the same vtable reach the file in order
+        std::mutex write_lock{};
+    };
+
+    // In the working set mode, the vtables of the debuggee architecture are read from and written to an in-memory
+    // copy, and a background thread writes the new rows to the database file every few seconds.
+    struct working_set
+    {
+        std::unique_ptr<SQLite::Database> db;
+        // must be declared after db, as the statements are finalized before the database is closed
+        std::unique_ptr<statement_cache> statements;
+        std::shared_ptr<dirty_vtables> dirty;
+        std::unique_ptr<background_job> writer;
+    };
+    std::unique_ptr<working_set> _working_set{};
+
+    statement_cache& vtable_statements() {
+        return _working_set ? *_working_set->statements : lookup_statements();
+    }
 
-    void fill_known_iids();
+    // read-only copy of the types and classes, replaced after each full index (nullptr when the
+    // snapshot does not match the database, so the lookups go to SQLite)
+    const fs::path _snapshot_path;
+    std::unique_ptr<metadata_snapshot> _snapshot{};
+
+    // GUIDs written after the snapshot was opened, so their lookups skip the snapshot and go to SQLite
+    flat_hash_set<GUID> _written_since_snapshot{};
+    // the registry rows are not in the snapshot, so the revision changes when the session ends
+    bool _snapshot_stale{};
+
+    // the read-only database under the layered metadata (empty if the database is not layered)
+    fs::path _base_path{};
+
+    // names read from the database, shared by all the cached metadata and breakpoints in the session
+    string_pool _names{};
+
+    flat_hash_set<IID> _known_iids{};
+
+    // the default LFU policy halves frequencies every 10 * capacity lookups, so the types that were
+    // hot only when the monitor attached do not pin the cache for the rest of the session
+    policy_cache<IID, const cache_entry<cotype>> _cotype_cache{ cache_policy::lfu, 100 };
+    policy_cache<CLSID, const cache_entry<coclass>> _coclass_cache{ cache_policy::lfu, 50 };
+    policy_cache<IID, const cache_entry<covtable_layout_ptr>> _vtable_layout_cache{ cache_policy::lfu, 100 };
+
+    // The generation is incremented before each type library is indexed, and each written GUID
+    // is stamped with it. A cached entry older than the last write of its GUID is stale.
+    uint64_t _generation{};
+    flat_hash_map<GUID, uint64_t> _guid_generations{};
+
+    // IIDs and CLSIDs present in the database, so lookups of unknown GUIDs never reach SQLite
+    bloom_filter _known_types{ 0 };
+    bloom_filter _known_classes{ 0 };
+    bool _known_guids_loaded{};
+
+    // GUIDs missing from the registry (checked after a database miss), so each is looked up once per session
+    flat_hash_set<GUID> _registry_misses{};
+
+    // (module name, timestamp) pairs with saved vtables, so loading a module without them never reaches SQLite
+    bloom_filter _known_modules{ 0 };
+    bool _known_modules_loaded{};
+    // The filter holds only the modules of the overlay, so the startup never reads the vtables of the base. A module
+    // missing from the filter is probed in the base once, and added to the filter if the base knows it.
+    flat_hash_set<uint64_t> _base_module_probes{};
+
+    // the full index running on a background thread, and the staging database it writes
+    std::unique_ptr<background_job> _index_job{};
+    fs::path _staging_path{};
+    // set in the instance writing the staging database, which needs no snapshot or filters
+    bool _is_staging{};
+
+    // built on the first search and rebuilt when the metadata revision changes
+    std::unique_ptr<name_index> _name_index{};
+    uint32_t _name_index_revision{};
 
-    void insert_cotype(const cotype& typedesc);
-    void insert_cotype_method(const comethod& method);
-    void insert_cotype_method_arg(const GUID& iid, int method_ordinal, const comethod_arg& arg, int arg_ordinal);
-    void insert_coclass(const coclass& classdesc);
+    std::array<lookup_stats, lookup_path_count> _lookup_stats{};
+
+    lookup_stats& stats_of(lookup_path path) {
+        return _lookup_stats[static_cast<size_t>(path)];
+    }
+
+    void mark_written(const GUID& guid) {
+        _guid_generations.insert_or_assign(guid, _generation);
+        if (_snapshot) {
+            _written_since_snapshot.insert(guid);
+        }
+    }
+
+    bool is_stale(const GUID& guid, uint64_t generation) const {
+        auto iter{ _guid_generations.find(guid) };
+        return iter != std::end(_guid_generations) && iter->second > generation;
+    }
+
+    void load_known_guids() noexcept;
+    void load_known_modules() noexcept;
+
+    // the revision (kept in the user_version pragma) changes whenever types or classes are written
+    uint32_t metadata_revision();
+    void bump_metadata_revision() noexcept;
+
+    HRESULT export_snapshot(uint32_t revision);
+    void build_name_index(uint32_t revision);
+    // maps the snapshot, exporting it first if it is missing or out of date
+    void open_snapshot() noexcept;
+    // rebuilds the snapshot, the caches, and the filters after the metadata changed
+    void reload_metadata() noexcept;
+
+    // attaches the base database recorded in the overlay, and changes the revision if its file changed
+    void open_base() noexcept;
+    void attach_base(const fs::path& base_path);
+    void detach_base() noexcept;
+    // returns true if the recorded fingerprint was different
+    bool save_base_record(const fs::path& base_path);
+
+    // layouts of the interfaces without known methods are cached too, but have no methods
+    covtable_layout_ptr find_vtable_layout(const IID& iid, lookup_stats& stats);
+    covtable_layout_ptr build_vtable_layout(const IID& iid, lookup_stats& stats);
+    std::vector<covtable_method> read_methods(const IID& iid, lookup_stats& stats);
+    std::vector<covtable_method> parse_methods_on_demand(const IID& iid, lookup_stats& stats);
+
+    std::optional<cotype> read_type(const IID& iid, lookup_stats& stats);
+    std::optional<coclass> read_class(const CLSID& clsid, lookup_stats& stats);
+    // Saves the metadata of a GUID unknown to the database from its Interface or CLSID registry key, and indexes
+    // the type library the key references. Returns true if the GUID is registered and its metadata was saved.
+    bool resolve_from_registry(const GUID& guid, bool is_class, lookup_stats& stats) noexcept;
+
+    // the architecture of a registered type library file (0 if the same file is registered for both)
+    USHORT typelib_arch(const typelib_info& tlbinfo) const {
+        return tlbinfo.other_tlb_path.empty() ? 0 : _arch;
+    }
+
+    void write_tlb(std::wstring_view tlb_path, USHORT arch, const parsed_typelib& parsed);
+    // replaces the rows of the previous version of the library with the parsed ones, and records its fingerprint
+    HRESULT index_tlb_file(std::wstring_view tlb_path, bool registered, USHORT arch, const std::optional<typelib_fingerprint>& fingerprint,
+        const std::variant<parsed_typelib, HRESULT>& parsed);
+
+    std::optional<typelib_fingerprint> find_typelib_fingerprint(std::wstring_view tlb_path);
+    // the architecture the library was indexed for (0 if it is not specific to one, or not indexed)
+    USHORT find_typelib_arch(std::wstring_view tlb_path);
+    std::vector<std::pair<std::wstring, bool>> get_indexed_typelibs();
+    void save_typelib(std::wstring_view tlb_path, const typelib_fingerprint& fingerprint, bool registered, USHORT arch);
+    // removes the rows of the GUIDs defined only by the library, and the signatures parsed from it (and the library
+    // record if forget is set)
+    void remove_typelib(std::wstring_view tlb_path, bool forget);
+    // true if the signatures of all the types of the library with methods are in the database
+    bool typelib_methods_parsed(std::wstring_view tlb_path);
+    // removes a library registered for the other architecture if it was indexed for any architecture
+    void forget_typelib_for_any_arch(std::wstring_view tlb_path);
+    void insert_typelib_guid(std::wstring_view tlb_path, const GUID& guid);
+
+    void fill_known_iids();
 
-    static std::unique_ptr<SQLite::Database> init_db(const fs::path& path, IDebugControl4* dbgcontrol);
-    static std::unique_ptr<SQLite::Database> open_db(const fs::path& path, IDebugControl4* dbgcontrol);
+    void insert_cotype(const cotype& typedesc, row_source source = row_source::typelib);
+    // all the methods of an interface are stored in a single signature blob, for the architecture of its type library
+    // (0 if the library is not specific to one)
+    void insert_cotype_methods(const IID& iid, std::span<const covtable_method> methods, USHORT arch = 0);
+    void insert_coclass(const coclass& classdesc, row_source source = row_source::typelib);
+
+    static std::unique_ptr<SQLite::Database> init_db(const fs::path& path, const dbgeng_logger& log);
+    static std::unique_ptr<SQLite::Database> open_db(const fs::path& path, const dbgeng_logger& log);
+    static std::unique_ptr<SQLite::Database> open_read_db(const SQLite::Database& db, const fs::path& path);
+
+    // returns false if the vtables stay pending
+    bool flush_pending_vtables(int lock_timeout_ms) noexcept;
+    static void write_vtables(SQLite::Database& db, statement_cache& statements, USHORT arch, std::span<const pending_vtable> vtables);
+
+    void attach_metadata_source(const fs::path& source_path);
+    // replaces the types, classes, and type libraries (but not the vtables) with the ones from another database
+    void copy_metadata(const fs::path& source_path);
+    // replaces the metadata of this database with the results of the background index in the staging database
+    void merge_index_results(const fs::path& staging_path);
+    // swaps in the staging database of a completed background index
+    void complete_index_job() noexcept;
+    void remove_staging_db() noexcept;
 
 public:
 
-    static bool is_valid_db(const fs::path& path);
+    // the legacy databases are merged into a new database
+    explicit cometa(const dbgeng_logger& logger, USHORT arch, const fs::path& db_path, bool create_new,
+        std::span<const legacy_database> legacy_databases = {});
 
-    explicit cometa(IDebugControl4* dbgcontrol, bool is_wow64, const fs::path& db_path, bool create_new);
+    cometa(const cometa&) = delete;
+    cometa& operator=(const cometa&) = delete;
+
+    ~cometa();
 
     void invalidate_cache() {
         _cotype_cache.clear();
         _coclass_cache.clear();
+        _vtable_layout_cache.clear();
+        _guid_generations.clear();
     }
 
-    HRESULT index();
+    void set_cache_policy(cache_policy policy, size_t capacity, std::optional<size_t> aging_period = std::nullopt) {
+        _cotype_cache.reset(policy, capacity, aging_period);
+        _coclass_cache.reset(policy, capacity, aging_period);
+        _vtable_layout_cache.reset(policy, capacity, aging_period);
+    }
 
-    HRESULT index(std::wstring_view tlb_path) {
-        if (!_db) {
-            _logger.log_error(L"no open database", E_FAIL);
-            return E_FAIL;
-        }
+    cache_info get_cotype_cache_info() const {
+        return { _cotype_cache.policy(), _cotype_cache.capacity(), _cotype_cache.size(), _cotype_cache.stats(),
+            _cotype_cache.aging_period() };
+    }
+
+    cache_info get_coclass_cache_info() const {
+        return { _coclass_cache.policy(), _coclass_cache.capacity(), _coclass_cache.size(), _coclass_cache.stats(),
+            _coclass_cache.aging_period() };
+    }
+
+    cache_info get_vtable_layout_cache_info() const {
+        return { _vtable_layout_cache.policy(), _vtable_layout_cache.capacity(), _vtable_layout_cache.size(), _vtable_layout_cache.stats(),
+            _vtable_layout_cache.aging_period() };
+    }
+
+    const string_pool& get_name_pool() const { return _names; }
+
+    const statement_cache& get_statements() const { return _statements; }
+
+    // nullptr when the lookups share the write connection
+    const statement_cache* get_read_statements() const { return _read_statements.get(); }
+
+    const metadata_snapshot* get_snapshot() const { return _snapshot.get(); }
 
-        if (auto hr{ index_tlb(tlb_path) }; SUCCEEDED(hr)) {
-            _logger.log_info_dml(std::format(L"'{}' : <col fg=\"srccmnt\">PARSED</col>", tlb_path));
+    const lookup_stats& get_lookup_stats(lookup_path path) const {
+        return _lookup_stats[static_cast<size_t>(path)];
+    }
 
-            invalidate_cache();
+    void reset_stats() {
+        _cotype_cache.reset_stats();
+        _coclass_cache.reset_stats();
+        _vtable_layout_cache.reset_stats();
+        _lookup_stats.fill({});
+    }
 
-            return S_OK;
-        } else {
-            _logger.log_error_dml(std::format(L"'{}'", tlb_path), hr);
-            return hr;
+    // runs in the calling thread, and stops early (with ERROR_CANCELLED) when a stop is requested
+    // with_methods parses the method signatures of the registered type libraries too (by default, they are parsed
+    // on first use), so the database has the layouts without the libraries (for example, to merge or share it)
+    HRESULT index(std::stop_token stop_token = {}, bool with_methods = false);
+
+    // The full index in the background. It copies the metadata to a staging database, indexes it on a separate
+    // thread, and replaces the metadata of this database in a single transaction when complete (keeping the rows
+    // written in the meantime). The lookups use the previous metadata until then.
+    HRESULT start_index(bool with_methods = false);
+    HRESULT index_status();
+    HRESULT cancel_index();
+
+    // checks whether the background index completed, so its metadata can be swapped in
+    void poll_index_job() noexcept {
+        if (_index_job && _index_job->is_done()) {
+            complete_index_job();
         }
     }
 
+    HRESULT index(std::wstring_view tlb_path);
+
     HRESULT save(std::wstring_view dbpath);
 
-    std::optional<std::wstring> resolve_type_name(const IID& iid) {
+    // loads the vtables into memory, so the breakpoints never wait for the disk (see working_set)
+    HRESULT enable_working_set();
+    HRESULT disable_working_set();
+    HRESULT working_set_status();
+
+    // Layers this database (the overlay) over a read-only base database, for example a prebuilt one shared by a team.
+    // The lookups read the overlay rows first and then the base ones, and all the writes go to the overlay. The
+    // base is recorded in the overlay, so the next sessions attach it too.
+    HRESULT set_base(std::wstring_view base_path);
+    HRESULT remove_base();
+    HRESULT base_status();
+
+    // writes the vtables saved in the working set mode, or the ones left pending, to the database file
+    void flush_vtables() noexcept;
+
+    // copies the types, classes, and vtables of another metadata database in a single transaction; the vtables
+    // of a legacy database get legacy_arch (or the architecture of this session)
+    HRESULT merge(std::wstring_view dbpath, merge_policy policy, std::optional<USHORT> legacy_arch = std::nullopt);
+
+    std::optional<std::wstring_view> resolve_type_name(const IID& iid) {
         if (auto t{ resolve_type(iid) }; t) {
             return t->name;
         }
@@ -170,10 +549,13 @@ public:
     
     std::vector<std::tuple<ULONG, CLSID>> find_clsids_by_module_name(const std::wstring& module_name);
 
-    std::optional<method_collection> get_type_methods(const IID& iid);
-    std::optional<method_arg_collection> get_type_method_args(const comethod& method);
+    // finds types, classes, and methods by a name fragment or a GUID prefix
+    std::variant<name_search_result, HRESULT> find_names(std::wstring_view text, size_t max_results);
+
+    // returns nullptr if the methods of the interface (or any of its ancestors) are unknown
+    covtable_layout_ptr get_vtable_layout(const IID& iid);
 
-    std::optional<std::wstring> resolve_class_name(const CLSID& clsid) {
+    std::optional<std::wstring_view> resolve_class_name(const CLSID& clsid) {
         if (auto c{ resolve_class(clsid) }; c) {
             return c->name;
         }
@@ -200,7 +582,20 @@ using funcdesc_t = std::unique_ptr<FUNCDESC, std::function<void(FUNCDESC*)>>;
 
 constexpr std::wstring_view bad_type_name{ L"BAD_TYPE" };
 
-std::variant<typelib_info, HRESULT> get_tlbinfo(HKEY typelib_hkey);
+// arch is IMAGE_FILE_MACHINE_I386 (prefers the win32 file) or IMAGE_FILE_MACHINE_AMD64 (prefers the win64 file)
+std::variant<typelib_info, HRESULT> get_tlbinfo(HKEY typelib_hkey, USHORT arch);
+
+// the hash of the indexed fingerprint is reused when the size and the last write time did not change
+std::optional<typelib_fingerprint> get_tlb_fingerprint(std::wstring_view tlb_path, const std::optional<typelib_fingerprint>& indexed);
+
+// does not touch the database, so the type libraries can be parsed on worker threads; without methods, it reads
+// only the type headers and the methods are parsed on first use
+std::variant<parsed_typelib, HRESULT> parse_tlb(std::wstring_view tlb_path, bool with_methods);
+
+std::variant<std::vector<covtable_method>, HRESULT> parse_type_methods(std::wstring_view tlb_path, const IID& iid, string_pool& names);
+
+std::variant<std::vector<covtable_method>, HRESULT> parse_methods(ITypeInfo* typeinfo, const TYPEATTR& typeattr, cotype_kind kind,
+    string_pool& names_pool);
 
 std::variant<typeattr_t, HRESULT> get_typeinfo_attr(ITypeInfo* typeinfo);
 
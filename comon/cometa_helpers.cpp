@@ -1,11 +1,15 @@
 
+#include <algorithm>
 #include <array>
+#include <cassert>
 #include <functional>
 #include <ranges>
 #include <sstream>
 #include <string>
 #include <format>
 #include <compare>
+#include <cstring>
+#include <filesystem>
 
 #include "cometa.h"
 #include "arch.h"
@@ -83,7 +87,7 @@ std::variant<std::wstring, HRESULT> registry::read_text_value(HKEY hkey, const w
     return std::wstring{ buffer.get() };
 }
 
-std::variant<typelib_info, HRESULT> typelib::get_tlbinfo(HKEY typelib_hkey) {
+std::variant<typelib_info, HRESULT> typelib::get_tlbinfo(HKEY typelib_hkey, USHORT arch) {
     std::vector<version> versions{};
     ranges::transform(registry::get_child_key_names(typelib_hkey), std::back_inserter(versions),
         [](const std::wstring& v) { return version{ v }; });
@@ -97,22 +101,246 @@ std::variant<typelib_info, HRESULT> typelib::get_tlbinfo(HKEY typelib_hkey) {
             return std::get<HRESULT>(name_kv);
         }
 
-#if ARCH_X64
-        auto path_kv{ registry::read_text_value(latest_version_hkey.get(), L"0\\win64", nullptr) };
-#else
-        auto path_kv{ registry::read_text_value(latest_version_hkey.get(), L"0\\win32", nullptr) };
-#endif
+        // The pointer-sized types (for example, __int3264) differ between the win32 and win64 libraries, so the
+        // methods are read from the library of the debuggee architecture. The other one is the fallback.
+        auto win64{ arch == IMAGE_FILE_MACHINE_AMD64 };
+        auto path_kv{ registry::read_text_value(latest_version_hkey.get(), win64 ? L"0\\win64" : L"0\\win32", nullptr) };
+        auto other_path_kv{ registry::read_text_value(latest_version_hkey.get(), win64 ? L"0\\win32" : L"0\\win64", nullptr) };
+        if (std::holds_alternative<HRESULT>(path_kv)) {
+            std::swap(path_kv, other_path_kv);
+        }
 
         if (std::holds_alternative<HRESULT>(path_kv)) {
             return std::get<HRESULT>(path_kv);
         }
 
-        return typelib_info{ std::get<std::wstring>(name_kv), latest_version->_version, std::get<std::wstring>(path_kv) };
+        typelib_info info{ std::get<std::wstring>(name_kv), latest_version->_version, std::get<std::wstring>(path_kv), {} };
+        if (auto other_path{ std::get_if<std::wstring>(&other_path_kv) }; other_path && ::_wcsicmp(other_path->c_str(), info.tlb_path.c_str()) != 0) {
+            info.other_tlb_path = std::move(*other_path);
+        }
+        return info;
     }
 
     return E_INVALIDARG;
 }
 
+std::optional<typelib_fingerprint> typelib::get_tlb_fingerprint(std::wstring_view tlb_path, const std::optional<typelib_fingerprint>& indexed) {
+    // a type library embedded in a DLL may have the resource index appended to the path, for example, 'oleaut32.dll\2';
+    // a path we can't access (no permissions, a removed network share) is treated as missing
+    std::error_code ec{};
+    fs::path file_path{ tlb_path };
+    if (auto resource_index{ file_path.filename().wstring() }; !resource_index.empty() && !fs::exists(file_path, ec) &&
+        ranges::all_of(resource_index, [](wchar_t c) { return c >= L'0' && c <= L'9'; })) {
+        file_path = file_path.parent_path();
+    }
+
+    WIN32_FILE_ATTRIBUTE_DATA attrs{};
+    if (!::GetFileAttributesExW(file_path.c_str(), GetFileExInfoStandard, &attrs)) {
+        return std::nullopt;
+    }
+
+    typelib_fingerprint fingerprint{
+        .size = (static_cast<uint64_t>(attrs.nFileSizeHigh) << 32) | attrs.nFileSizeLow,
+        .last_write_time = static_cast<int64_t>((static_cast<uint64_t>(attrs.ftLastWriteTime.dwHighDateTime) << 32) |
+            attrs.ftLastWriteTime.dwLowDateTime),
+        .hash = 0 };
+
+    if (indexed && indexed->size == fingerprint.size && indexed->last_write_time == fingerprint.last_write_time) {
+        fingerprint.hash = indexed->hash;
+        return fingerprint;
+    }
+
+    wil::unique_hfile file{ ::CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr) };
+    if (!file) {
+        return std::nullopt;
+    }
+
+    // the content is hashed in 64-bit words, the tail of the file is padded with zeros
+    std::vector<uint64_t> buffer(8192);
+    uint64_t hash{ fingerprint.size };
+    for (;;) {
+        DWORD bytes_read{};
+        if (!::ReadFile(file.get(), buffer.data(), static_cast<DWORD>(buffer.size() * sizeof(uint64_t)), &bytes_read, nullptr)) {
+            return std::nullopt;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+
+        auto words{ (bytes_read + sizeof(uint64_t) - 1) / sizeof(uint64_t) };
+        std::memset(reinterpret_cast<std::byte*>(buffer.data()) + bytes_read, 0, words * sizeof(uint64_t) - bytes_read);
+        for (size_t i = 0; i < words; i++) {
+            hash = mix64(hash ^ buffer[i]);
+        }
+    }
+    fingerprint.hash = hash;
+
+    return fingerprint;
+}
+
+std::variant<std::vector<covtable_method>, HRESULT> typelib::parse_methods(ITypeInfo* typeinfo, const TYPEATTR& typeattr,
+    cotype_kind kind, string_pool& names_pool) {
+    using namespace std::literals;
+
+    auto get_type_name = [typeinfo, &names_pool](const TYPEDESC* tdesc) {
+        auto type_name{ get_type_desc(typeinfo, tdesc) };
+        return std::holds_alternative<std::wstring>(type_name) ? names_pool.intern(std::get<std::wstring>(type_name)) :
+            bad_type_name;
+    };
+
+    auto funcdesc_deleter = [typeinfo](FUNCDESC* fd) { typeinfo->ReleaseFuncDesc(fd); };
+
+    std::vector<covtable_method> methods{};
+
+    // TODO: typeattr->cVars for properties in dispinterfaces
+
+    for (int ordinal = 0; ordinal < typeattr.cFuncs; ) {
+        FUNCDESC* p_fd;
+        RETURN_IF_FAILED(typeinfo->GetFuncDesc(ordinal, &p_fd));
+        funcdesc_t fd{ p_fd, funcdesc_deleter };
+
+        if (auto names_v{ get_comethod_names(typeinfo, fd.get()) }; std::holds_alternative<HRESULT>(names_v)) {
+            return std::get<HRESULT>(names_v);
+        } else {
+            auto& names = std::get<std::vector<wil::unique_bstr>>(names_v);
+            assert(names.size() > 0);
+
+            if (ordinal == 0 && names[0].get() == L"QueryInterface"sv) {
+                // skip IUnknown
+                ordinal += 3;
+                continue;
+            }
+            if ((ordinal == 0 || ordinal == 3) && names[0].get() == L"GetTypeInfoCount"sv) {
+                // skip IDispatch
+                ordinal += 4;
+                continue;
+            }
+
+            std::wstring method_name{ names[0].get() };
+            if (fd->invkind & INVOKE_PROPERTYPUTREF) {
+                method_name.insert(0, L"putref_");
+            } else if (fd->invkind & INVOKE_PROPERTYPUT) {
+                method_name.insert(0, L"put_");
+            } else if (fd->invkind & INVOKE_PROPERTYGET) {
+                method_name.insert(0, L"get_");
+            }
+            std::optional<DISPID> dispid = kind == cotype_kind::DispInterface ? std::make_optional(fd->memid) : std::nullopt;
+
+            assert((SHORT)names.size() == fd->cParams + 1);
+
+            method_arg_collection args{};
+            // first parameter is this pointer
+            args.push_back({ L"this", L"void*", 0 });
+
+            for (int param_num = 0; param_num < fd->cParams; param_num++) {
+                auto elem_desc{ fd->lprgelemdescParam + param_num };
+                args.push_back({
+                    names_pool.intern(names[param_num + 1].get()),
+                    get_type_name(&elem_desc->tdesc),
+                    elem_desc->idldesc.wIDLFlags
+                    });
+            }
+
+            std::wstring_view return_type{};
+            auto result_vt{ fd->elemdescFunc.tdesc.vt & 0xFFF };
+            if (kind == cotype_kind::DispInterface && result_vt != VT_HRESULT && result_vt != VT_VOID) {
+                // the return value is passed as an out parameter
+                TYPEDESC tdesc{ .lptdesc = &fd->elemdescFunc.tdesc, .vt = VT_PTR };
+                args.push_back({ L"result", get_type_name(&tdesc), IDLFLAG_FOUT | IDLFLAG_FRETVAL });
+
+                return_type = names_pool.intern(vt_to_string(VT_HRESULT));
+            } else {
+                return_type = get_type_name(&fd->elemdescFunc.tdesc);
+            }
+
+            methods.push_back({
+                comethod{ typeattr.guid, names_pool.intern(method_name), ordinal, fd->callconv, dispid, return_type },
+                std::move(args) });
+
+            // TODO: I'm still missing handling of the optional parameters
+
+            ordinal += 1;
+        }
+    }
+
+    return methods;
+}
+
+std::variant<parsed_typelib, HRESULT> typelib::parse_tlb(std::wstring_view tlb_path, bool with_methods) {
+    wil::com_ptr_t<ITypeLib> typelib{};
+    RETURN_IF_FAILED(::LoadTypeLibEx(tlb_path.data(), REGKIND_NONE, typelib.put()));
+
+    parsed_typelib parsed{ .methods_parsed = with_methods };
+    auto& names_pool{ parsed.names };
+
+    auto types_len = typelib->GetTypeInfoCount();
+    for (UINT type_num = 0; type_num < types_len; type_num++) {
+        wil::com_ptr_t<ITypeInfo> typeinfo{};
+        RETURN_IF_FAILED(typelib->GetTypeInfo(type_num, typeinfo.put()));
+
+        wil::unique_bstr name{};
+        RETURN_IF_FAILED(typeinfo->GetDocumentation(MEMBERID_NIL, name.put(), nullptr, nullptr, nullptr));
+
+        auto typeattr_res{ get_typeinfo_attr(typeinfo.get()) };
+        if (std::holds_alternative<HRESULT>(typeattr_res)) {
+            return std::get<HRESULT>(typeattr_res);
+        }
+
+        auto typeattr{ std::move(std::get<typeattr_t>(typeattr_res)) };
+        switch (typeattr->typekind) {
+        case TKIND_INTERFACE:
+        case TKIND_DISPATCH: {
+            auto kind{ typeattr->typekind == TKIND_INTERFACE ? cotype_kind::Interface : cotype_kind::DispInterface };
+
+            auto parent_iid_v{ get_type_parent_iid(typeinfo.get(), kind, typeattr->cImplTypes) };
+            if (std::holds_alternative<HRESULT>(parent_iid_v)) {
+                return std::get<HRESULT>(parent_iid_v);
+            }
+            auto& parent_iid{ std::get<GUID>(parent_iid_v) };
+
+            parsed.types.push_back({ cotype{ typeattr->guid, names_pool.intern(name.get()), kind, parent_iid, true }, {} });
+
+            if (with_methods) {
+                if (auto methods{ parse_methods(typeinfo.get(), *typeattr, kind, names_pool) }; std::holds_alternative<HRESULT>(methods)) {
+                    return std::get<HRESULT>(methods);
+                } else {
+                    parsed.types.back().methods = std::move(std::get<std::vector<covtable_method>>(methods));
+                }
+            }
+            break;
+        }
+        case TKIND_COCLASS: {
+            parsed.classes.push_back({ typeattr->guid, names_pool.intern(name.get()) });
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    return parsed;
+}
+
+std::variant<std::vector<covtable_method>, HRESULT> typelib::parse_type_methods(std::wstring_view tlb_path, const IID& iid, string_pool& names) {
+    wil::com_ptr_t<ITypeLib> typelib{};
+    RETURN_IF_FAILED(::LoadTypeLibEx(tlb_path.data(), REGKIND_NONE, typelib.put()));
+
+    wil::com_ptr_t<ITypeInfo> typeinfo{};
+    RETURN_IF_FAILED(typelib->GetTypeInfoOfGuid(iid, typeinfo.put()));
+
+    auto typeattr_res{ get_typeinfo_attr(typeinfo.get()) };
+    if (std::holds_alternative<HRESULT>(typeattr_res)) {
+        return std::get<HRESULT>(typeattr_res);
+    }
+
+    auto& typeattr{ std::get<typeattr_t>(typeattr_res) };
+    if (typeattr->typekind != TKIND_INTERFACE && typeattr->typekind != TKIND_DISPATCH) {
+        return TYPE_E_WRONGTYPEKIND;
+    }
+    return parse_methods(typeinfo.get(), *typeattr, typeattr->typekind == TKIND_INTERFACE ? cotype_kind::Interface : cotype_kind::DispInterface, names);
+}
+
 std::variant<typelib::typeattr_t, HRESULT> typelib::get_typeinfo_attr(ITypeInfo* typeinfo) {
     auto typeattr_deleter = [typeinfo](TYPEATTR* ta) { typeinfo->ReleaseTypeAttr(ta); };
 
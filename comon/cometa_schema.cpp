@@ -0,0 +1,255 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <array>
+#include <chrono>
+#include <format>
+#include <stdexcept>
+#include <string>
+
+#include <SQLiteCpp/Statement.h>
+#include <SQLiteCpp/Transaction.h>
+
+#include "cometa_schema.h"
+#include "cometa_signature.h"
+
+using namespace comon_ext;
+
+namespace
+{
+int64_t count_rows(SQLite::Database& db, const std::string& query) {
+    return db.execAndGet(query).getInt64();
+}
+
+/*
+ * Each step upgrades the schema from its version to the next one, keeping the existing rows. The new
+ * databases run all the steps too, so an upgraded database always ends with the same schema as a new one.
+*/
+constexpr std::array schema_migrations{
+    schema_migration{ 5, L"type library fingerprints and GUID owners", [](SQLite::Database& db) {
+        db.exec(R"(create table typelibs (
+path text primary key,
+registered int not null,
+size integer not null,
+last_write_time integer not null,
+hash integer not null) without rowid)");
+
+        db.exec(R"(create table typelib_guids (
+path text not null,
+guid blob not null,
+primary key (path, guid)) without rowid;
+create index IX_typelib_guids_guid on typelib_guids (guid))");
+
+        // the fundamental types belong to a built-in library (with an empty path), so removing a type library
+        // that redefines them never deletes them
+        SQLite::Statement stmt{ db, "insert into typelib_guids (path, guid) values ('', :guid)" };
+        for (const auto& iid : { __uuidof(IUnknown), __uuidof(IDispatch) }) {
+            stmt.bind(":guid", &iid, sizeof(GUID));
+            stmt.exec();
+            stmt.reset();
+        }
+
+        // the types indexed before have no owners, so the next index parses all the type libraries again
+    } },
+    schema_migration{ 6, L"packed method signatures", [](SQLite::Database& db) {
+        db.exec(R"(create table cotype_signatures (
+iid blob primary key,
+signature blob not null) without rowid)");
+
+        auto guid_of = [](const SQLite::Column& column) { return *reinterpret_cast<const GUID*>(column.getBlob()); };
+
+        string_pool names{};
+        flat_hash_map<IID, std::vector<covtable_method>> signatures{};
+
+        SQLite::Statement methods{ db, "select iid,name,ordinal,callconv,dispid,return_type from cotype_methods order by iid, ordinal" };
+        while (methods.executeStep()) {
+            auto iid{ guid_of(methods.getColumn(0)) };
+            auto dispid_column{ methods.getColumn(4) };
+            signatures[iid].push_back({ .method = {
+                .iid = iid,
+                .name = names.intern_utf8(methods.getColumn(1).getText()),
+                .ordinal = methods.getColumn(2).getInt(),
+                .callconv = static_cast<CALLCONV>(methods.getColumn(3).getInt()),
+                .dispid = !dispid_column.isNull() ? std::optional<DISPID>{ dispid_column.getInt() } : std::nullopt,
+                .return_type = names.intern_utf8(methods.getColumn(5).getText()) } });
+        }
+
+        SQLite::Statement args{ db, "select iid,method_ordinal,name,type,flags from cotype_method_args order by iid, method_ordinal, ordinal" };
+        while (args.executeStep()) {
+            auto iid_methods{ signatures.find(guid_of(args.getColumn(0))) };
+            if (iid_methods == std::end(signatures)) {
+                continue;
+            }
+            auto method_ordinal{ args.getColumn(1).getInt() };
+            if (auto m{ std::ranges::lower_bound(iid_methods->second, method_ordinal, {}, [](const covtable_method& m) { return m.method.ordinal; }) };
+                m != std::end(iid_methods->second) && m->method.ordinal == method_ordinal) {
+                m->args.push_back({
+                    .name = names.intern_utf8(args.getColumn(2).getText()),
+                    .type = names.intern_utf8(args.getColumn(3).getText()),
+                    .flags = static_cast<USHORT>(args.getColumn(4).getUInt()) });
+            }
+        }
+
+        SQLite::Statement insert{ db, "insert into cotype_signatures (iid, signature) values (:iid, :signature)" };
+        for (const auto& [iid, iid_methods] : signatures) {
+            auto blob{ signature::encode(iid_methods) };
+            insert.bind(":iid", &iid, sizeof(GUID));
+            insert.bind(":signature", blob.data(), static_cast<int>(blob.size()));
+            insert.exec();
+            insert.reset();
+        }
+
+        db.exec("drop table cotype_method_args; drop table cotype_methods");
+    } },
+    schema_migration{ 7, L"covering index of module vtables", [](SQLite::Database& db) {
+        // the primary key columns (clsid, iid) are part of each index entry, so the index covers the module queries
+        db.exec(R"(drop index IX_vtables_module_name;
+create index IX_vtables_module on vtables (module_name, module_timestamp, vtable))");
+    } },
+    schema_migration{ 8, L"architecture of vtables", [](SQLite::Database& db) {
+        // There was a database for each architecture, so the rows of an upgraded one have no known
+        // architecture (0). Merging the database into the shared one assigns it. Both indexes cover
+        // their queries, as otherwise the planner prefers a covering index that matches only the arch.
+        db.exec(R"(create table vtables_arch (
+arch integer not null,
+clsid blob not null,
+iid blob not null,
+module_name text not null,
+module_timestamp integer not null,
+vtable integer not null,
+primary key (arch, clsid, iid)) without rowid;
+insert into vtables_arch (arch, clsid, iid, module_name, module_timestamp, vtable)
+select 0, clsid, iid, module_name, module_timestamp, vtable from vtables;
+drop table vtables;
+alter table vtables_arch rename to vtables;
+create index IX_vtables_iid on vtables (arch, iid, module_name, vtable);
+create index IX_vtables_module on vtables (arch, module_name, module_timestamp, vtable))");
+    } },
+    schema_migration{ 9, L"base database of the layered metadata", [](SQLite::Database& db) {
+        // at most one row; a size of -1 means the base database was missing when the session opened
+        db.exec(R"(create table base_database (
+path text not null,
+size integer not null,
+last_write_time integer not null))");
+    } },
+    schema_migration{ 10, L"type libraries of the base database removed in the overlay", [](SQLite::Database& db) {
+        db.exec(R"(create table base_tombstones (
+path text primary key) without rowid)");
+    } },
+    schema_migration{ 11, L"architecture of type libraries and method signatures", [](SQLite::Database& db) {
+        // The win32 and win64 files of a type library describe the pointer-sized types differently, so each
+        // keeps its architecture. The libraries and signatures indexed before are for any architecture (0).
+        db.exec(R"(alter table typelibs add column arch integer not null default 0;
+create table cotype_signatures_arch (
+iid blob not null,
+arch integer not null,
+signature blob not null,
+primary key (iid, arch)) without rowid;
+insert into cotype_signatures_arch (iid, arch, signature) select iid, 0, signature from cotype_signatures;
+drop table cotype_signatures;
+alter table cotype_signatures_arch rename to cotype_signatures)");
+    } },
+};
+
+static_assert(schema_migrations.front().from_version == base_schema_version);
+static_assert(schema_migrations.back().from_version + 1 == schema_version);
+}
+
+std::span<const schema_migration> comon_ext::get_schema_migrations() {
+    return schema_migrations;
+}
+
+void comon_ext::create_base_schema(SQLite::Database& db) {
+    db.exec(R"(create table schema_version (version integer not null);)");
+    db.exec(std::format("insert into schema_version (version) values({})", base_schema_version));
+
+    db.exec(R"(create table cotypes (
+iid blob primary key, 
+type integer not null,
+name text not null,
+parent_iid blob not null,
+methods_available int not null) without rowid)");
+
+    db.exec(R"(create table cotype_methods (
+iid blob not null,
+ordinal integer not null,
+name text not null,
+callconv integer not null,
+dispid integer null,
+return_type text not null,
+primary key (iid, ordinal)) without rowid)");
+
+    db.exec(R"(create table cotype_method_args (
+iid blob not null,
+method_ordinal integer not null,
+name text not null,
+ordinal integer not null,
+type text not null,
+flags int not null,
+primary key (iid, method_ordinal, ordinal)) without rowid)");
+
+    db.exec(R"(create table coclasses (
+clsid blob primary key, 
+name text not null
+) without rowid)");
+
+    db.exec(R"(create table vtables (
+clsid blob not null, 
+iid blob not null,
+module_name text not null,
+module_timestamp integer not null,
+vtable integer not null,
+primary key (clsid, iid)) without rowid;
+create index IX_vtables_iid on vtables (iid);
+create index IX_vtables_module_name on vtables (module_name))");
+}
+
+void comon_ext::upgrade_schema(SQLite::Database& db, int from_version, const dbgeng_logger* log) {
+    using namespace std::chrono;
+
+    SQLite::Transaction transaction{ db };
+
+    auto upgrade_start{ steady_clock::now() };
+    for (const auto& migration : schema_migrations) {
+        if (migration.from_version < from_version) {
+            continue;
+        }
+
+        auto step_start{ steady_clock::now() };
+        migration.upgrade(db);
+
+        if (log) {
+            log->log_info(std::format(L"  {} -> {} ({}): {} ms", migration.from_version, migration.from_version + 1,
+                migration.description, duration_cast<milliseconds>(steady_clock::now() - step_start).count()));
+        }
+    }
+    db.exec(std::format("update schema_version set version = {}", schema_version));
+
+    // a database without a single row of the new version would be upgraded again (or rejected) when opened next time
+    if (count_rows(db, "select count(*) from schema_version") != 1 ||
+        count_rows(db, std::format("select count(*) from schema_version where version = {}", schema_version)) != 1) {
+        throw std::runtime_error{ "the upgraded database has an incorrect schema version" };
+    }
+
+    transaction.commit();
+
+    if (log) {
+        log->log_info(std::format(L"Schema upgraded in {} ms, kept {} vtables, {} types, {} method signatures, and {} classes.",
+            duration_cast<milliseconds>(steady_clock::now() - upgrade_start).count(), count_rows(db, "select count(*) from vtables"),
+            count_rows(db, "select count(*) from cotypes"), count_rows(db, "select count(*) from cotype_signatures"),
+            count_rows(db, "select count(*) from coclasses")));
+    }
+}
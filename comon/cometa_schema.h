@@ -0,0 +1,49 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <span>
+#include <string_view>
+
+#include <SQLiteCpp/Database.h>
+
+#include "comon.h"
+
+namespace comon_ext
+{
+// increment whenever the database schema changes, and add the step that upgrades the previous version
+constexpr int schema_version{ 12 };
+
+// the oldest schema that can be upgraded, the new databases start from it too
+constexpr int base_schema_version{ 5 };
+
+struct schema_migration
+{
+    int from_version;
+    std::wstring_view description;
+    void (*upgrade)(SQLite::Database& db);
+};
+
+// the upgrade steps in the order of their versions, from base_schema_version to schema_version - 1
+std::span<const schema_migration> get_schema_migrations();
+
+// the tables of the oldest schema, which upgrade_schema brings to the current one
+void create_base_schema(SQLite::Database& db);
+
+// runs the upgrade steps in a single transaction, so a failed step leaves the database untouched
+void upgrade_schema(SQLite::Database& db, int from_version, const dbgeng_logger* log);
+}
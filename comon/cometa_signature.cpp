@@ -0,0 +1,236 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string>
+
+#include <wil/result.h>
+
+#include "cometa_signature.h"
+
+using namespace comon_ext;
+
+namespace
+{
+class blob_writer
+{
+    std::vector<std::byte> _bytes{};
+
+public:
+    void write(uint64_t value) {
+        do {
+            auto b{ static_cast<uint8_t>(value & 0x7f) };
+            value >>= 7;
+            _bytes.push_back(static_cast<std::byte>(value != 0 ? b | 0x80 : b));
+        } while (value != 0);
+    }
+
+    void write_signed(int64_t value) {
+        write((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    void write(std::string_view s) {
+        write(s.size());
+        auto p{ reinterpret_cast<const std::byte*>(s.data()) };
+        _bytes.insert(std::end(_bytes), p, p + s.size());
+    }
+
+    std::vector<std::byte> release() { return std::move(_bytes); }
+};
+
+// all the reads are bounds-checked, as the blob comes from a database file that might be damaged
+class blob_reader
+{
+    std::span<const std::byte> _bytes;
+    size_t _offset{};
+
+public:
+    explicit blob_reader(std::span<const std::byte> bytes) : _bytes{ bytes } {}
+
+    bool read(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && _offset < _bytes.size(); shift += 7) {
+            auto b{ static_cast<uint8_t>(_bytes[_offset++]) };
+            value |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool read_signed(int64_t& value) {
+        uint64_t v{};
+        if (!read(v)) {
+            return false;
+        }
+        value = static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+        return true;
+    }
+
+    bool read(std::string_view& s) {
+        uint64_t len{};
+        if (!read(len) || len > _bytes.size() - _offset) {
+            return false;
+        }
+        s = { reinterpret_cast<const char*>(_bytes.data() + _offset), static_cast<size_t>(len) };
+        _offset += static_cast<size_t>(len);
+        return true;
+    }
+
+    bool at_end() const { return _offset == _bytes.size(); }
+};
+
+// keeps the order of first use, so the encoding of the same methods is always the same
+class string_table
+{
+    flat_hash_map<std::wstring_view, uint32_t> _ids{};
+    std::vector<std::wstring_view> _strings{};
+
+public:
+    uint32_t id_of(std::wstring_view s) {
+        auto [iter, inserted] { _ids.try_emplace(s, static_cast<uint32_t>(_strings.size())) };
+        if (inserted) {
+            _strings.push_back(s);
+        }
+        return iter->second;
+    }
+
+    const std::vector<std::wstring_view>& strings() const { return _strings; }
+};
+}
+
+std::vector<std::byte> signature::encode(std::span<const covtable_method> methods) {
+    string_table strings{};
+    for (const auto& [method, args] : methods) {
+        strings.id_of(method.name);
+        strings.id_of(method.return_type);
+        for (const auto& arg : args) {
+            strings.id_of(arg.name);
+            strings.id_of(arg.type);
+        }
+    }
+
+    blob_writer writer{};
+    writer.write(format_version);
+
+    writer.write(strings.strings().size());
+    for (auto s : strings.strings()) {
+        writer.write(to_utf8(s));
+    }
+
+    writer.write(methods.size());
+    for (const auto& [method, args] : methods) {
+        writer.write(strings.id_of(method.name));
+        writer.write(static_cast<uint32_t>(method.ordinal));
+        writer.write(static_cast<uint32_t>(method.callconv));
+        writer.write(method.dispid ? 1 : 0);
+        if (method.dispid) {
+            writer.write_signed(*method.dispid);
+        }
+        writer.write(strings.id_of(method.return_type));
+
+        writer.write(args.size());
+        for (const auto& arg : args) {
+            writer.write(strings.id_of(arg.name));
+            writer.write(strings.id_of(arg.type));
+            writer.write(arg.flags);
+        }
+    }
+
+    return writer.release();
+}
+
+std::variant<std::vector<covtable_method>, HRESULT> signature::decode(std::span<const std::byte> blob, const IID& iid, string_pool& names) {
+    const HRESULT invalid_data{ HRESULT_FROM_WIN32(ERROR_INVALID_DATA) };
+
+    blob_reader reader{ blob };
+
+    uint64_t version{};
+    if (!reader.read(version) || version != format_version) {
+        return invalid_data;
+    }
+
+    // each count is checked against the blob size, so a damaged count cannot cause a huge allocation
+    auto read_count = [&reader, &blob](uint64_t& count) { return reader.read(count) && count <= blob.size(); };
+
+    uint64_t strings_count{};
+    if (!read_count(strings_count)) {
+        return invalid_data;
+    }
+
+    std::vector<std::wstring_view> strings(static_cast<size_t>(strings_count));
+    for (auto& s : strings) {
+        std::string_view s_utf8{};
+        if (!reader.read(s_utf8)) {
+            return invalid_data;
+        }
+        s = names.intern_utf8(s_utf8);
+    }
+
+    auto read_string = [&reader, &strings](std::wstring_view& s) {
+        uint64_t id{};
+        if (!reader.read(id) || id >= strings.size()) {
+            return false;
+        }
+        s = strings[static_cast<size_t>(id)];
+        return true;
+    };
+
+    uint64_t methods_count{};
+    if (!read_count(methods_count)) {
+        return invalid_data;
+    }
+
+    std::vector<covtable_method> methods{};
+    methods.reserve(static_cast<size_t>(methods_count));
+    for (uint64_t i = 0; i < methods_count; i++) {
+        auto& [method, args] { methods.emplace_back() };
+        method.iid = iid;
+
+        uint64_t ordinal{}, callconv{}, has_dispid{}, args_count{};
+        if (!read_string(method.name) || !reader.read(ordinal) || !reader.read(callconv) || !reader.read(has_dispid)) {
+            return invalid_data;
+        }
+        method.ordinal = static_cast<int>(ordinal);
+        method.callconv = static_cast<CALLCONV>(callconv);
+
+        if (has_dispid != 0) {
+            int64_t dispid{};
+            if (!reader.read_signed(dispid)) {
+                return invalid_data;
+            }
+            method.dispid = static_cast<DISPID>(dispid);
+        }
+
+        if (!read_string(method.return_type) || !read_count(args_count)) {
+            return invalid_data;
+        }
+
+        args.resize(static_cast<size_t>(args_count));
+        for (auto& arg : args) {
+            uint64_t flags{};
+            if (!read_string(arg.name) || !read_string(arg.type) || !reader.read(flags)) {
+                return invalid_data;
+            }
+            arg.flags = static_cast<USHORT>(flags);
+        }
+    }
+
+    if (!reader.at_end()) {
+        return invalid_data;
+    }
+    return methods;
+}
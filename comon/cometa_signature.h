@@ -0,0 +1,47 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <variant>
+#include <vector>
+
+#include "cometa.h"
+#include "string_pool.h"
+
+namespace comon_ext::signature
+{
+/*
+ * Compact encoding of all the methods of an interface, stored as a single blob per IID. All the
+ * integers are LEB128 varints (the DISPIDs are zigzag-encoded, as many of them are negative). Names
+ * and types are UTF-8 strings stored once in a table at the start of the blob, and the methods and
+ * args refer to them by index:
+ *
+ *   version, string count, strings (byte length + bytes),
+ *   method count, methods (name, ordinal, callconv, has dispid, [dispid], return type, arg count,
+ *   args (name, type, flags))
+*/
+
+constexpr uint32_t format_version{ 1 };
+
+std::vector<std::byte> encode(std::span<const covtable_method> methods);
+
+// the decoded names are interned in the pool, the methods get the provided IID
+std::variant<std::vector<covtable_method>, HRESULT> decode(std::span<const std::byte> blob, const IID& iid, string_pool& names);
+
+}
@@ -0,0 +1,317 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+
+#include <Windows.h>
+#include <wil/resource.h>
+
+#include "cometa_snapshot.h"
+
+using namespace comon_ext;
+namespace sf = comon_ext::snapshot_format;
+
+namespace {
+
+constexpr size_t npos{ std::numeric_limits<size_t>::max() };
+
+// any strict order works, as long as the builder and the lookups use the same one
+bool guid_less(const GUID& a, const GUID& b) {
+    std::array<uint64_t, 2> a_words{}, b_words{};
+    std::memcpy(a_words.data(), &a, sizeof(GUID));
+    std::memcpy(b_words.data(), &b, sizeof(GUID));
+    return a_words < b_words;
+}
+
+// lays out the sorted items as an implicit search tree: the node k (1-based) is stored at k - 1
+std::vector<uint32_t> eytzinger_order(const std::vector<uint32_t>& sorted) {
+    std::vector<uint32_t> order(sorted.size());
+    size_t next{};
+    auto fill = [&sorted, &order, &next](auto& self, size_t k) -> void {
+        if (k <= sorted.size()) {
+            self(self, 2 * k);
+            order[k - 1] = sorted[next++];
+            self(self, 2 * k + 1);
+        }
+    };
+    fill(fill, 1);
+    return order;
+}
+
+size_t eytzinger_find(std::span<const GUID> keys, const GUID& key) {
+    size_t k{ 1 };
+    while (k <= keys.size()) {
+        k = 2 * k + (guid_less(keys[k - 1], key) ? 1 : 0);
+    }
+    // cancels the right turns taken after the last left turn, which leaves us at the lower bound
+    k >>= std::countr_one(k) + 1;
+    return k != 0 && keys[k - 1] == key ? k - 1 : npos;
+}
+
+template<typename T>
+bool read_section(std::span<const std::byte> data, const sf::section& section, std::span<const T>& out) {
+    if (section.offset % alignof(T) != 0 || section.offset > data.size() ||
+        section.count > (data.size() - section.offset) / sizeof(T)) {
+        return false;
+    }
+    out = { reinterpret_cast<const T*>(data.data() + section.offset), section.count };
+    return true;
+}
+
+template<typename T>
+bool is_valid_range(std::span<const T> items, uint32_t first, uint32_t count) {
+    return static_cast<uint64_t>(first) + count <= items.size();
+}
+
+}
+
+/* *** SNAPSHOT BUILDER *** */
+
+sf::string_ref snapshot_builder::add_string(std::wstring_view s) {
+    if (auto iter{ _string_refs.find(s) }; iter != std::end(_string_refs)) {
+        return iter->second;
+    }
+
+    sf::string_ref ref{ static_cast<uint32_t>(_strings.size()), static_cast<uint32_t>(s.size()) };
+    _strings.insert(std::end(_strings), std::cbegin(s), std::cend(s));
+    _string_refs.try_emplace(_string_pool.intern(s), ref);
+    return ref;
+}
+
+void snapshot_builder::add_type(const GUID& iid, std::wstring_view name, uint32_t kind, const GUID& parent_iid, bool methods_available) {
+    if (_type_indexes.contains(iid)) {
+        return;
+    }
+
+    _type_indexes.try_emplace(iid, static_cast<uint32_t>(_types.size()));
+    _types.push_back({ iid, { .parent_iid = parent_iid, .name = add_string(name), .kind = kind,
+        .methods_available = methods_available ? 1u : 0u, .first_method = 0, .method_count = 0 } });
+}
+
+void snapshot_builder::add_method(const GUID& iid, std::wstring_view name, int32_t ordinal, uint32_t callconv,
+    std::optional<int32_t> dispid, std::wstring_view return_type) {
+    auto type_index{ _type_indexes.find(iid) };
+    if (type_index == std::end(_type_indexes)) {
+        return;
+    }
+
+    auto& type{ _types[type_index->second].record };
+    if (type.method_count == 0) {
+        type.first_method = static_cast<uint32_t>(_methods.size());
+    } else if (type.first_method + type.method_count != _methods.size()) {
+        // the methods of a type must form a contiguous range
+        return;
+    }
+
+    _methods.push_back({ .name = add_string(name), .return_type = add_string(return_type), .ordinal = ordinal,
+        .callconv = callconv, .dispid = dispid.value_or(0), .has_dispid = dispid ? 1u : 0u, .first_arg = 0, .arg_count = 0 });
+    type.method_count++;
+}
+
+void snapshot_builder::add_method_arg(const GUID& iid, int32_t method_ordinal, std::wstring_view name, std::wstring_view type, uint32_t flags) {
+    auto type_index{ _type_indexes.find(iid) };
+    if (type_index == std::end(_type_indexes)) {
+        return;
+    }
+
+    auto& type_record{ _types[type_index->second].record };
+    std::span methods{ _methods.data() + type_record.first_method, type_record.method_count };
+    auto method{ std::ranges::lower_bound(methods, method_ordinal, {}, &sf::method_record::ordinal) };
+    if (method == std::end(methods) || method->ordinal != method_ordinal) {
+        return;
+    }
+
+    if (method->arg_count == 0) {
+        method->first_arg = static_cast<uint32_t>(_args.size());
+    } else if (method->first_arg + method->arg_count != _args.size()) {
+        return;
+    }
+
+    _args.push_back({ .name = add_string(name), .type = add_string(type), .flags = flags });
+    method->arg_count++;
+}
+
+void snapshot_builder::add_class(const GUID& clsid, std::wstring_view name) {
+    _classes.push_back({ clsid, { .name = add_string(name) } });
+}
+
+std::vector<std::byte> snapshot_builder::build(uint32_t schema_version, uint32_t revision) const {
+    auto sorted_indexes = [](size_t count, auto key_of) {
+        std::vector<uint32_t> indexes(count);
+        std::iota(std::begin(indexes), std::end(indexes), 0u);
+        std::ranges::sort(indexes, guid_less, key_of);
+        return indexes;
+    };
+
+    auto type_order{ eytzinger_order(sorted_indexes(_types.size(), [this](uint32_t i) -> const GUID& { return _types[i].iid; })) };
+    auto class_order{ eytzinger_order(sorted_indexes(_classes.size(), [this](uint32_t i) -> const GUID& { return _classes[i].first; })) };
+
+    std::vector<std::byte> bytes(sizeof(sf::header));
+
+    auto append = [&bytes](const void* items, size_t count, size_t item_size) {
+        bytes.resize((bytes.size() + 7) & ~size_t{ 7 });
+        sf::section section{ static_cast<uint32_t>(bytes.size()), static_cast<uint32_t>(count) };
+        auto data{ static_cast<const std::byte*>(items) };
+        bytes.insert(std::end(bytes), data, data + count * item_size);
+        return section;
+    };
+
+    auto append_ordered = [&append](const std::vector<uint32_t>& order, auto item_of) {
+        using item_t = std::remove_cvref_t<decltype(item_of(0u))>;
+        std::vector<item_t> items{};
+        items.reserve(order.size());
+        for (auto i : order) {
+            items.push_back(item_of(i));
+        }
+        return append(items.data(), items.size(), sizeof(item_t));
+    };
+
+    sf::header header{};
+    header.magic = sf::magic;
+    header.version = sf::version;
+    header.schema_version = schema_version;
+    header.revision = revision;
+    header.type_keys = append_ordered(type_order, [this](uint32_t i) { return _types[i].iid; });
+    header.types = append_ordered(type_order, [this](uint32_t i) { return _types[i].record; });
+    header.methods = append(_methods.data(), _methods.size(), sizeof(sf::method_record));
+    header.args = append(_args.data(), _args.size(), sizeof(sf::arg_record));
+    header.class_keys = append_ordered(class_order, [this](uint32_t i) { return _classes[i].first; });
+    header.classes = append_ordered(class_order, [this](uint32_t i) { return _classes[i].second; });
+    header.strings = append(_strings.data(), _strings.size(), sizeof(wchar_t));
+
+    if (bytes.size() > std::numeric_limits<uint32_t>::max()) {
+        return {};
+    }
+    header.file_size = static_cast<uint32_t>(bytes.size());
+    std::memcpy(bytes.data(), &header, sizeof(header));
+
+    return bytes;
+}
+
+HRESULT snapshot_builder::write(const fs::path& path, uint32_t schema_version, uint32_t revision) const {
+    auto bytes{ build(schema_version, revision) };
+    if (bytes.empty()) {
+        return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+
+    auto tmp_path{ fs::path{ path } += L".tmp" };
+    {
+        std::ofstream file{ tmp_path, std::ios::binary | std::ios::trunc };
+        file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (file.close(); file.fail()) {
+            std::error_code ec{};
+            fs::remove(tmp_path, ec);
+            return HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+        }
+    }
+
+    // the rename fails if another session has the previous snapshot mapped
+    std::error_code ec{};
+    fs::rename(tmp_path, path, ec);
+    if (ec) {
+        auto hr{ HRESULT_FROM_WIN32(static_cast<DWORD>(ec.value())) };
+        fs::remove(tmp_path, ec);
+        return hr;
+    }
+    return S_OK;
+}
+
+/* *** METADATA SNAPSHOT *** */
+
+std::variant<std::unique_ptr<metadata_snapshot>, HRESULT> metadata_snapshot::open(const fs::path& path,
+    uint32_t schema_version, uint32_t revision) {
+    wil::unique_hfile file{ ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr) };
+    if (!file) {
+        return HRESULT_FROM_WIN32(::GetLastError());
+    }
+
+    LARGE_INTEGER size{};
+    if (!::GetFileSizeEx(file.get(), &size)) {
+        return HRESULT_FROM_WIN32(::GetLastError());
+    }
+    if (size.QuadPart < static_cast<LONGLONG>(sizeof(sf::header)) || size.QuadPart > std::numeric_limits<uint32_t>::max()) {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    // the view keeps the mapping alive, so we can close both handles once it is mapped
+    wil::unique_handle mapping{ ::CreateFileMappingW(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr) };
+    if (!mapping) {
+        return HRESULT_FROM_WIN32(::GetLastError());
+    }
+
+    wil::unique_mapview_ptr<void> view{ ::MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0) };
+    if (!view) {
+        return HRESULT_FROM_WIN32(::GetLastError());
+    }
+
+    std::span data{ static_cast<const std::byte*>(view.get()), static_cast<size_t>(size.QuadPart) };
+    std::unique_ptr<metadata_snapshot> snapshot{ new metadata_snapshot{ std::move(view), data } };
+    if (!snapshot->load_sections(schema_version, revision)) {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+    return snapshot;
+}
+
+bool metadata_snapshot::load_sections(uint32_t schema_version, uint32_t revision) {
+    sf::header header{};
+    std::memcpy(&header, _data.data(), sizeof(header));
+
+    if (header.magic != sf::magic || header.version != sf::version || header.schema_version != schema_version ||
+        header.revision != revision || header.file_size != _data.size()) {
+        return false;
+    }
+
+    std::span<const wchar_t> strings{};
+    if (!read_section(_data, header.type_keys, _type_keys) || !read_section(_data, header.types, _types) ||
+        !read_section(_data, header.methods, _methods) || !read_section(_data, header.args, _args) ||
+        !read_section(_data, header.class_keys, _class_keys) || !read_section(_data, header.classes, _classes) ||
+        !read_section(_data, header.strings, strings)) {
+        return false;
+    }
+    _strings = { strings.data(), strings.size() };
+
+    return _type_keys.size() == _types.size() && _class_keys.size() == _classes.size();
+}
+
+const sf::type_record* metadata_snapshot::find_type(const IID& iid) const {
+    auto index{ eytzinger_find(_type_keys, iid) };
+    return index != npos ? &_types[index] : nullptr;
+}
+
+const sf::class_record* metadata_snapshot::find_class(const CLSID& clsid) const {
+    auto index{ eytzinger_find(_class_keys, clsid) };
+    return index != npos ? &_classes[index] : nullptr;
+}
+
+std::span<const sf::method_record> metadata_snapshot::methods_of(const sf::type_record& type) const {
+    return is_valid_range(_methods, type.first_method, type.method_count) ?
+        _methods.subspan(type.first_method, type.method_count) : std::span<const sf::method_record>{};
+}
+
+std::span<const sf::arg_record> metadata_snapshot::args_of(const sf::method_record& method) const {
+    return is_valid_range(_args, method.first_arg, method.arg_count) ?
+        _args.subspan(method.first_arg, method.arg_count) : std::span<const sf::arg_record>{};
+}
+
+std::wstring_view metadata_snapshot::text(sf::string_ref ref) const {
+    return is_valid_range(std::span{ _strings }, ref.offset, ref.length) ? _strings.substr(ref.offset, ref.length) : std::wstring_view{};
+}
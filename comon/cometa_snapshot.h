@@ -0,0 +1,201 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include <Windows.h>
+#include <wil/resource.h>
+
+#include "comon.h"
+#include "string_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace comon_ext
+{
+/*
+ * On-disk layout of the metadata snapshot. All the sections are arrays of fixed-size records,
+ * aligned to 8 bytes. The GUID keys of types and classes are stored in the Eytzinger order
+ * (the children of the key k - 1 are at 2k - 1 and 2k), and the record at the same index
+ * describes the key. The methods of a type and the arguments of a method are contiguous
+ * ranges, ordered by their ordinals. Names are UTF-16 ranges of a shared string table.
+*/
+namespace snapshot_format
+{
+constexpr uint32_t magic{ 0x4e534d43 }; // "CMSN"
+constexpr uint32_t version{ 1 };
+
+struct string_ref
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct type_record
+{
+    GUID parent_iid;
+    string_ref name;
+    uint32_t kind;
+    uint32_t methods_available;
+    uint32_t first_method;
+    uint32_t method_count;
+};
+
+struct method_record
+{
+    string_ref name;
+    string_ref return_type;
+    int32_t ordinal;
+    uint32_t callconv;
+    int32_t dispid;
+    uint32_t has_dispid;
+    uint32_t first_arg;
+    uint32_t arg_count;
+};
+
+struct arg_record
+{
+    string_ref name;
+    string_ref type;
+    uint32_t flags;
+};
+
+struct class_record
+{
+    string_ref name;
+};
+
+struct section
+{
+    uint32_t offset;
+    uint32_t count;
+};
+
+struct header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t schema_version;
+    uint32_t revision;
+    section type_keys;
+    section types;
+    section methods;
+    section args;
+    section class_keys;
+    section classes;
+    section strings;
+    uint32_t file_size;
+};
+
+static_assert(sizeof(type_record) == 40 && sizeof(method_record) == 40 && sizeof(arg_record) == 20);
+}
+
+/*
+ * Collects the metadata rows exported from the database and writes them as a snapshot file.
+ * The methods must be added in the (iid, ordinal) order and the arguments in the
+ * (iid, method_ordinal, ordinal) order, after the types they belong to.
+*/
+class snapshot_builder
+{
+    struct type_entry
+    {
+        GUID iid;
+        snapshot_format::type_record record;
+    };
+
+    std::vector<type_entry> _types{};
+    flat_hash_map<GUID, uint32_t> _type_indexes{};
+    std::vector<snapshot_format::method_record> _methods{};
+    std::vector<snapshot_format::arg_record> _args{};
+    std::vector<std::pair<GUID, snapshot_format::class_record>> _classes{};
+
+    string_pool _string_pool{};
+    flat_hash_map<std::wstring_view, snapshot_format::string_ref> _string_refs{};
+    std::vector<wchar_t> _strings{};
+
+    snapshot_format::string_ref add_string(std::wstring_view s);
+
+public:
+    void add_type(const GUID& iid, std::wstring_view name, uint32_t kind, const GUID& parent_iid, bool methods_available);
+
+    void add_method(const GUID& iid, std::wstring_view name, int32_t ordinal, uint32_t callconv,
+        std::optional<int32_t> dispid, std::wstring_view return_type);
+
+    void add_method_arg(const GUID& iid, int32_t method_ordinal, std::wstring_view name, std::wstring_view type, uint32_t flags);
+
+    void add_class(const GUID& clsid, std::wstring_view name);
+
+    std::vector<std::byte> build(uint32_t schema_version, uint32_t revision) const;
+
+    // writes the snapshot to a temporary file first, so a failed write does not leave a torn file behind
+    HRESULT write(const fs::path& path, uint32_t schema_version, uint32_t revision) const;
+};
+
+/*
+ * Read-only metadata snapshot mapped into memory. Opening it only validates the header, and
+ * a lookup is a branch-free descent of the Eytzinger-ordered keys, where the first levels
+ * of the tree share a few cache lines. The ranges read from the records are checked, so
+ * a damaged file yields empty results instead of reads outside the mapping.
+*/
+class metadata_snapshot
+{
+    wil::unique_mapview_ptr<void> _view;
+    std::span<const std::byte> _data;
+
+    std::span<const GUID> _type_keys{};
+    std::span<const snapshot_format::type_record> _types{};
+    std::span<const snapshot_format::method_record> _methods{};
+    std::span<const snapshot_format::arg_record> _args{};
+    std::span<const GUID> _class_keys{};
+    std::span<const snapshot_format::class_record> _classes{};
+    std::wstring_view _strings{};
+
+    metadata_snapshot(wil::unique_mapview_ptr<void> view, std::span<const std::byte> data): _view{ std::move(view) }, _data{ data } {}
+
+    bool load_sections(uint32_t schema_version, uint32_t revision);
+
+public:
+    // fails with HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) if the file is missing and with
+    // HRESULT_FROM_WIN32(ERROR_INVALID_DATA) if it is damaged or does not match the database
+    static std::variant<std::unique_ptr<metadata_snapshot>, HRESULT> open(const fs::path& path,
+        uint32_t schema_version, uint32_t revision);
+
+    const snapshot_format::type_record* find_type(const IID& iid) const;
+
+    const snapshot_format::class_record* find_class(const CLSID& clsid) const;
+
+    std::span<const snapshot_format::method_record> methods_of(const snapshot_format::type_record& type) const;
+
+    std::span<const snapshot_format::arg_record> args_of(const snapshot_format::method_record& method) const;
+
+    std::wstring_view text(snapshot_format::string_ref ref) const;
+
+    size_t type_count() const { return _types.size(); }
+
+    size_t class_count() const { return _classes.size(); }
+
+    size_t size_bytes() const { return _data.size(); }
+};
+}
@@ -18,15 +18,22 @@
 
 #include <string>
 #include <format>
+#include <memory>
+#include <mutex>
 #include <unordered_set>
 #include <unordered_map>
 #include <span>
+#include <utility>
+#include <vector>
 
 #include <Windows.h>
 #include <DbgEng.h>
 
 #include <wil/com.h>
 
+#include "guid_hash.h"
+#include "flat_hash.h"
+
 namespace comon_ext
 {
 std::wstring widen(std::string_view s);
@@ -54,18 +61,16 @@ inline void hash_combine(std::size_t& seed, const T& v) {
 template<> struct std::hash<GUID>
 {
     std::size_t operator()(const GUID& g) const noexcept {
-        const unsigned long* r{ &g.Data1 };
-        return *r ^ *(r + 1) ^ *(r + 2) ^ *(r + 3);
+        return static_cast<std::size_t>(comon_ext::guid_fingerprint(g));
     }
 };
 
 template<> struct std::hash<std::pair<CLSID, IID>>
 {
     std::size_t operator()(const std::pair<CLSID, IID>& p) const noexcept {
-        std::hash<GUID> hasher{};
-        auto seed{ hasher(p.first) };
-        hash_combine(seed, p.second);
-        return seed;
+        // the multiplication keeps the (a, b) and (b, a) pairs apart
+        return static_cast<std::size_t>(comon_ext::mix64(comon_ext::guid_fingerprint(p.first) ^
+            comon_ext::guid_fingerprint(p.second) * 0x9e3779b97f4a7c15ull));
     }
 };
 
@@ -128,14 +133,57 @@ private:
 namespace comon_ext
 {
 
+// messages logged on a background thread, written to the debugger output later by the engine thread
+class output_buffer
+{
+public:
+    struct message
+    {
+        ULONG mask;
+        bool dml;
+        std::wstring text;
+    };
+
+private:
+    std::mutex _lock{};
+    std::vector<message> _messages{};
+
+public:
+    void add(ULONG mask, bool dml, std::wstring text) {
+        std::scoped_lock lock{ _lock };
+        _messages.push_back({ mask, dml, std::move(text) });
+    }
+
+    std::vector<message> take() {
+        std::scoped_lock lock{ _lock };
+        return std::exchange(_messages, {});
+    }
+};
+
 class dbgeng_logger
 {
 private:
     const wil::com_ptr<IDebugControl4> _dbgcontrol;
+    // set when the messages are logged on a background thread, which must not call the debugger engine
+    const std::shared_ptr<output_buffer> _buffer;
+
+    void output(ULONG mask, bool dml, std::wstring text) const {
+        if (_buffer) {
+            _buffer->add(mask, dml, std::move(text));
+        } else if (dml) {
+            LOG_IF_FAILED(_dbgcontrol->ControlledOutputWide(DEBUG_OUTCTL_AMBIENT_DML, mask, text.c_str()));
+        } else {
+            LOG_IF_FAILED(_dbgcontrol->OutputWide(mask, text.c_str()));
+        }
+    }
 
 public:
     static std::wstring_view get_error_msg(HRESULT hr) {
+        // the loggers of the background jobs share the cache with the engine thread
+        static std::mutex lock{};
         static std::unordered_map<HRESULT, std::wstring> error_messages{};
+
+        std::scoped_lock guard{ lock };
         if (!error_messages.contains(hr)) {
             wchar_t error_msg[256];
             auto cnt{ ::FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, nullptr,
@@ -154,19 +202,28 @@ public:
     };
 
     dbgeng_logger(IDebugControl4* dbgcontrol):
-        _dbgcontrol{ dbgcontrol } {}
+        _dbgcontrol{ dbgcontrol }, _buffer{} {}
+
+    explicit dbgeng_logger(std::shared_ptr<output_buffer> buffer):
+        _dbgcontrol{}, _buffer{ std::move(buffer) } {}
 
     void log_info(std::wstring_view message) const {
-        LOG_IF_FAILED(_dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"[comon] {}\n", message).c_str()));
+        output(DEBUG_OUTPUT_NORMAL, false, std::format(L"[comon] {}\n", message));
     }
 
     void log_info_dml(std::wstring_view message) const {
-        LOG_IF_FAILED(_dbgcontrol->ControlledOutputWide(DEBUG_OUTCTL_AMBIENT_DML, DEBUG_OUTPUT_NORMAL,
-            std::format(L"[comon] {}\n", message).c_str()));
+        output(DEBUG_OUTPUT_NORMAL, true, std::format(L"[comon] {}\n", message));
     }
 
     void log_warning(std::wstring_view message) const {
-        LOG_IF_FAILED(_dbgcontrol->OutputWide(DEBUG_OUTPUT_WARNING, std::format(L"[comon] {}\n", message).c_str()));
+        output(DEBUG_OUTPUT_WARNING, false, std::format(L"[comon] {}\n", message));
+    }
+
+    // writes the messages of a background logger
+    void write(output_buffer& buffer) const {
+        for (auto& m : buffer.take()) {
+            output(m.mask, m.dml, std::move(m.text));
+        }
     }
 
     void log_error(std::wstring_view message, HRESULT hr) const {
@@ -174,9 +231,8 @@ public:
     }
 
     void log_error_dml(std::wstring_view message, HRESULT hr) const {
-        LOG_IF_FAILED(_dbgcontrol->ControlledOutputWide(DEBUG_OUTCTL_AMBIENT_DML, DEBUG_OUTPUT_ERROR,
-            std::format(L"[comon] {}, <col fg=\"srcstr\">error: {:#x} - {}</col>\n",
-                message, static_cast<unsigned long>(hr), get_error_msg(hr)).c_str()));
+        output(DEBUG_OUTPUT_ERROR, true, std::format(L"[comon] {}, <col fg=\"srcstr\">error: {:#x} - {}</col>\n",
+            message, static_cast<unsigned long>(hr), get_error_msg(hr)));
     }
 };
 }
@@ -391,8 +391,8 @@ void comonitor::log_com_call_error(const CLSID& clsid, const IID& iid, std::wstr
         dbgeng_logger::get_error_msg(result_code)));
 }
 
-std::unordered_map<CLSID, std::vector<std::pair<ULONG64, IID>>> comonitor::list_cotypes() const {
-    std::unordered_map<CLSID, std::vector<std::pair<ULONG64, IID>>> result{};
+flat_hash_map<CLSID, std::vector<std::pair<ULONG64, IID>>> comonitor::list_cotypes() const {
+    flat_hash_map<CLSID, std::vector<std::pair<ULONG64, IID>>> result{};
 
     for (const auto& [key, addr] : _cotype_with_vtables) {
         const auto& [clsid, iid] {key};
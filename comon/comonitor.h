@@ -34,8 +34,8 @@
 namespace comon_ext {
 
 struct no_filter {};
-struct including_filter { const std::unordered_set<CLSID> clsids; };
-struct excluding_filter { const std::unordered_set<CLSID> clsids; };
+struct including_filter { const flat_hash_set<CLSID> clsids; };
+struct excluding_filter { const flat_hash_set<CLSID> clsids; };
 using cofilter = std::variant<no_filter, including_filter, excluding_filter>;
 
 enum class debuggee_type {
@@ -88,9 +88,9 @@ private:
     struct cobreakpoint {
         const CLSID clsid;
         const IID iid;
-        const std::wstring method_name;
+        const std::wstring_view method_name;
         const CALLCONV callconv;
-        const std::wstring return_type;
+        const std::wstring_view return_type;
         const method_arg_collection args;
         const cobreakpoint_behavior behavior;
     };
@@ -98,8 +98,8 @@ private:
     struct cobreakpoint_return {
         const CLSID clsid;
         const IID iid;
-        const std::wstring method_name;
-        const std::wstring return_type;
+        const std::wstring_view method_name;
+        const std::wstring_view return_type;
         const method_arg_collection out_args;
         const std::vector<call_context::arg_val> out_arg_values;
         const bool should_stop;
@@ -152,7 +152,7 @@ private:
 
     std::unordered_map<ULONG, breakpoint_data> _breakpoints{};
     std::unordered_map<ULONG64, ULONG> _breakpoint_addresses{};
-    std::unordered_map<std::pair<CLSID, IID>, ULONG64> _cotype_with_vtables{};
+    flat_hash_map<std::pair<CLSID, IID>, ULONG64> _cotype_with_vtables{};
 
     std::variant<module_info, HRESULT> get_module_info(ULONG64 base_address) const;
 
@@ -230,7 +230,7 @@ public:
         }
     }
 
-    std::unordered_map<CLSID, std::vector<std::pair<ULONG64, IID>>> list_cotypes() const;
+    flat_hash_map<CLSID, std::vector<std::pair<ULONG64, IID>>> list_cotypes() const;
 
     HRESULT create_cobreakpoint(const CLSID& clsid, const IID& iid, DWORD method_num, cobreakpoint_behavior behavior);
 
@@ -174,15 +174,13 @@ HRESULT comonitor::create_cobreakpoint(const CLSID& clsid, const IID& iid, DWORD
         return E_INVALIDARG;
     }
 
-    if (auto methods{ _cometa.get_type_methods(iid) }; methods && methods->size() > method_num) {
-        auto& method{ methods->at(method_num) };
+    if (auto layout{ _cometa.get_vtable_layout(iid) }; layout && layout->methods.size() > method_num) {
+        auto& [method, args] { layout->methods.at(method_num) };
         if (auto vtable{ _cotype_with_vtables.find({ clsid, iid }) }; vtable != std::end(_cotype_with_vtables)) {
             ULONG64 addr{};
             RETURN_IF_FAILED(_cc.read_pointer(vtable->second + method_num * _cc.get_pointer_size(), addr));
 
-            auto args{ _cometa.get_type_method_args(method) };
-            cobreakpoint cobrk{ clsid, iid, method.name, method.callconv, method.return_type,
-                args ? *args : method_arg_collection{}, behavior };
+            cobreakpoint cobrk{ clsid, iid, method.name, method.callconv, method.return_type, args, behavior };
 
             ULONG brk_id{};
             if (auto hr{ set_breakpoint(cobrk, addr, &brk_id) }; SUCCEEDED(hr)) {
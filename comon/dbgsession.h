@@ -58,15 +58,24 @@ private:
     }
 
     static cometa create_cometa(IDebugControl4* dbgcontrol, const call_context& cc) {
-        auto name{ cc.is_64bit() ? "cometa_64.db3" : "cometa_32.db3" };
-        if (auto path{ fs::temp_directory_path() / name }; fs::exists(path)) {
-            if (cometa::is_valid_db(path)) {
-                return cometa{ dbgcontrol, cc.is_wow64(), path, false };
-            } else {
-                return cometa{ dbgcontrol, cc.is_wow64(), "", true };
+        auto arch{ static_cast<USHORT>(cc.is_64bit() ? IMAGE_FILE_MACHINE_AMD64 : IMAGE_FILE_MACHINE_I386) };
+        auto temp_path{ fs::temp_directory_path() };
+        if (auto path{ temp_path / "cometa.db3" }; fs::exists(path)) {
+            // opening the database validates its schema, so the file is opened only once
+            try {
+                return cometa{ dbgcontrol, arch, path, false };
+            } catch (const std::exception&) {
+                return cometa{ dbgcontrol, arch, "", true };
             }
         } else {
-            return cometa{ dbgcontrol, cc.is_wow64(), path, true };
+            // the earlier versions kept a database for each architecture, the new one starts with their metadata
+            std::vector<legacy_database> legacy_databases{};
+            for (auto [name, legacy_arch] : { std::pair{ "cometa_32.db3", IMAGE_FILE_MACHINE_I386 }, std::pair{ "cometa_64.db3", IMAGE_FILE_MACHINE_AMD64 } }) {
+                if (auto legacy_path{ temp_path / name }; fs::exists(legacy_path)) {
+                    legacy_databases.push_back({ legacy_path, static_cast<USHORT>(legacy_arch) });
+                }
+            }
+            return cometa{ dbgcontrol, arch, path, true, legacy_databases };
         }
     }
 
@@ -123,6 +132,8 @@ public:
         if (auto monitor{ _monitors.find(get_active_process_id()) }; monitor != std::end(_monitors)) {
             _monitors.erase(monitor);
         }
+        // the vtables found by the monitor reach the database file before the debugger detaches or unloads the extension
+        _cometa.flush_vtables();
     }
 
     cometa& get_metadata() { return _cometa; }
@@ -37,6 +37,8 @@ namespace fs = std::filesystem;
 namespace {
 dbgsession g_dbgsession{};
 
+constexpr ULONG64 max_cache_capacity{ 1'000'000 };
+
 const wchar_t* monitor_not_enabled_error{ L"COM monitor not enabled for the current process. Run !comon attach to enable it.\n" };
 
 std::vector<std::string> split_args(std::string_view args) {
@@ -79,21 +81,19 @@ void cometa_showi(wil::com_ptr_t<IDebugControl4> dbgcontrol, comon_ext::cometa&
         dbgcontrol->ControlledOutputWide(DEBUG_OUTCTL_AMBIENT_DML, DEBUG_OUTPUT_NORMAL,
             std::format(L"Found: {:b} ({})\n\n", iid, cotype->name).c_str());
 
-        if (auto methods{ cometa.get_type_methods(iid) }; methods) {
+        if (auto layout{ cometa.get_vtable_layout(iid) }; layout) {
             dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, L"Methods:\n");
-            for (size_t i = 0; i < methods->size(); i++) {
-                auto& method = methods->at(i);
-                auto method_args{ cometa.get_type_method_args(method) };
-                assert(method_args);
+            for (size_t i = 0; i < layout->methods.size(); i++) {
+                auto& [method, method_args] { layout->methods.at(i) };
 
                 dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"- [{}] {} {}(", i, method.return_type, method.name).c_str());
 
-                auto arg_iter = method_args->begin();
-                if (arg_iter != method_args->end()) {
+                auto arg_iter = method_args.begin();
+                if (arg_iter != method_args.end()) {
                     dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"{} {}", arg_iter->type, arg_iter->name).c_str());
                     arg_iter++;
                 }
-                while (arg_iter != method_args->end()) {
+                while (arg_iter != method_args.end()) {
                     dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L", {} {}", arg_iter->type, arg_iter->name).c_str());
                     arg_iter++;
                 }
@@ -159,6 +159,147 @@ void cometa_showm(wil::com_ptr_t<IDebugControl4> dbgcontrol, comon_ext::cometa&
     }
 }
 
+void cometa_find(wil::com_ptr_t<IDebugControl4> dbgcontrol, comon_ext::cometa& cometa, const std::wstring& text) {
+    constexpr size_t max_results{ 50 };
+
+    auto result{ cometa.find_names(text, max_results) };
+    if (std::holds_alternative<HRESULT>(result)) {
+        return;
+    }
+
+    auto& [matches, total_matches] { std::get<name_search_result>(result) };
+    if (matches.empty()) {
+        dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL,
+            std::format(L"Can't find any types, classes, or methods matching '{}' in the metadata.\n", text).c_str());
+        return;
+    }
+
+    for (const auto& [kind, guid, name] : matches) {
+        switch (kind) {
+        case name_kind::type:
+            dbgcontrol->ControlledOutputWide(DEBUG_OUTCTL_AMBIENT_DML, DEBUG_OUTPUT_NORMAL,
+                std::format(L"- Type: <link cmd=\"!cometa showi {0:b}\">{0:b}</link> ({1})\n", guid, name).c_str());
+            break;
+        case name_kind::coclass:
+            dbgcontrol->ControlledOutputWide(DEBUG_OUTCTL_AMBIENT_DML, DEBUG_OUTPUT_NORMAL,
+                std::format(L"- CLSID: <link cmd=\"!cometa showc {0:b}\">{0:b}</link> ({1})\n", guid, name).c_str());
+            break;
+        case name_kind::method: {
+            auto type_name{ cometa.resolve_type_name(guid) };
+            dbgcontrol->ControlledOutputWide(DEBUG_OUTCTL_AMBIENT_DML, DEBUG_OUTPUT_NORMAL,
+                std::format(L"- Method: <link cmd=\"!cometa showi {0:b}\">{0:b}</link> ({1}::{2})\n",
+                    guid, type_name ? *type_name : L"N/A", name).c_str());
+            break;
+        }
+        }
+    }
+
+    if (total_matches > matches.size()) {
+        dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"\nShowing {} of {} matches. Refine the search text to narrow the results.\n",
+            matches.size(), total_matches).c_str());
+    }
+}
+
+void cometa_cache(wil::com_ptr_t<IDebugControl4> dbgcontrol, const comon_ext::cometa& cometa) {
+    auto print_cache_info = [&dbgcontrol](std::wstring_view name, const cache_info& ci) {
+        auto aging{ !ci.aging_period ? std::wstring{} : *ci.aging_period == 0 ? std::wstring{ L", aging: off" } :
+            std::format(L", aging: every {} accesses", *ci.aging_period) };
+        dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"{}: policy: {}, capacity: {}{}, entries: {}\n",
+            name, cache_policy_name(ci.policy), ci.capacity, aging, ci.size).c_str());
+    };
+
+    print_cache_info(L"Type cache", cometa.get_cotype_cache_info());
+    print_cache_info(L"Class cache", cometa.get_coclass_cache_info());
+    print_cache_info(L"VTable layout cache", cometa.get_vtable_layout_cache_info());
+}
+
+void cometa_cachestats(wil::com_ptr_t<IDebugControl4> dbgcontrol, const comon_ext::cometa& cometa) {
+    auto print_cache_stats = [&dbgcontrol](std::wstring_view name, const cache_info& ci) {
+        dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"{}: policy: {}, entries: {}/{}, hits: {}, inserts: {}, updates: {}, evictions: {}\n",
+            name, cache_policy_name(ci.policy), ci.size, ci.capacity, ci.stats.hits, ci.stats.inserts, ci.stats.updates, ci.stats.evictions).c_str());
+    };
+
+    print_cache_stats(L"Type cache", cometa.get_cotype_cache_info());
+    print_cache_stats(L"Class cache", cometa.get_coclass_cache_info());
+    print_cache_stats(L"VTable layout cache", cometa.get_vtable_layout_cache_info());
+    dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"Interned names: {}, pool size: {} bytes\n",
+        cometa.get_name_pool().size(), cometa.get_name_pool().allocated_bytes()).c_str());
+    dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"Prepared statements: {}, re-entrant fresh statements: {}\n",
+        cometa.get_statements().size(), cometa.get_statements().fresh_statements()).c_str());
+    if (auto read_statements{ cometa.get_read_statements() }; read_statements) {
+        dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"Read-only connection: prepared statements: {}, re-entrant fresh statements: {}\n",
+            read_statements->size(), read_statements->fresh_statements()).c_str());
+    }
+    if (auto snapshot{ cometa.get_snapshot() }; snapshot) {
+        dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"Metadata snapshot: {} types, {} classes, {} bytes mapped\n",
+            snapshot->type_count(), snapshot->class_count(), snapshot->size_bytes()).c_str());
+    } else {
+        dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, L"Metadata snapshot: not loaded\n");
+    }
+
+    dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, L"\nMetadata lookups:\n");
+    for (size_t i = 0; i < lookup_path_count; i++) {
+        auto path{ static_cast<lookup_path>(i) };
+        auto& ls{ cometa.get_lookup_stats(path) };
+        auto total_us{ ls.latency.total().count() };
+        dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(
+            L"- {}: calls: {}, cache hits: {}, stale hits: {}, filtered: {}, snapshot reads: {}, SQL statements: {}, SQL rows: {}, type library reads: {}, registry reads: {}, total: {}us, avg: {}us\n",
+            lookup_path_name(path), ls.calls, ls.cache_hits, ls.stale_hits, ls.filtered, ls.snapshot_reads, ls.sql_statements, ls.sql_rows,
+            ls.typelib_reads, ls.registry_reads, total_us, ls.calls > 0 ? total_us / static_cast<long long>(ls.calls) : 0).c_str());
+
+        if (ls.latency.count() > 0) {
+            std::wstring buckets{};
+            for (size_t b = 0; b < latency_histogram::bucket_count; b++) {
+                if (auto n{ ls.latency.bucket(b) }; n > 0) {
+                    auto limit{ latency_histogram::bucket_limit(b) };
+                    buckets += limit != 0 ? std::format(L" <{}us: {}", limit, n) :
+                        std::format(L" >={}us: {}", latency_histogram::bucket_limit(b - 1), n);
+                }
+            }
+            dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"  latency:{}\n", buckets).c_str());
+        }
+    }
+    dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, L"\n");
+}
+
+void cometa_cachestats_json(wil::com_ptr_t<IDebugControl4> dbgcontrol, const comon_ext::cometa& cometa) {
+    auto cache_json = [](const cache_info& ci) {
+        return std::format(LR"({{"policy":"{}","capacity":{},"aging_period":{},"entries":{},"hits":{},"inserts":{},"updates":{},"evictions":{}}})",
+            cache_policy_name(ci.policy), ci.capacity, ci.aging_period ? std::to_wstring(*ci.aging_period) : std::wstring{ L"null" },
+            ci.size, ci.stats.hits, ci.stats.inserts, ci.stats.updates, ci.stats.evictions);
+    };
+
+    auto snapshot{ cometa.get_snapshot() };
+    auto snapshot_json{ snapshot ? std::format(LR"({{"types":{},"classes":{},"bytes":{}}})",
+        snapshot->type_count(), snapshot->class_count(), snapshot->size_bytes()) : std::wstring{ L"null" } };
+
+    auto read_statements{ cometa.get_read_statements() };
+    auto read_statements_json{ read_statements ? std::format(LR"({{"prepared":{},"fresh":{}}})",
+        read_statements->size(), read_statements->fresh_statements()) : std::wstring{ L"null" } };
+
+    std::wstring json{ std::format(LR"({{"caches":{{"type":{},"class":{},"vtable_layout":{}}},"names":{{"count":{},"pool_bytes":{}}},"statements":{{"prepared":{},"fresh":{}}},"read_statements":{},"snapshot":{},"lookups":{{)",
+        cache_json(cometa.get_cotype_cache_info()), cache_json(cometa.get_coclass_cache_info()),
+        cache_json(cometa.get_vtable_layout_cache_info()), cometa.get_name_pool().size(), cometa.get_name_pool().allocated_bytes(),
+        cometa.get_statements().size(), cometa.get_statements().fresh_statements(), read_statements_json, snapshot_json) };
+
+    for (size_t i = 0; i < lookup_path_count; i++) {
+        auto path{ static_cast<lookup_path>(i) };
+        auto& ls{ cometa.get_lookup_stats(path) };
+
+        std::wstring buckets{};
+        for (size_t b = 0; b < latency_histogram::bucket_count; b++) {
+            buckets += std::format(L"{}{}", b == 0 ? L"" : L",", ls.latency.bucket(b));
+        }
+
+        json += std::format(LR"({}"{}":{{"calls":{},"cache_hits":{},"stale_hits":{},"filtered":{},"snapshot_reads":{},"sql_statements":{},"sql_rows":{},"typelib_reads":{},"registry_reads":{},"total_us":{},"latency_buckets":[{}]}})",
+            i == 0 ? L"" : L",", lookup_path_name(path), ls.calls, ls.cache_hits, ls.stale_hits, ls.filtered, ls.snapshot_reads,
+            ls.sql_statements, ls.sql_rows, ls.typelib_reads, ls.registry_reads, ls.latency.total().count(), buckets);
+    }
+    json += L"}}\n";
+
+    dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, json.c_str());
+}
+
 HRESULT try_finding_active_monitor(IDebugControl4* dbgcontrol, comonitor** monitor) {
     if (auto m{ g_dbgsession.find_active_monitor() }; m) {
         *monitor = m;
@@ -217,14 +358,64 @@ extern "C" HRESULT CALLBACK cometa(IDebugClient * dbgclient, PCSTR args) {
     }
 
     auto& cometa{ g_dbgsession.get_metadata() };
+    // reports (and swaps in) a completed background index before running the command
+    cometa.poll_index_job();
+
     if (vargs[0] == "index") {
-        return vargs.size() == 1 ? cometa.index() : cometa.index(widen(vargs[1]));
+        if (vargs.size() == 1) {
+            return cometa.start_index();
+        }
+        if (vargs[1] == "status") {
+            return cometa.index_status();
+        }
+        if (vargs[1] == "cancel") {
+            return cometa.cancel_index();
+        }
+        if (vargs[1] == "--methods") {
+            return cometa.start_index(true);
+        }
+        return cometa.index(widen(vargs[1]));
+    } else if (vargs[0] == "base") {
+        if (vargs.size() == 1) {
+            return cometa.base_status();
+        }
+        if (vargs.size() != 2) {
+            dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid arguments. Run !cohelp to check the syntax.\n");
+            return E_INVALIDARG;
+        }
+        if (vargs[1] == "off") {
+            return cometa.remove_base();
+        }
+        return cometa.set_base(widen(vargs[1]));
+    } else if (vargs[0] == "workingset") {
+        if (vargs.size() == 1) {
+            return cometa.working_set_status();
+        }
+        if (vargs.size() == 2 && vargs[1] == "on") {
+            return cometa.enable_working_set();
+        }
+        if (vargs.size() == 2 && vargs[1] == "off") {
+            return cometa.disable_working_set();
+        }
+        dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid arguments. Run !cohelp to check the syntax.\n");
+        return E_INVALIDARG;
     } else if (vargs[0] == "save") {
         if (vargs.size() != 2) {
             dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid arguments. Run !cohelp to check the syntax.\n");
             return E_INVALIDARG;
         }
         return cometa.save(widen(vargs[1]));
+    } else if (vargs[0] == "merge") {
+        if (vargs.size() < 2 || vargs.size() > 3) {
+            dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid arguments. Run !cohelp to check the syntax.\n");
+            return E_INVALIDARG;
+        }
+        auto policy{ vargs.size() == 3 ? parse_merge_policy(vargs[2]) : merge_policy::newest };
+        if (!policy) {
+            dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid merge policy. Run !cohelp to check the syntax.\n");
+            return E_INVALIDARG;
+        }
+        return cometa.merge(widen(vargs[1]), *policy);
     } else if (vargs[0] == "showi") {
         if (vargs.size() != 2) {
             dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid arguments. Run !cohelp to check the syntax.\n");
@@ -256,6 +447,50 @@ extern "C" HRESULT CALLBACK cometa(IDebugClient * dbgclient, PCSTR args) {
         }
         cometa_showm(dbgcontrol, cometa, widen(vargs[1]));
         return S_OK;
+    } else if (vargs[0] == "find") {
+        if (vargs.size() != 2) {
+            dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid arguments. Run !cohelp to check the syntax.\n");
+            return E_INVALIDARG;
+        }
+        cometa_find(dbgcontrol, cometa, widen(vargs[1]));
+        return S_OK;
+    } else if (vargs[0] == "cache") {
+        if ((vargs.size() == 4 || vargs.size() == 5) && vargs[1] == "policy") {
+            auto policy{ parse_cache_policy(vargs[2]) };
+            ULONG64 capacity{};
+            if (!policy || FAILED(evaluate_number(dbgcontrol.get(), vargs[3], &capacity)) || capacity == 0 || capacity > max_cache_capacity) {
+                dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid cache policy or capacity. Run !cohelp to check the syntax.\n");
+                return E_INVALIDARG;
+            }
+            std::optional<size_t> aging_period{};
+            if (vargs.size() == 5) {
+                // only the LFU policy ages its entries
+                ULONG64 aging{};
+                if (*policy != cache_policy::lfu || FAILED(evaluate_number(dbgcontrol.get(), vargs[4], &aging))) {
+                    dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid aging period. Run !cohelp to check the syntax.\n");
+                    return E_INVALIDARG;
+                }
+                aging_period = static_cast<size_t>(aging);
+            }
+            cometa.set_cache_policy(*policy, static_cast<size_t>(capacity), aging_period);
+        } else if (vargs.size() != 1) {
+            dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid arguments. Run !cohelp to check the syntax.\n");
+            return E_INVALIDARG;
+        }
+        cometa_cache(dbgcontrol, cometa);
+        return S_OK;
+    } else if (vargs[0] == "cachestats") {
+        if (vargs.size() == 1) {
+            cometa_cachestats(dbgcontrol, cometa);
+        } else if (vargs.size() == 2 && vargs[1] == "--json") {
+            cometa_cachestats_json(dbgcontrol, cometa);
+        } else if (vargs.size() == 2 && vargs[1] == "reset") {
+            cometa.reset_stats();
+        } else {
+            dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: invalid arguments. Run !cohelp to check the syntax.\n");
+            return E_INVALIDARG;
+        }
+        return S_OK;
     } else {
         dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: unknown subcommand. Run !cohelp to check the syntax.\n");
         return E_INVALIDARG;
@@ -267,7 +502,7 @@ extern "C" HRESULT CALLBACK comon(IDebugClient * dbgclient, PCSTR args) {
     RETURN_IF_FAILED(dbgclient->QueryInterface(__uuidof(IDebugControl4), dbgcontrol.put_void()));
 
     auto print_filter = [&dbgcontrol](const cofilter& filter) {
-        auto print_clsids = [&dbgcontrol](const std::unordered_set<CLSID>& clsids) {
+        auto print_clsids = [&dbgcontrol](const flat_hash_set<CLSID>& clsids) {
             for (auto& clsid : clsids) {
                 dbgcontrol->OutputWide(DEBUG_OUTPUT_NORMAL, std::format(L"- {:b}\n", clsid).c_str());
             }
@@ -287,7 +522,7 @@ extern "C" HRESULT CALLBACK comon(IDebugClient * dbgclient, PCSTR args) {
     };
 
     auto parse_filter = [](std::span<const std::string> args) -> cofilter {
-        std::unordered_set<CLSID> clsids{};
+        flat_hash_set<CLSID> clsids{};
         for (auto iter{ std::crbegin(args) }; iter != std::crend(args); iter++) {
             if (*iter == "-i") {
                 return including_filter{ clsids };
@@ -446,11 +681,12 @@ extern "C" HRESULT CALLBACK cobp(IDebugClient * dbgclient, PCSTR args) {
     ULONG64 method_num{};
     if (FAILED(evaluate_number(dbgcontrol.get(), vargs[arg_start + 2], &method_num))) {
         auto& cometa{ g_dbgsession.get_metadata() };
-        if (auto methods{ cometa.get_type_methods(iid) }; methods) {
+        if (auto layout{ cometa.get_vtable_layout(iid) }; layout) {
+            auto& methods{ layout->methods };
             auto method_name{ widen(vargs[arg_start + 2]) };
-            auto matching_method = [&method_name](const comethod& method) { return method.name == method_name; };
-            if (auto res{ std::find_if(std::cbegin(*methods), std::cend(*methods), matching_method) };res != std::end(*methods)) {
-                method_num = static_cast<DWORD>(res - std::begin(*methods));
+            auto matching_method = [&method_name](const covtable_method& m) { return m.method.name == method_name; };
+            if (auto res{ std::find_if(std::cbegin(methods), std::cend(methods), matching_method) }; res != std::cend(methods)) {
+                method_num = static_cast<DWORD>(res - std::cbegin(methods));
                 return monitor->create_cobreakpoint(clsid, iid, static_cast<DWORD>(method_num), behavior);
             } else {
                 dbgcontrol->OutputWide(DEBUG_OUTPUT_ERROR, L"ERROR: Could not find a method with the given name in the metadata.\n");
@@ -0,0 +1,416 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <ranges>
+#include <utility>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define COMON_FLAT_HASH_SSE2
+#endif
+
+namespace comon_ext
+{
+namespace flat_hash_detail
+{
+using ctrl_t = int8_t;
+
+// a control byte is either one of the markers below or, for a full slot, the 7 low bits of the key hash
+constexpr ctrl_t ctrl_empty{ -128 };
+constexpr ctrl_t ctrl_deleted{ -2 };
+
+constexpr size_t group_width{ 16 };
+constexpr size_t npos{ static_cast<size_t>(-1) };
+
+// 16 control bytes compared at once; each match method returns a bit mask of the matching positions
+class group
+{
+#ifdef COMON_FLAT_HASH_SSE2
+    __m128i _ctrl;
+
+public:
+    explicit group(const ctrl_t* ctrl): _ctrl{ _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl)) } {}
+
+    uint32_t match(ctrl_t tag) const {
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), _ctrl)));
+    }
+
+    // full slots have the sign bit clear
+    uint32_t match_empty_or_deleted() const {
+        return static_cast<uint32_t>(_mm_movemask_epi8(_ctrl));
+    }
+#else
+    const ctrl_t* _ctrl;
+
+public:
+    explicit group(const ctrl_t* ctrl): _ctrl{ ctrl } {}
+
+    uint32_t match(ctrl_t tag) const {
+        uint32_t mask{};
+        for (size_t i = 0; i < group_width; i++) {
+            mask |= static_cast<uint32_t>(_ctrl[i] == tag) << i;
+        }
+        return mask;
+    }
+
+    uint32_t match_empty_or_deleted() const {
+        uint32_t mask{};
+        for (size_t i = 0; i < group_width; i++) {
+            mask |= static_cast<uint32_t>(_ctrl[i] < 0) << i;
+        }
+        return mask;
+    }
+#endif
+
+    uint32_t match_empty() const { return match(ctrl_empty); }
+};
+
+/*
+ * Open-addressing hash table in the SwissTable layout: slots are split into groups of 16,
+ * each with 16 control bytes holding 7 bits of the slot key hash. A lookup compares all
+ * the control bytes of a group in one SIMD instruction and touches only the slots whose
+ * tags match, so probe sequences stay short and cache-friendly even for clustered keys.
+ * The remaining hash bits select the first group; the next groups are probed in
+ * triangular steps, which visit every group of a power-of-two table.
+ *
+ * Slots are stored by value and must be default-constructible; inserting may move them,
+ * so (unlike std::unordered_map) references to elements do not survive a rehash.
+*/
+template<typename K, typename Slot, typename KeyOf, typename Hash, typename KeyEqual>
+class flat_table
+{
+    std::vector<ctrl_t> _ctrl{};
+    std::vector<Slot> _slots{};
+    size_t _size{};
+    size_t _tombstones{};
+
+    Hash _hash{};
+    KeyEqual _eq{};
+
+    static constexpr size_t max_load(size_t capacity) { return capacity - capacity / 8; }
+
+    static constexpr ctrl_t tag_of(size_t hash) { return static_cast<ctrl_t>(hash & 0x7f); }
+
+    size_t first_group(size_t hash) const { return (hash >> 7) & (_ctrl.size() / group_width - 1); }
+
+    size_t next_group(size_t g, size_t step) const { return (g + step) & (_ctrl.size() / group_width - 1); }
+
+    size_t find_slot(const K& key, size_t hash) const {
+        if (_ctrl.empty()) {
+            return npos;
+        }
+
+        auto tag{ tag_of(hash) };
+        for (size_t g{ first_group(hash) }, step{ 1 }; ; g = next_group(g, step++)) {
+            group grp{ &_ctrl[g * group_width] };
+            for (auto mask{ grp.match(tag) }; mask != 0; mask &= mask - 1) {
+                if (auto i{ g * group_width + std::countr_zero(mask) }; _eq(KeyOf{}(_slots[i]), key)) {
+                    return i;
+                }
+            }
+            if (grp.match_empty() != 0) {
+                return npos;
+            }
+        }
+    }
+
+    size_t find_free_slot(size_t hash) const {
+        for (size_t g{ first_group(hash) }, step{ 1 }; ; g = next_group(g, step++)) {
+            if (auto mask{ group{ &_ctrl[g * group_width] }.match_empty_or_deleted() }; mask != 0) {
+                return g * group_width + std::countr_zero(mask);
+            }
+        }
+    }
+
+    void rehash(size_t capacity) {
+        assert(capacity >= group_width && std::has_single_bit(capacity));
+        auto old_ctrl{ std::exchange(_ctrl, std::vector<ctrl_t>(capacity, ctrl_empty)) };
+        auto old_slots{ std::exchange(_slots, std::vector<Slot>(capacity)) };
+        _tombstones = 0;
+
+        for (size_t i = 0; i < old_ctrl.size(); i++) {
+            if (old_ctrl[i] >= 0) {
+                auto hash{ _hash(KeyOf{}(old_slots[i])) };
+                auto slot{ find_free_slot(hash) };
+                _ctrl[slot] = tag_of(hash);
+                _slots[slot] = std::move(old_slots[i]);
+            }
+        }
+    }
+
+    static size_t capacity_for(size_t size) {
+        auto capacity{ std::bit_ceil(std::max(group_width, size + size / 7 + 1)) };
+        return max_load(capacity) < size ? capacity * 2 : capacity;
+    }
+
+public:
+    template<bool is_const>
+    class basic_iterator
+    {
+        friend class flat_table;
+
+        using table_t = std::conditional_t<is_const, const flat_table, flat_table>;
+
+        table_t* _table{};
+        size_t _index{};
+
+        void skip_free() {
+            while (_index < _table->_ctrl.size() && _table->_ctrl[_index] < 0) {
+                _index++;
+            }
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Slot;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<is_const, const Slot*, Slot*>;
+        using reference = std::conditional_t<is_const, const Slot&, Slot&>;
+
+        basic_iterator() = default;
+
+        basic_iterator(table_t* table, size_t index): _table{ table }, _index{ index } {}
+
+        operator basic_iterator<true>() const requires (!is_const) { return { _table, _index }; }
+
+        reference operator*() const { return _table->_slots[_index]; }
+
+        pointer operator->() const { return &_table->_slots[_index]; }
+
+        basic_iterator& operator++() {
+            _index++;
+            skip_free();
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            auto prev{ *this };
+            ++*this;
+            return prev;
+        }
+
+        bool operator==(const basic_iterator& other) const { return _index == other._index; }
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    flat_table() = default;
+
+    iterator begin() {
+        iterator iter{ this, 0 };
+        iter.skip_free();
+        return iter;
+    }
+
+    iterator end() { return { this, _ctrl.size() }; }
+
+    const_iterator begin() const {
+        const_iterator iter{ this, 0 };
+        iter.skip_free();
+        return iter;
+    }
+
+    const_iterator end() const { return { this, _ctrl.size() }; }
+
+    size_t size() const { return _size; }
+
+    bool empty() const { return _size == 0; }
+
+    void reserve(size_t size) {
+        if (size > max_load(_ctrl.size())) {
+            rehash(capacity_for(size));
+        }
+    }
+
+    void clear() {
+        _ctrl.clear();
+        _slots.clear();
+        _size = 0;
+        _tombstones = 0;
+    }
+
+    iterator find(const K& key) {
+        auto i{ find_slot(key, _hash(key)) };
+        return i != npos ? iterator{ this, i } : end();
+    }
+
+    const_iterator find(const K& key) const {
+        auto i{ find_slot(key, _hash(key)) };
+        return i != npos ? const_iterator{ this, i } : end();
+    }
+
+    bool contains(const K& key) const { return find_slot(key, _hash(key)) != npos; }
+
+    size_t count(const K& key) const { return contains(key) ? 1 : 0; }
+
+    // make_slot is called only when the key is missing
+    template<typename F>
+    std::pair<iterator, bool> find_or_insert(const K& key, F&& make_slot) {
+        auto hash{ _hash(key) };
+        if (auto i{ find_slot(key, hash) }; i != npos) {
+            return { iterator{ this, i }, false };
+        }
+
+        if (_size + _tombstones + 1 > max_load(_ctrl.size())) {
+            // when tombstones take most of the space, rehashing in place is enough
+            rehash(_ctrl.empty() ? group_width : (_size + 1 > _ctrl.size() / 2 ? _ctrl.size() * 2 : _ctrl.size()));
+        }
+
+        auto i{ find_free_slot(hash) };
+        if (_ctrl[i] == ctrl_deleted) {
+            _tombstones--;
+        }
+        _ctrl[i] = tag_of(hash);
+        _slots[i] = std::forward<F>(make_slot)();
+        _size++;
+
+        return { iterator{ this, i }, true };
+    }
+
+    iterator erase(const_iterator iter) {
+        auto i{ iter._index };
+        assert(i < _ctrl.size() && _ctrl[i] >= 0);
+
+        // If the group still has an empty slot, no probe sequence ever continued past it,
+        // and the slot may become empty again. Otherwise it must stay as a tombstone.
+        if (group{ &_ctrl[i - i % group_width] }.match_empty() != 0) {
+            _ctrl[i] = ctrl_empty;
+        } else {
+            _ctrl[i] = ctrl_deleted;
+            _tombstones++;
+        }
+        _slots[i] = Slot{};
+        _size--;
+
+        iterator next{ this, i };
+        ++next;
+        return next;
+    }
+
+    size_t erase(const K& key) {
+        if (auto i{ find_slot(key, _hash(key)) }; i != npos) {
+            erase(const_iterator{ this, i });
+            return 1;
+        }
+        return 0;
+    }
+};
+
+struct slot_key
+{
+    template<typename K>
+    const K& operator()(const K& key) const { return key; }
+};
+
+struct pair_slot_key
+{
+    template<typename K, typename V>
+    const K& operator()(const std::pair<K, V>& slot) const { return slot.first; }
+};
+}
+
+/*
+ * Flat hash map (see flat_hash_detail::flat_table). The iterators expose mutable
+ * std::pair<K, V> slots; the keys must not be modified.
+*/
+template<typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class flat_hash_map: public flat_hash_detail::flat_table<K, std::pair<K, V>, flat_hash_detail::pair_slot_key, Hash, KeyEqual>
+{
+    using base = flat_hash_detail::flat_table<K, std::pair<K, V>, flat_hash_detail::pair_slot_key, Hash, KeyEqual>;
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+    using typename base::iterator;
+    using typename base::const_iterator;
+
+    flat_hash_map() = default;
+
+    flat_hash_map(std::initializer_list<value_type> values) {
+        this->reserve(values.size());
+        for (auto& v : values) {
+            insert(v);
+        }
+    }
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const K& key, Args&&... args) {
+        return this->find_or_insert(key, [&]() { return value_type{ key, V(std::forward<Args>(args)...) }; });
+    }
+
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(const K& key, Args&&... args) {
+        return try_emplace(key, std::forward<Args>(args)...);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        return this->find_or_insert(value.first, [&value]() { return value; });
+    }
+
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const K& key, M&& mapped) {
+        auto result{ try_emplace(key) };
+        result.first->second = std::forward<M>(mapped);
+        return result;
+    }
+
+    V& operator[](const K& key) { return try_emplace(key).first->second; }
+};
+
+template<typename K, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class flat_hash_set: public flat_hash_detail::flat_table<K, K, flat_hash_detail::slot_key, Hash, KeyEqual>
+{
+    using base = flat_hash_detail::flat_table<K, K, flat_hash_detail::slot_key, Hash, KeyEqual>;
+
+public:
+    using key_type = K;
+    using value_type = K;
+    using typename base::iterator;
+    using typename base::const_iterator;
+
+    flat_hash_set() = default;
+
+    flat_hash_set(std::initializer_list<K> keys) {
+        insert_range(keys);
+    }
+
+    std::pair<iterator, bool> insert(const K& key) {
+        return this->find_or_insert(key, [&key]() { return key; });
+    }
+
+    template<std::ranges::input_range R>
+    void insert_range(R&& keys) {
+        if constexpr (std::ranges::sized_range<R>) {
+            this->reserve(this->size() + std::ranges::size(keys));
+        }
+        for (const K& key : keys) {
+            insert(key);
+        }
+    }
+};
+}
@@ -0,0 +1,47 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <Windows.h>
+
+namespace comon_ext
+{
+inline uint64_t mix64(uint64_t h) {
+    // splitmix64 finalizer
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+/*
+ * Mixes all 128 bits of a GUID into 64 bits. GUIDs from one family often differ only in
+ * Data1 (xxxxxxxx-0000-0000-C000-000000000046) or in a few low bits (sequential CLSIDs),
+ * so every input bit must affect the whole result.
+*/
+inline uint64_t guid_fingerprint(const GUID& guid) {
+    uint64_t lo, hi;
+    std::memcpy(&lo, &guid, sizeof lo);
+    std::memcpy(&hi, reinterpret_cast<const char*>(&guid) + sizeof lo, sizeof hi);
+    return mix64(lo ^ mix64(hi));
+}
+}
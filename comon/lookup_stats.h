@@ -0,0 +1,123 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+namespace comon_ext
+{
+
+enum class lookup_path
+{
+    resolve_type,
+    resolve_class,
+    get_vtable_layout,
+    find_vtables_by_iid,
+    find_vtables_by_clsid,
+    find_clsids_by_module_name,
+    get_module_vtables
+};
+
+constexpr size_t lookup_path_count{ static_cast<size_t>(lookup_path::get_module_vtables) + 1 };
+
+constexpr std::wstring_view lookup_path_name(lookup_path path) {
+    constexpr std::array<std::wstring_view, lookup_path_count> names{
+        L"resolve_type", L"resolve_class", L"get_vtable_layout",
+        L"find_vtables_by_iid", L"find_vtables_by_clsid", L"find_clsids_by_module_name", L"get_module_vtables" };
+    return names[static_cast<size_t>(path)];
+}
+
+/*
+ * Cumulative latency histogram with power-of-two microsecond buckets. Bucket 0 counts
+ * calls shorter than 1us, bucket i counts calls in [2^(i-1), 2^i) us, and the last bucket
+ * collects everything above.
+*/
+class latency_histogram
+{
+public:
+    static constexpr size_t bucket_count{ 20 };
+
+private:
+    std::array<uint64_t, bucket_count> _buckets{};
+    uint64_t _count{};
+    std::chrono::microseconds _total{};
+
+public:
+    void record(std::chrono::microseconds elapsed) {
+        auto us{ static_cast<uint64_t>(std::max<std::chrono::microseconds::rep>(elapsed.count(), 0)) };
+        auto bucket{ std::min<size_t>(static_cast<size_t>(std::bit_width(us)), bucket_count - 1) };
+        _buckets[bucket]++;
+        _count++;
+        _total += elapsed;
+    }
+
+    // exclusive upper bound of the bucket in microseconds (0 for the open-ended last bucket)
+    static constexpr uint64_t bucket_limit(size_t bucket) {
+        return bucket + 1 < bucket_count ? uint64_t{ 1 } << bucket : 0;
+    }
+
+    uint64_t bucket(size_t index) const { return _buckets[index]; }
+
+    uint64_t count() const { return _count; }
+
+    std::chrono::microseconds total() const { return _total; }
+};
+
+struct lookup_stats
+{
+    uint64_t calls;
+    uint64_t cache_hits;
+    uint64_t stale_hits;
+    uint64_t filtered;
+    uint64_t snapshot_reads;
+    uint64_t sql_statements;
+    uint64_t sql_rows;
+    // method signatures parsed from a type library on first use
+    uint64_t typelib_reads;
+    // single CLSID or Interface keys read after a database miss
+    uint64_t registry_reads;
+    latency_histogram latency;
+};
+
+/*
+ * Counts a call of a lookup path and adds its duration to the path histogram
+ * when the scope ends.
+*/
+class lookup_timer
+{
+    lookup_stats& _stats;
+    const std::chrono::steady_clock::time_point _start;
+
+public:
+    explicit lookup_timer(lookup_stats& stats) : _stats{ stats }, _start{ std::chrono::steady_clock::now() } {
+        _stats.calls++;
+    }
+
+    lookup_timer(const lookup_timer&) = delete;
+    lookup_timer& operator=(const lookup_timer&) = delete;
+
+    ~lookup_timer() {
+        _stats.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start));
+    }
+};
+
+}
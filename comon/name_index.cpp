@@ -0,0 +1,215 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+#include <cwchar>
+#include <cwctype>
+#include <numeric>
+#include <ranges>
+#include <tuple>
+
+#include "name_index.h"
+
+using namespace comon_ext;
+
+namespace
+{
+std::wstring to_lower(std::wstring_view s) {
+    std::wstring lower(s.size(), L'\0');
+    std::ranges::transform(s, std::begin(lower), [](wchar_t c) { return static_cast<wchar_t>(std::towlower(c)); });
+    return lower;
+}
+
+// the 32 hex digits of the GUID fields, in the order of its string form
+bool parse_guid_prefix(std::wstring_view text, std::wstring& digits) {
+    digits.clear();
+    for (auto c : text) {
+        if (c == L'{' || c == L'}' || c == L'-') {
+            continue;
+        }
+        if (!std::iswxdigit(c) || digits.size() == 32) {
+            return false;
+        }
+        digits.push_back(static_cast<wchar_t>(std::towupper(c)));
+    }
+    // shorter prefixes match too many GUIDs (and many words are valid hex numbers)
+    return digits.size() >= 4;
+}
+}
+
+name_index::guid_key name_index::key_of(const GUID& guid) {
+    constexpr std::wstring_view hex_digits{ L"0123456789ABCDEF" };
+
+    guid_key key{};
+    size_t i{};
+    auto append = [&key, &i, &hex_digits](uint64_t value, int digits) {
+        for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+            key[i++] = hex_digits[static_cast<size_t>((value >> shift) & 0xf)];
+        }
+    };
+
+    append(guid.Data1, 8);
+    append(guid.Data2, 4);
+    append(guid.Data3, 4);
+    for (auto b : guid.Data4) {
+        append(b, 2);
+    }
+    return key;
+}
+
+void name_index::add(name_kind kind, const GUID& guid, std::wstring_view name) {
+    if (name.empty()) {
+        return;
+    }
+
+    // the map keys point to the pool, not to the caller's strings
+    auto pooled{ _pool.intern(name) };
+    auto [iter, inserted] { _name_ids.try_emplace(pooled, static_cast<uint32_t>(_names.size())) };
+    if (inserted) {
+        _names.push_back(pooled);
+    }
+    _entries.push_back({ kind, guid, iter->second });
+}
+
+void name_index::build() {
+    _text.clear();
+    _name_offsets.clear();
+    for (auto name : _names) {
+        _name_offsets.push_back(static_cast<uint32_t>(_text.size()));
+        _text += to_lower(name);
+        _text.push_back(L'\0');
+    }
+
+    _suffixes.clear();
+    std::vector<uint32_t> position_names(_text.size());
+    for (uint32_t name_id = 0, i = 0; i < _text.size(); i++) {
+        if (_text[i] != L'\0') {
+            _suffixes.push_back(i);
+            position_names[i] = name_id;
+        } else {
+            name_id++;
+        }
+    }
+
+    // most suffixes differ in their first characters, so comparing the packed first four characters first
+    // avoids most of the string comparisons
+    auto packed_prefix = [this](uint32_t pos) {
+        uint64_t packed{};
+        for (uint32_t i = 0; i < 4; i++) {
+            auto c{ _text[pos] };
+            packed = (packed << 16) | c;
+            pos += c != L'\0' ? 1 : 0;
+        }
+        return packed;
+    };
+
+    std::vector<std::pair<uint64_t, uint32_t>> keyed_suffixes(_suffixes.size());
+    std::ranges::transform(_suffixes, std::begin(keyed_suffixes), [&packed_prefix](uint32_t pos) {
+        return std::pair{ packed_prefix(pos), pos }; });
+    std::ranges::sort(keyed_suffixes, [this](const auto& a, const auto& b) {
+        if (a.first != b.first) {
+            return a.first < b.first;
+        }
+        return std::wcscmp(_text.data() + a.second, _text.data() + b.second) < 0;
+    });
+    std::ranges::transform(keyed_suffixes, std::begin(_suffixes), [](const auto& ks) { return ks.second; });
+
+    _suffix_names.resize(_suffixes.size());
+    std::ranges::transform(_suffixes, std::begin(_suffix_names), [&position_names](uint32_t pos) { return position_names[pos]; });
+
+    std::ranges::stable_sort(_entries, {}, &entry::name_id);
+    _name_entries.assign(_names.size() + 1, 0);
+    for (const auto& e : _entries) {
+        _name_entries[e.name_id + 1]++;
+    }
+    std::partial_sum(std::begin(_name_entries), std::end(_name_entries), std::begin(_name_entries));
+
+    _guid_keys.clear();
+    flat_hash_set<GUID> seen_guids{};
+    for (uint32_t i = 0; i < _entries.size(); i++) {
+        if (_entries[i].kind != name_kind::method && seen_guids.insert(_entries[i].guid).second) {
+            _guid_keys.push_back({ key_of(_entries[i].guid), i });
+        }
+    }
+    std::ranges::sort(_guid_keys);
+}
+
+name_search_result name_index::find(std::wstring_view text, size_t max_results) const {
+    name_search_result result{};
+
+    auto query{ to_lower(text) };
+    if (query.empty()) {
+        return result;
+    }
+
+    auto suffix_at = [this](uint32_t pos) { return std::wstring_view{ _text.data() + pos }; };
+
+    // the suffixes that start with the query form a contiguous range of the suffix array
+    auto first{ std::ranges::lower_bound(_suffixes, std::wstring_view{ query }, {}, suffix_at) };
+    auto last{ std::partition_point(first, std::end(_suffixes), [&suffix_at, &query](uint32_t pos) {
+        return suffix_at(pos).starts_with(query); }) };
+
+    // exact matches come first, then the names that start with the query, then the others
+    constexpr uint8_t not_matched{ 3 };
+    std::vector<uint8_t> name_ranks(_names.size(), not_matched);
+    for (auto i{ static_cast<size_t>(first - std::begin(_suffixes)) }; i < static_cast<size_t>(last - std::begin(_suffixes)); i++) {
+        auto name_id{ _suffix_names[i] };
+        auto at_start{ _name_offsets[name_id] == _suffixes[i] };
+        uint8_t rank = at_start && _names[name_id].size() == query.size() ? 0 : at_start ? 1 : 2;
+        name_ranks[name_id] = std::min(name_ranks[name_id], rank);
+    }
+
+    std::vector<std::pair<uint8_t, uint32_t>> ranked_names{};
+    for (uint32_t name_id = 0; name_id < name_ranks.size(); name_id++) {
+        if (name_ranks[name_id] != not_matched) {
+            ranked_names.push_back({ name_ranks[name_id], name_id });
+        }
+    }
+
+    // each name has at least one entry, so only the first names need to be sorted
+    auto sorted_end{ std::begin(ranked_names) + static_cast<ptrdiff_t>(std::min(max_results, ranked_names.size())) };
+    std::ranges::partial_sort(std::begin(ranked_names), sorted_end, std::end(ranked_names), [this](const auto& a, const auto& b) {
+        return std::tuple{ a.first, _names[a.second].size(), _names[a.second] } < std::tuple{ b.first, _names[b.second].size(), _names[b.second] };
+    });
+
+    auto add_match = [this, &result, max_results](const entry& e) {
+        result.total_matches++;
+        if (result.matches.size() < max_results) {
+            result.matches.push_back({ e.kind, e.guid, _names[e.name_id] });
+        }
+    };
+
+    if (std::wstring digits{}; parse_guid_prefix(text, digits)) {
+        auto matches_prefix = [&digits](const std::pair<guid_key, uint32_t>& k) {
+            return std::wstring_view{ k.first.data(), k.first.size() }.starts_with(digits); };
+        auto guid_first{ std::ranges::lower_bound(_guid_keys, std::wstring_view{ digits }, {},
+            [](const std::pair<guid_key, uint32_t>& k) { return std::wstring_view{ k.first.data(), k.first.size() }; }) };
+        for (auto iter{ guid_first }; iter != std::end(_guid_keys) && matches_prefix(*iter); iter++) {
+            add_match(_entries[iter->second]);
+        }
+    }
+
+    for (auto iter{ std::begin(ranked_names) }; iter != sorted_end; iter++) {
+        for (auto i = _name_entries[iter->second]; i < _name_entries[iter->second + 1]; i++) {
+            add_match(_entries[i]);
+        }
+    }
+    for (auto iter{ sorted_end }; iter != std::end(ranked_names); iter++) {
+        result.total_matches += _name_entries[iter->second + 1] - _name_entries[iter->second];
+    }
+
+    return result;
+}
@@ -0,0 +1,99 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "comon.h"
+#include "string_pool.h"
+
+namespace comon_ext
+{
+enum class name_kind
+{
+    type,
+    coclass,
+    method
+};
+
+struct name_match
+{
+    name_kind kind;
+    // the IID for types and methods, the CLSID for classes
+    GUID guid;
+    std::wstring_view name;
+};
+
+struct name_search_result
+{
+    std::vector<name_match> matches;
+    // the number of all the matching entries, the matches are capped by the maximum number of results
+    size_t total_matches;
+};
+
+/*
+ * Search index over the type, class and method names. The lowercase names are stored once,
+ * one after another, and a suffix array over them answers case-insensitive substring queries
+ * with two binary searches. The IIDs and CLSIDs are also kept as sorted hex strings, so a
+ * GUID prefix ("{0002DF0", "0002df05-0000") finds the types and classes too. The index is
+ * immutable once built.
+*/
+class name_index
+{
+    using guid_key = std::array<wchar_t, 32>;
+
+    struct entry
+    {
+        name_kind kind;
+        GUID guid;
+        uint32_t name_id;
+    };
+
+    string_pool _pool{};
+    std::vector<std::wstring_view> _names{};
+    flat_hash_map<std::wstring_view, uint32_t> _name_ids{};
+    std::vector<entry> _entries{};
+
+    // lowercase names, each followed by L'\0', and the offset of each name in the text
+    std::wstring _text{};
+    std::vector<uint32_t> _name_offsets{};
+    std::vector<uint32_t> _suffixes{};
+    // the name of each suffix
+    std::vector<uint32_t> _suffix_names{};
+
+    // the entries sorted by name, the entries of the name i are in [_name_entries[i], _name_entries[i + 1])
+    std::vector<uint32_t> _name_entries{};
+    std::vector<std::pair<guid_key, uint32_t>> _guid_keys{};
+
+    static guid_key key_of(const GUID& guid);
+
+public:
+    void add(name_kind kind, const GUID& guid, std::wstring_view name);
+
+    void build();
+
+    name_search_result find(std::wstring_view text, size_t max_results) const;
+
+    size_t names_count() const { return _names.size(); }
+
+    size_t entries_count() const { return _entries.size(); }
+};
+}
@@ -0,0 +1,115 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <SQLiteCpp/Database.h>
+#include <SQLiteCpp/Statement.h>
+
+#include "flat_hash.h"
+
+namespace comon_ext
+{
+/*
+ * Registry of prepared statements for one database, keyed by the SQL text (which must be
+ * a string literal, as the keys are not copied). A statement is parsed and planned only on
+ * its first use; later uses borrow it, and it is reset and unbound when the lease ends.
+ * If the cached statement is still leased (a nested call runs the same SQL), the lease
+ * gets a fresh statement instead.
+*/
+class statement_cache
+{
+    struct cached_statement
+    {
+        SQLite::Statement statement;
+        bool in_use{};
+
+        cached_statement(SQLite::Database& db, const std::string& sql): statement{ db, sql } {}
+    };
+
+    SQLite::Database& _db;
+    flat_hash_map<std::string_view, std::unique_ptr<cached_statement>> _statements{};
+    size_t _fresh_statements{};
+
+public:
+    class lease
+    {
+        cached_statement* _cached{};
+        std::optional<SQLite::Statement> _fresh{};
+
+    public:
+        explicit lease(cached_statement& cached): _cached{ &cached } {
+            _cached->in_use = true;
+        }
+
+        lease(SQLite::Database& db, std::string_view sql): _fresh{ std::in_place, db, std::string{ sql } } {}
+
+        lease(const lease&) = delete;
+        lease& operator=(const lease&) = delete;
+
+        ~lease() {
+            if (_cached) {
+                // the bindNoCopy buffers must not outlive the lease
+                _cached->statement.tryReset();
+                try {
+                    _cached->statement.clearBindings();
+                } catch (const SQLite::Exception&) {
+                    // sqlite3_clear_bindings does not fail
+                }
+                _cached->in_use = false;
+            }
+        }
+
+        SQLite::Statement& operator*() { return _cached ? _cached->statement : *_fresh; }
+
+        SQLite::Statement* operator->() { return &**this; }
+    };
+
+    explicit statement_cache(SQLite::Database& db): _db{ db } {}
+
+    statement_cache(const statement_cache&) = delete;
+    statement_cache& operator=(const statement_cache&) = delete;
+
+    lease acquire(std::string_view sql) {
+        if (auto iter{ _statements.find(sql) }; iter != std::end(_statements)) {
+            if (!iter->second->in_use) {
+                return lease{ *iter->second };
+            }
+            _fresh_statements++;
+            return lease{ _db, sql };
+        }
+
+        // the statement is prepared before it is registered, so invalid SQL leaves no entry behind
+        auto cached{ std::make_unique<cached_statement>(_db, std::string{ sql }) };
+        return lease{ *_statements.try_emplace(sql, std::move(cached)).first->second };
+    }
+
+    // must be called before the schema objects used by the statements are dropped
+    void clear() {
+        _statements.clear();
+    }
+
+    size_t size() const { return _statements.size(); }
+
+    // the number of statements prepared because the cached one was in use
+    size_t fresh_statements() const { return _fresh_statements; }
+};
+}
@@ -0,0 +1,77 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+#include <cassert>
+
+#include <Windows.h>
+#include <wil/result.h>
+
+#include "string_pool.h"
+
+using namespace comon_ext;
+
+wchar_t* string_pool::allocate(size_t chars) {
+    if (chars > block_size / 4) {
+        // long strings get their own block, so they do not waste the rest of the current one
+        _allocated_chars += chars;
+        return _blocks.emplace_back(std::make_unique_for_overwrite<wchar_t[]>(chars)).get();
+    }
+
+    if (chars > _block_free) {
+        _block_cursor = _blocks.emplace_back(std::make_unique_for_overwrite<wchar_t[]>(block_size)).get();
+        _block_free = block_size;
+        _allocated_chars += block_size;
+    }
+
+    auto p{ _block_cursor };
+    _block_cursor += chars;
+    _block_free -= chars;
+    return p;
+}
+
+std::wstring_view string_pool::intern(std::wstring_view s) {
+    if (auto iter{ _strings.find(s) }; iter != std::end(_strings)) {
+        return *iter;
+    }
+
+    auto p{ allocate(s.size() + 1) };
+    std::ranges::copy(s, p);
+    p[s.size()] = L'\0';
+
+    std::wstring_view interned{ p, s.size() };
+    _strings.insert(interned);
+    return interned;
+}
+
+std::wstring_view string_pool::intern_utf8(std::string_view s) {
+    if (s.empty()) {
+        return intern({});
+    }
+
+    auto len{ ::MultiByteToWideChar(CP_UTF8, 0, s.data(), static_cast<int>(s.size()), nullptr, 0) };
+    if (len == 0) {
+        THROW_LAST_ERROR();
+    }
+
+    _conversion_buffer.resize(static_cast<size_t>(len));
+    if (len != ::MultiByteToWideChar(CP_UTF8, 0, s.data(), static_cast<int>(s.size()),
+        _conversion_buffer.data(), static_cast<int>(_conversion_buffer.size()))) {
+        THROW_LAST_ERROR();
+    }
+
+    return intern(_conversion_buffer);
+}
@@ -0,0 +1,67 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "flat_hash.h"
+
+namespace comon_ext
+{
+/*
+ * Append-only pool of interned strings. Each distinct string is stored once, null-terminated,
+ * in large blocks that are never moved or freed before the pool, so the returned views stay
+ * valid for the pool lifetime. Metadata names repeat a lot ("HRESULT", "void*", "GUID*",
+ * "this"), so the pool also saves memory compared to separate std::wstring copies.
+*/
+class string_pool
+{
+    static constexpr size_t block_size{ 16 * 1024 };
+
+    std::vector<std::unique_ptr<wchar_t[]>> _blocks{};
+    wchar_t* _block_cursor{};
+    size_t _block_free{};
+    size_t _allocated_chars{};
+
+    flat_hash_set<std::wstring_view> _strings{};
+
+    // reused by intern_utf8, so converting a name that is already interned does not allocate
+    std::wstring _conversion_buffer{};
+
+    wchar_t* allocate(size_t chars);
+
+public:
+    string_pool() = default;
+
+    string_pool(const string_pool&) = delete;
+    string_pool& operator=(const string_pool&) = delete;
+
+    string_pool(string_pool&&) = default;
+    string_pool& operator=(string_pool&&) = default;
+
+    std::wstring_view intern(std::wstring_view s);
+
+    std::wstring_view intern_utf8(std::string_view s);
+
+    size_t size() const { return _strings.size(); }
+
+    size_t allocated_bytes() const { return _allocated_chars * sizeof(wchar_t); }
+};
+}
@@ -0,0 +1,255 @@
+/*
+   Copyright 2022 Sebastian Solnica
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/*
+ * Upgrades fixture databases from every past schema version. A fixture starts in the oldest
+ * schema and reaches an older version through the steps up to it, as the new databases of
+ * the release that introduced that version did. Each step is checked for the rows it keeps.
+*/
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <memory>
+#include <span>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <SQLiteCpp/Database.h>
+#include <SQLiteCpp/Statement.h>
+
+#include <Windows.h>
+
+#include "cometa_schema.h"
+#include "cometa_signature.h"
+
+using namespace comon_ext;
+
+#define TEST_CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+namespace
+{
+void check(bool condition, const char* expression, const char* file, int line) {
+    if (!condition) {
+        std::fprintf(stderr, "%s(%d): check failed: %s\n", file, line, expression);
+        std::exit(1);
+    }
+}
+
+// an interface with methods, its parent without them, and a class
+constexpr GUID fixture_iid{ 0x6f1c0b1e, 0x3d0a, 0x4c1b, { 0x9e, 0x51, 0x2a, 0x7d, 0x40, 0x13, 0x8c, 0x01 } };
+constexpr GUID fixture_parent_iid{ 0x6f1c0b1e, 0x3d0a, 0x4c1b, { 0x9e, 0x51, 0x2a, 0x7d, 0x40, 0x13, 0x8c, 0x02 } };
+constexpr GUID fixture_clsid{ 0x6f1c0b1e, 0x3d0a, 0x4c1b, { 0x9e, 0x51, 0x2a, 0x7d, 0x40, 0x13, 0x8c, 0x03 } };
+
+int64_t count_rows(SQLite::Database& db, const std::string& query) {
+    return db.execAndGet(query).getInt64();
+}
+
+std::string blob_literal(const GUID& guid) {
+    std::string literal{ "x'" };
+    for (auto b : std::span{ reinterpret_cast<const uint8_t*>(&guid), sizeof(GUID) }) {
+        literal += std::format("{:02x}", b);
+    }
+    return literal + "'";
+}
+
+std::unique_ptr<SQLite::Database> make_fixture(int version) {
+    auto db{ std::make_unique<SQLite::Database>(":memory:", SQLite::OPEN_CREATE | SQLite::OPEN_READWRITE) };
+    create_base_schema(*db);
+
+    db->exec(std::format(R"(insert into cotypes (iid, type, name, parent_iid, methods_available)
+values ({0}, 0, 'IFixture', {1}, 1), ({1}, 0, 'IFixtureBase', {3}, 0);
+insert into cotype_methods (iid, ordinal, name, callconv, dispid, return_type)
+values ({0}, 0, 'Get', {4}, null, 'HRESULT'), ({0}, 1, 'Invoke', {4}, 5, 'HRESULT');
+insert into cotype_method_args (iid, method_ordinal, name, ordinal, type, flags)
+values ({0}, 0, 'index', 0, 'long', {5}), ({0}, 0, 'value', 1, 'BSTR*', {6}), ({0}, 1, 'flags', 0, 'DWORD', {5});
+insert into coclasses (clsid, name) values ({2}, 'Fixture');
+insert into vtables (clsid, iid, module_name, module_timestamp, vtable)
+values ({2}, {0}, 'fixture.dll', 1234, 4096), ({2}, {1}, 'fixture.dll', 1234, 8192))",
+        blob_literal(fixture_iid), blob_literal(fixture_parent_iid), blob_literal(fixture_clsid), blob_literal(__uuidof(IUnknown)),
+        static_cast<int>(CC_STDCALL), IDLFLAG_FIN, IDLFLAG_FOUT));
+
+    for (const auto& migration : get_schema_migrations()) {
+        if (migration.from_version < version) {
+            migration.upgrade(*db);
+        }
+    }
+    db->exec(std::format("update schema_version set version = {}", version));
+    return db;
+}
+
+// the whole schema, to compare an upgraded database with a new one
+std::vector<std::string> schema_of(SQLite::Database& db) {
+    std::vector<std::string> objects{};
+    SQLite::Statement query{ db, "select type, name, coalesce(sql, '') from sqlite_master order by type, name" };
+    while (query.executeStep()) {
+        objects.push_back(std::format("{} {}: {}", query.getColumn(0).getText(), query.getColumn(1).getText(), query.getColumn(2).getText()));
+    }
+    return objects;
+}
+
+void check_signature(SQLite::Database& db) {
+    // the interface without methods gets no signature
+    TEST_CHECK(count_rows(db, "select count(*) from cotype_signatures") == 1);
+
+    SQLite::Statement query{ db, "select signature from cotype_signatures where iid = :iid" };
+    query.bind(":iid", &fixture_iid, sizeof(GUID));
+    TEST_CHECK(query.executeStep());
+
+    string_pool names{};
+    auto column{ query.getColumn(0) };
+    auto decoded{ signature::decode({ static_cast<const std::byte*>(column.getBlob()), static_cast<size_t>(column.getBytes()) }, fixture_iid, names) };
+    TEST_CHECK(std::holds_alternative<std::vector<covtable_method>>(decoded));
+
+    const auto& methods{ std::get<std::vector<covtable_method>>(decoded) };
+    TEST_CHECK(methods.size() == 2);
+    TEST_CHECK(methods[0].method.name == L"Get" && methods[0].method.ordinal == 0 && methods[0].method.callconv == CC_STDCALL &&
+        !methods[0].method.dispid && methods[0].method.return_type == L"HRESULT");
+    TEST_CHECK(methods[0].args.size() == 2 && methods[0].args[0].name == L"index" && methods[0].args[1].name == L"value" &&
+        methods[0].args[1].type == L"BSTR*" && methods[0].args[1].flags == IDLFLAG_FOUT);
+    TEST_CHECK(methods[1].method.name == L"Invoke" && methods[1].method.ordinal == 1 && methods[1].method.dispid == 5 &&
+        methods[1].args.size() == 1 && methods[1].args[0].flags == IDLFLAG_FIN);
+}
+
+void check_vtables(SQLite::Database& db) {
+    TEST_CHECK(count_rows(db, "select count(*) from vtables") == 2);
+    TEST_CHECK(count_rows(db, std::format(R"(select count(*) from vtables where clsid = {} and module_name = 'fixture.dll'
+and module_timestamp = 1234 and (iid = {} and vtable = 4096 or iid = {} and vtable = 8192))",
+        blob_literal(fixture_clsid), blob_literal(fixture_iid), blob_literal(fixture_parent_iid))) == 2);
+}
+
+// the rows each step must leave, in the order of the steps
+struct step_check
+{
+    int from_version;
+    void (*check)(SQLite::Database& db);
+};
+
+constexpr std::array step_checks{
+    step_check{ 5, [](SQLite::Database& db) {
+        TEST_CHECK(db.tableExists("typelibs") && count_rows(db, "select count(*) from typelibs") == 0);
+        TEST_CHECK(count_rows(db, "select count(*) from typelib_guids where path = ''") == 2);
+    } },
+    step_check{ 6, [](SQLite::Database& db) {
+        TEST_CHECK(!db.tableExists("cotype_methods") && !db.tableExists("cotype_method_args"));
+        check_signature(db);
+    } },
+    step_check{ 7, [](SQLite::Database& db) {
+        TEST_CHECK(count_rows(db, "select count(*) from sqlite_master where type = 'index' and name = 'IX_vtables_module'") == 1);
+        TEST_CHECK(count_rows(db, "select count(*) from sqlite_master where type = 'index' and name = 'IX_vtables_module_name'") == 0);
+        check_vtables(db);
+    } },
+    step_check{ 8, [](SQLite::Database& db) {
+        check_vtables(db);
+        TEST_CHECK(count_rows(db, "select count(*) from vtables where arch = 0") == 2);
+        TEST_CHECK(count_rows(db, "select count(*) from pragma_index_info('IX_vtables_iid') where name = 'arch'") == 1);
+        TEST_CHECK(count_rows(db, "select count(*) from pragma_index_info('IX_vtables_module') where name = 'arch'") == 1);
+    } },
+    step_check{ 9, [](SQLite::Database& db) {
+        TEST_CHECK(db.tableExists("base_database") && count_rows(db, "select count(*) from base_database") == 0);
+    } },
+    step_check{ 10, [](SQLite::Database& db) {
+        TEST_CHECK(db.tableExists("base_tombstones") && count_rows(db, "select count(*) from base_tombstones") == 0);
+    } },
+    step_check{ 11, [](SQLite::Database& db) {
+        TEST_CHECK(count_rows(db, "select count(*) from pragma_table_info('typelibs') where name = 'arch'") == 1);
+        TEST_CHECK(count_rows(db, "select count(*) from cotype_signatures where arch = 0") == 1);
+        check_signature(db);
+    } },
+};
+
+void test_each_step() {
+    auto migrations{ get_schema_migrations() };
+    TEST_CHECK(migrations.size() == step_checks.size());
+
+    auto db{ make_fixture(base_schema_version) };
+    for (size_t i = 0; i < migrations.size(); i++) {
+        TEST_CHECK(migrations[i].from_version == step_checks[i].from_version);
+        migrations[i].upgrade(*db);
+        step_checks[i].check(*db);
+    }
+}
+
+void test_upgrade_from_every_version() {
+    auto new_db{ std::make_unique<SQLite::Database>(":memory:", SQLite::OPEN_CREATE | SQLite::OPEN_READWRITE) };
+    create_base_schema(*new_db);
+    upgrade_schema(*new_db, base_schema_version, nullptr);
+    auto new_schema{ schema_of(*new_db) };
+
+    for (int version = base_schema_version; version < schema_version; version++) {
+        auto db{ make_fixture(version) };
+
+        auto buffer{ std::make_shared<output_buffer>() };
+        dbgeng_logger log{ buffer };
+        upgrade_schema(*db, version, &log);
+
+        // a line per step and the summary
+        TEST_CHECK(buffer->take().size() == static_cast<size_t>(schema_version - version) + 1);
+
+        TEST_CHECK(db->execAndGet("select version from schema_version").getInt() == schema_version);
+        TEST_CHECK(schema_of(*db) == new_schema);
+
+        TEST_CHECK(count_rows(*db, "select count(*) from cotypes") == 2);
+        TEST_CHECK(count_rows(*db, "select count(*) from coclasses") == 1);
+        TEST_CHECK(count_rows(*db, "select count(*) from vtables where arch = 0") == 2);
+        check_vtables(*db);
+        check_signature(*db);
+    }
+}
+
+void test_failed_step_rolls_back() {
+    auto db{ make_fixture(7) };
+    db->exec("drop index IX_vtables_module_name");
+
+    bool failed{};
+    try {
+        upgrade_schema(*db, 7, nullptr);
+    } catch (const SQLite::Exception&) {
+        failed = true;
+    }
+    TEST_CHECK(failed);
+    TEST_CHECK(db->execAndGet("select version from schema_version").getInt() == 7);
+    TEST_CHECK(count_rows(*db, "select count(*) from sqlite_master where type = 'index' and name = 'IX_vtables_module'") == 0);
+    check_vtables(*db);
+}
+
+void test_schema_version_check() {
+    // an upgrade must leave exactly one version row
+    auto db{ make_fixture(10) };
+    db->exec("insert into schema_version (version) values (10)");
+
+    bool failed{};
+    try {
+        upgrade_schema(*db, 10, nullptr);
+    } catch (const std::runtime_error&) {
+        failed = true;
+    }
+    TEST_CHECK(failed);
+    TEST_CHECK(!db->tableExists("base_tombstones"));
+}
+}
+
+int main() {
+    test_each_step();
+    test_upgrade_from_every_version();
+    test_failed_step_rolls_back();
+    test_schema_version_check();
+
+    std::printf("schema migration tests passed\n");
+    return 0;
+}